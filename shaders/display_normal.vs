@@ -1,19 +1,61 @@
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
+#ifdef NORMAL_OCT16
+layout (location = 1) in vec2 aNormal_oct;
+#else
 layout (location = 1) in vec3 aNormal;
+#endif
 
 out VS_OUT {
 	vec3 normal;
 } vs_out;
 
-uniform mat4 projection;
-uniform mat4 view;
+// per-object transform of merged geometry draws, identity for everything else
+layout (location = 12) in mat4 object_transform;
+
 uniform mat4 model;
 
+struct Light {
+	vec4 position;
+	vec4 direction;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 attenuation;
+};
+
+layout (std140) uniform FrameData {
+	mat4  view;
+	mat4  projection;
+	mat4  view_projection;
+	vec4  camera_pos;
+	ivec4 light_count;
+	Light lights[8];
+};
+
+// meshes imported with "oct16" normals store two octahedral components; programs drawing
+// them are built with the NORMAL_OCT16 define
+vec3 DecodeNormal(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+vec3 ObjectNormal()
+{
+#ifdef NORMAL_OCT16
+	return DecodeNormal(aNormal_oct);
+#else
+	return aNormal;
+#endif
+}
+
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
-	mat3 normalMatrix = mat3(transpose(inverse(view * model)));
-	vs_out.normal = normalize(vec3(projection * vec4(normalMatrix * aNormal, 1.0)));
+	gl_Position = view_projection * model * object_transform * vec4(aPos, 1.0);
+	mat3 normalMatrix = mat3(transpose(inverse(view * model * object_transform)));
+	vs_out.normal = normalize(vec3(projection * vec4(normalMatrix * ObjectNormal(), 1.0)));
 }
\ No newline at end of file
@@ -7,14 +7,34 @@ in vec3 obj_color;
 
 out vec4 frag_color;
 
+// used when the scene defines no lights
 uniform vec3 light_pos;
 
+struct Light {
+	vec4 position;
+	vec4 direction;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 attenuation;
+};
+
+layout (std140) uniform FrameData {
+	mat4  view;
+	mat4  projection;
+	mat4  view_projection;
+	vec4  camera_pos;
+	ivec4 light_count;
+	Light lights[8];
+};
+
 void main()
 {
 	float ambient_strength = 0.1;
 	vec3 ambient = ambient_strength * light_color;
 	vec3 norm = normalize(frag_normal);
-	vec3 light_dir = normalize(light_pos - frag_pos);
+	vec3 light_view_pos = light_count.x > 0 ? vec3(view * vec4(lights[0].position.xyz, 1.0)) : light_pos;
+	vec3 light_dir = normalize(light_view_pos - frag_pos);
 	float diff = max(dot(norm, light_dir), 0.0);
 	vec3 diffuse = diff * light_color;
 	frag_color = vec4((ambient+diffuse) * obj_color, 1.0);
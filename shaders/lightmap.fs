@@ -5,7 +5,26 @@ in vec3 frag_pos;
 in vec3 frag_normal;
 in vec2 frag_texcoord;
 
+// used when the scene defines no lights
 uniform vec3 light_pos;
+
+struct Light {
+	vec4 position;
+	vec4 direction;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 attenuation;
+};
+
+layout (std140) uniform FrameData {
+	mat4  view;
+	mat4  projection;
+	mat4  view_projection;
+	vec4  camera_pos;
+	ivec4 light_count;
+	Light lights[8];
+};
 uniform sampler2D diffuse_map;
 
 out vec4 frag_color;
@@ -14,7 +33,8 @@ void main()
 {
 	float ambient_strength = 0.1;
 	vec3 ambient = ambient_strength * light_color;
-	vec3 light_dir = normalize(light_pos - frag_pos);
+	vec3 light_view_pos = light_count.x > 0 ? vec3(view * vec4(lights[0].position.xyz, 1.0)) : light_pos;
+	vec3 light_dir = normalize(light_view_pos - frag_pos);
 	float diffuse_strength = max(0.0, dot(light_dir, normalize(frag_normal)));
 	vec3 diffuse = diffuse_strength * light_color;
 	frag_color = vec4((ambient+diffuse) * vec3(texture(diffuse_map, frag_texcoord)), 1.0);
@@ -1,20 +1,62 @@
 #version 330 core
 
 layout (location = 0) in vec3 position;
+#ifdef NORMAL_OCT16
+layout (location = 1) in vec2 normal_oct;
+#else
 layout (location = 1) in vec3 normal;
+#endif
 layout (location = 3) in vec2 texcoord;
 
 out vec3 frag_pos;
 out vec3 frag_normal;
 out vec2 frag_texcoord;
 
+// per-object transform of merged geometry draws, identity for everything else
+layout (location = 12) in mat4 object_transform;
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+struct Light {
+	vec4 position;
+	vec4 direction;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 attenuation;
+};
+
+layout (std140) uniform FrameData {
+	mat4  view;
+	mat4  projection;
+	mat4  view_projection;
+	vec4  camera_pos;
+	ivec4 light_count;
+	Light lights[8];
+};
+
+// meshes imported with "oct16" normals store two octahedral components; programs drawing
+// them are built with the NORMAL_OCT16 define
+vec3 DecodeNormal(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+vec3 ObjectNormal()
+{
+#ifdef NORMAL_OCT16
+	return DecodeNormal(normal_oct);
+#else
+	return normal;
+#endif
+}
 
 void main() {
-	gl_Position = projection * view * model * vec4(position, 1.0);
-	frag_pos = vec3(view * model * vec4(position, 1.0));
-	frag_normal = mat3(transpose(inverse(view*model))) * normal;
+	gl_Position = view_projection * model * object_transform * vec4(position, 1.0);
+	frag_pos = vec3(view * model * object_transform * vec4(position, 1.0));
+	frag_normal = mat3(transpose(inverse(view * model * object_transform))) * ObjectNormal();
 	frag_texcoord = texcoord;
 }
\ No newline at end of file
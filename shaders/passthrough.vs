@@ -3,12 +3,31 @@ layout (location=0) in vec3 position;
 
 out vec4 vertex_color;
 
+// per-object transform of merged geometry draws, identity for everything else
+layout (location = 12) in mat4 object_transform;
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+struct Light {
+	vec4 position;
+	vec4 direction;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 attenuation;
+};
+
+layout (std140) uniform FrameData {
+	mat4  view;
+	mat4  projection;
+	mat4  view_projection;
+	vec4  camera_pos;
+	ivec4 light_count;
+	Light lights[8];
+};
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(position, 1.0);
+	gl_Position = view_projection * model * object_transform * vec4(position, 1.0);
 	vertex_color = vec4(0.5, 0.0, 0.0, 1.0);
 }
\ No newline at end of file
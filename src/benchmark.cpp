@@ -0,0 +1,222 @@
+#include "benchmark.h"
+#include "window.h"
+#include "renderer.h"
+#include "renderpass.h"
+#include "camera.h"
+#include "scene.h"
+#include "geometry.h"
+#include "profiler.h"
+#include "jobsystem.h"
+
+#include <json/json.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+
+using json = nlohmann::json;
+
+Benchmark::Benchmark(WindowPtr window, const Settings& settings)
+    : _window(window),
+    _settings(settings)
+{
+}
+
+void Benchmark::MoveCamera(int frame)
+{
+    auto& path = _settings.camera_path;
+    CameraPtr camera = _window->GetRenderer()->GetCamera();
+    if (path.empty() || camera == nullptr)
+        return;
+
+    float t = 0.0f;
+    if (path.size() > 1 && _settings.frames > 1)
+        t = float(frame) / float(_settings.frames - 1) * float(path.size() - 1);
+    size_t key = std::min(size_t(t), path.size() - 1);
+    size_t next = std::min(key + 1, path.size() - 1);
+    float f = t - float(key);
+
+    const CameraKeyframe& a = path[key];
+    const CameraKeyframe& b = path[next];
+    camera->LookAt(glm::mix(a.pos, b.pos, f), glm::mix(a.focus, b.focus, f), glm::normalize(glm::mix(a.up, b.up, f)));
+}
+
+static void SpinInstances(void* data, uint32_t count, const glm::mat4& spin)
+{
+    glm::mat4* transforms = static_cast<glm::mat4*>(data);
+    if (transforms == nullptr)
+        return;
+    JobSystem* jobs = JobSystem::GetInstance();
+    jobs->ParallelFor(count, jobs->GetBatchCount(count, 4096), [transforms, &spin](uint32_t, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+            transforms[i] = transforms[i] * spin;
+    });
+}
+
+double Benchmark::UpdateInstances(int frame)
+{
+    using clock = std::chrono::high_resolution_clock;
+
+    ScenePtr scene = _window->GetRenderer()->GetScene();
+    if (_settings.instance_updates <= 0 || scene == nullptr)
+        return 0.0;
+
+    // turns the instances a little around their own up axis; each frame takes the range after
+    // the one of the previous frame, so the rings see partial updates
+    const glm::mat4 spin = glm::rotate(0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+    auto start = clock::now();
+    for (auto& g : scene->GetGeometries()) {
+        uint32_t total = g->GetInstanceNum();
+        if (!g->HasDynamicInstances() || total == 0)
+            continue;
+        uint32_t updates = std::min(total, (uint32_t)_settings.instance_updates);
+        uint32_t first = uint32_t(uint64_t(frame) * updates % total);
+        uint32_t head = std::min(updates, total - first);
+        for (size_t s = 0; s < g->GetInstanceStreamCount(); s++) {
+            if (g->GetInstanceStride(s) != sizeof(glm::mat4))
+                continue;
+            SpinInstances(g->UpdateInstanceData(s, first, head), head, spin);
+            if (updates > head)
+                SpinInstances(g->UpdateInstanceData(s, 0, updates - head), updates - head, spin);
+        }
+    }
+    return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+}
+
+static InstanceBufferRing::Stats SumRingStats(const ScenePtr& scene)
+{
+    InstanceBufferRing::Stats sum = { 0, 0, 0, 0 };
+    for (auto& g : scene->GetGeometries()) {
+        for (size_t s = 0; s < g->GetInstanceStreamCount(); s++) {
+            const InstanceBufferRing* ring = g->GetInstanceRing(s);
+            if (ring == nullptr)
+                continue;
+            sum.slots = std::max(sum.slots, ring->GetStats().slots);
+            sum.grown += ring->GetStats().grown;
+            sum.waits += ring->GetStats().waits;
+            sum.bytes_copied += ring->GetStats().bytes_copied;
+        }
+    }
+    return sum;
+}
+
+json Benchmark::RunInstanceUpdates()
+{
+    using clock = std::chrono::high_resolution_clock;
+    auto ms = [](clock::time_point start) { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+    ScenePtr scene = _window->GetRenderer()->GetScene();
+    if (scene == nullptr)
+        return json();
+
+    // without a glFinish per frame the GPU falls behind as it would in an application, so
+    // the rings have to find slots the GPU is done with, grow or wait
+    InstanceBufferRing::Stats before = SumRingStats(scene);
+    std::vector<double> write_times, cpu_times;
+    auto run_start = clock::now();
+    for (int i = 0; i < _settings.frames; i++) {
+        MoveCamera(i);
+        auto start = clock::now();
+        write_times.push_back(UpdateInstances(i));
+        _window->RenderFrame();
+        cpu_times.push_back(ms(start));
+    }
+    glFinish();
+    double run_ms = ms(run_start);
+    InstanceBufferRing::Stats after = SumRingStats(scene);
+
+    int frames = std::max(1, _settings.frames);
+    double write_mean = std::accumulate(write_times.begin(), write_times.end(), 0.0) / frames;
+    double cpu_mean = std::accumulate(cpu_times.begin(), cpu_times.end(), 0.0) / frames;
+    double copied_mb = double(after.bytes_copied - before.bytes_copied) / (1024.0 * 1024.0) / frames;
+    printf("[INSTANCES] %d updates per frame over %d frames: written in %.3f ms, CPU frame %.3f ms, "
+        "%.1f MB uploaded per frame, %u ring slots (%u added), %u waits\n", _settings.instance_updates, frames,
+        write_mean, cpu_mean, copied_mb, after.slots, after.grown - before.grown, after.waits - before.waits);
+
+    return {
+        { "per_frame", _settings.instance_updates },
+        { "frames", _settings.frames },
+        { "write_ms_mean", write_mean },
+        { "write_ms_max", write_times.empty() ? 0.0 : *std::max_element(write_times.begin(), write_times.end()) },
+        { "cpu_frame_ms_mean", cpu_mean },
+        { "cpu_frame_ms_max", cpu_times.empty() ? 0.0 : *std::max_element(cpu_times.begin(), cpu_times.end()) },
+        { "total_ms", run_ms },
+        { "ring_slots", after.slots },
+        { "ring_slots_grown", after.grown - before.grown },
+        { "ring_waits", after.waits - before.waits },
+        { "uploaded_mb_per_frame", copied_mb }
+    };
+}
+
+bool Benchmark::Run(const std::string& config, int width, int height)
+{
+    using clock = std::chrono::high_resolution_clock;
+
+    _window->Initialize();
+
+    MoveCamera(0);
+    for (int i = 0; i < _settings.warmup; i++)
+        _window->RenderFrame();
+    glFinish();
+
+    std::vector<double> times;
+    times.reserve(_settings.frames);
+    for (int i = 0; i < _settings.frames; i++) {
+        MoveCamera(i);
+        auto start = clock::now();
+        _window->RenderFrame();
+        glFinish();
+        times.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+    }
+    json instance_results;
+    if (_settings.instance_updates > 0)
+        instance_results = RunInstanceUpdates();
+    PROFILE_SHUTDOWN();
+
+    if (times.empty()) {
+        std::cout << "no frames were measured" << std::endl;
+        return false;
+    }
+
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) {
+        return sorted[std::min(sorted.size() - 1, size_t(p * (sorted.size() - 1) + 0.5))];
+    };
+
+    const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    json result;
+    result["config"] = config;
+    result["gl_renderer"] = renderer ? renderer : "";
+    result["gl_version"] = version ? version : "";
+    result["width"] = width;
+    result["height"] = height;
+    result["headless"] = _window->IsHeadless();
+    result["warmup_frames"] = _settings.warmup;
+    result["frames"] = _settings.frames;
+    result["camera_keyframes"] = _settings.camera_path.size();
+    result["frame_time_ms"] = {
+        { "min", sorted.front() },
+        { "median", percentile(0.5) },
+        { "p99", percentile(0.99) },
+        { "max", sorted.back() },
+        { "mean", std::accumulate(times.begin(), times.end(), 0.0) / times.size() }
+    };
+    result["frame_times_ms"] = times;
+
+    if (_settings.instance_updates > 0)
+        result["instance_updates"] = instance_results;
+
+    std::cout << "benchmark " << config << ": " << times.size() << " frames, min " << sorted.front()
+        << " ms, median " << percentile(0.5) << " ms, p99 " << percentile(0.99) << " ms" << std::endl;
+
+    std::ofstream out(_settings.output);
+    if (!out.is_open()) {
+        std::cout << "failed to write " << _settings.output << std::endl;
+        return false;
+    }
+    out << result.dump(2) << std::endl;
+    return bool(out);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.h"
+
+#include <json/json.hpp>
+
+struct CameraKeyframe {
+    glm::vec3 pos;
+    glm::vec3 focus;
+    glm::vec3 up;
+};
+
+// Renders a fixed number of frames and reports their times. Every frame is finished with
+// glFinish, so a frame time covers the GPU work as well. An optional camera path, interpolated
+// linearly between its keyframes over the measured frames, makes runs repeatable. With
+// instance_updates a second run rewrites the transforms of that many dynamic instances before
+// every frame, moving through the instances from frame to frame. That run does not finish its
+// frames, so the instance buffer rings see a GPU lagging behind the CPU.
+class Benchmark {
+public:
+    struct Settings {
+        Settings() : frames(300), warmup(10), instance_updates(0), output("gfxlab_benchmark.json") {}
+        int                          frames;
+        int                          warmup;       // rendered before the measured frames
+        int                          instance_updates;    // per dynamic instanced geometry and frame
+        std::vector<CameraKeyframe>  camera_path;
+        std::string                  output;
+    };
+
+    Benchmark(WindowPtr window, const Settings& settings);
+
+    // renders the warmup and measured frames and writes the results as JSON
+    bool      Run(const std::string& config, int width, int height);
+
+private:
+    void      MoveCamera(int frame);
+    // returns the milliseconds spent writing the instances
+    double    UpdateInstances(int frame);
+    // renders the frames again with instance updates and returns the results
+    nlohmann::json RunInstanceUpdates();
+
+    WindowPtr  _window;
+    Settings   _settings;
+};
@@ -0,0 +1,141 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cassert>
+
+void BVH::Build(const std::vector<AABB>& items)
+{
+    _nodes.clear();
+    _items.resize(items.size());
+    _itemBounds = items;
+    _leafOfItem.assign(items.size(), -1);
+    for (uint32_t i = 0; i < items.size(); i++)
+        _items[i] = i;
+
+    if (!items.empty()) {
+        _nodes.reserve(2 * items.size());
+        BuildRecursive(-1, 0, (uint32_t)items.size(), items);
+    }
+}
+
+int32_t BVH::BuildRecursive(int32_t parent, uint32_t first, uint32_t count, const std::vector<AABB>& items)
+{
+    int32_t index = (int32_t)_nodes.size();
+    _nodes.push_back(Node());
+
+    AABB bounds, centers;
+    for (uint32_t i = first; i < first + count; i++) {
+        bounds.Extend(items[_items[i]]);
+        glm::vec3 c = items[_items[i]].Center();
+        centers.Extend(AABB(c, c));
+    }
+
+    Node node;
+    node.bounds = bounds;
+    node.parent = parent;
+    node.left = node.right = -1;
+    node.first = first;
+    node.count = count;
+
+    if (count > MAX_LEAF_ITEMS) {
+        // median split along the longest axis of the item centers
+        glm::vec3 extent = centers.max - centers.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        uint32_t half = count / 2;
+        std::nth_element(_items.begin() + first, _items.begin() + first + half, _items.begin() + first + count,
+            [&](uint32_t a, uint32_t b) { return items[a].Center()[axis] < items[b].Center()[axis]; });
+
+        node.left = BuildRecursive(index, first, half, items);
+        node.right = BuildRecursive(index, first + half, count - half, items);
+        node.count = 0;
+    }
+    else {
+        for (uint32_t i = first; i < first + count; i++)
+            _leafOfItem[_items[i]] = index;
+    }
+
+    _nodes[index] = node;
+    return index;
+}
+
+void BVH::Refit(uint32_t item, const AABB& bounds)
+{
+    assert(item < _leafOfItem.size());
+    _itemBounds[item] = bounds;
+
+    for (int32_t index = _leafOfItem[item]; index >= 0; index = _nodes[index].parent) {
+        Node& node = _nodes[index];
+        AABB refit;
+        if (node.left < 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+                refit.Extend(_itemBounds[_items[i]]);
+        }
+        else {
+            refit = _nodes[node.left].bounds;
+            refit.Extend(_nodes[node.right].bounds);
+        }
+
+        // ancestors already enclose the unchanged box
+        if (refit.min == node.bounds.min && refit.max == node.bounds.max)
+            break;
+        node.bounds = refit;
+    }
+}
+
+void BVH::CollectItems(int32_t index, std::vector<uint32_t>& visible) const
+{
+    const Node& node = _nodes[index];
+    if (node.left < 0)
+        visible.insert(visible.end(), _items.begin() + node.first, _items.begin() + node.first + node.count);
+    else {
+        CollectItems(node.left, visible);
+        CollectItems(node.right, visible);
+    }
+}
+
+void BVH::Query(const Frustum& frustum, std::vector<uint32_t>& visible, Stats* stats) const
+{
+    size_t visible_before = visible.size();
+    uint32_t visited = 0;
+
+    if (!_nodes.empty()) {
+        struct Entry { int32_t node; uint32_t mask; };
+        Entry stack[64];
+        int top = 0;
+        stack[top++] = { 0, Frustum::ALL_PLANES };
+
+        while (top > 0) {
+            Entry e = stack[--top];
+            const Node& node = _nodes[e.node];
+            visited++;
+
+            Frustum::Result result = frustum.Classify(node.bounds, e.mask);
+            if (result == Frustum::OUTSIDE)
+                continue;
+
+            // fully inside: the whole subtree is visible without further tests
+            if (result == Frustum::INSIDE || node.left < 0) {
+                if (node.left < 0 && result == Frustum::INTERSECT) {
+                    for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                        uint32_t mask = e.mask;
+                        if (frustum.Classify(_itemBounds[_items[i]], mask) != Frustum::OUTSIDE)
+                            visible.push_back(_items[i]);
+                    }
+                }
+                else
+                    CollectItems(e.node, visible);
+                continue;
+            }
+
+            assert(top + 2 <= 64);
+            stack[top++] = { node.right, e.mask };
+            stack[top++] = { node.left, e.mask };
+        }
+    }
+
+    if (stats) {
+        stats->nodes_visited = visited;
+        stats->items_visible = (uint32_t)(visible.size() - visible_before);
+        stats->items_culled = (uint32_t)_leafOfItem.size() - stats->items_visible;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "frustum.h"
+
+#include <vector>
+
+// Bounding volume hierarchy over the world space bounds of the scene geometries. Items are
+// identified by their index in the array passed to Build. Moving an item refits the boxes
+// on its path to the root; the tree topology is only rebuilt on Build.
+class BVH {
+public:
+    struct Stats {
+        uint32_t nodes_visited;
+        uint32_t items_visible;
+        uint32_t items_culled;
+    };
+
+    void          Build(const std::vector<AABB>& items);
+    void          Refit(uint32_t item, const AABB& bounds);
+    // appends the items overlapping the frustum to 'visible'
+    void          Query(const Frustum& frustum, std::vector<uint32_t>& visible, Stats* stats = nullptr) const;
+    size_t        GetItemCount() const { return _leafOfItem.size(); }
+
+private:
+    struct Node {
+        AABB     bounds;
+        int32_t  parent;
+        int32_t  left;      // -1 for leaves
+        int32_t  right;
+        uint32_t first;     // leaf item range inside _items
+        uint32_t count;
+    };
+
+    static const uint32_t MAX_LEAF_ITEMS = 2;
+
+    int32_t       BuildRecursive(int32_t parent, uint32_t first, uint32_t count, const std::vector<AABB>& items);
+    void          CollectItems(int32_t node, std::vector<uint32_t>& visible) const;
+
+    std::vector<Node>     _nodes;
+    std::vector<uint32_t> _items;
+    std::vector<AABB>     _itemBounds;
+    std::vector<int32_t>  _leafOfItem;
+};
@@ -20,6 +20,7 @@ public:
     const glm::mat4& GetViewMatrix()                  const { return _view; }
     const glm::mat4& GetProjectionMatrix()            const { return _projection; }
     const glm::vec3& GetPosition()                    const { return _position; }
+    int              GetViewHeight()                  const { return _viewHeight; }
 
 
 
@@ -0,0 +1,120 @@
+#include "filewatcher.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstring>
+
+FileWatcher::FileWatcher()
+#ifdef __linux__
+    : _inotify(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+    if (_inotify < 0)
+        std::cout << "inotify_init1 failed: " << strerror(errno) << std::endl;
+}
+#else
+    : _lastPoll(std::chrono::steady_clock::now())
+{
+}
+#endif
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (_inotify >= 0)
+        close(_inotify);
+#endif
+}
+
+std::string FileWatcher::Normalize(const std::string& path)
+{
+    // the resource folders are joined with '/', leaving "//" and mixed separators behind
+    std::string result;
+    for (char c : path) {
+        if (c == '\\')
+            c = '/';
+        if (c == '/' && !result.empty() && result.back() == '/')
+            continue;
+        result += c;
+    }
+    size_t pos;
+    while ((pos = result.find("/./")) != std::string::npos)
+        result.erase(pos, 2);
+    return result;
+}
+
+int64_t FileWatcher::GetModificationTime(const std::string& path)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0)
+        return -1;
+    return (int64_t)sb.st_mtime;
+}
+
+void FileWatcher::AddFile(const std::string& path)
+{
+    std::string normalized = Normalize(path);
+    if (_files.find(normalized) != _files.end())
+        return;
+    _files[normalized] = path;
+
+#ifdef __linux__
+    if (_inotify < 0)
+        return;
+    size_t slash = normalized.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : normalized.substr(0, slash);
+    int wd = inotify_add_watch(_inotify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
+        std::cout << "failed to watch " << dir << ": " << strerror(errno) << std::endl;
+    else
+        _dirs[wd] = dir;
+#else
+    _mtimes[normalized] = GetModificationTime(path);
+#endif
+}
+
+void FileWatcher::Poll(std::vector<std::string>& changed)
+{
+    std::unordered_set<std::string> unique;
+
+#ifdef __linux__
+    if (_inotify < 0)
+        return;
+
+    alignas(inotify_event) char buffer[4096];
+    for (;;) {
+        ssize_t len = read(_inotify, buffer, sizeof(buffer));
+        if (len <= 0)
+            break;
+        for (char* p = buffer; p < buffer + len; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+            auto event = (const inotify_event*)p;
+            auto dir = _dirs.find(event->wd);
+            if (dir == _dirs.end() || event->len == 0)
+                continue;
+            auto file = _files.find(dir->second + "/" + event->name);
+            if (file != _files.end() && unique.insert(file->second).second)
+                changed.push_back(file->second);
+        }
+    }
+#else
+    auto now = std::chrono::steady_clock::now();
+    if (now - _lastPoll < std::chrono::milliseconds(POLL_INTERVAL_MS))
+        return;
+    _lastPoll = now;
+
+    for (auto& it : _mtimes) {
+        int64_t mtime = GetModificationTime(it.first);
+        if (mtime != it.second && mtime >= 0) {
+            it.second = mtime;
+            if (unique.insert(_files[it.first]).second)
+                changed.push_back(_files[it.first]);
+        }
+    }
+#endif
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+
+// Reports files modified since the last Poll. On Linux the directories of the watched files are
+// watched with inotify, which also sees editors that save by renaming a temporary file over the
+// original; elsewhere the modification times are polled every POLL_INTERVAL_MS.
+class FileWatcher {
+public:
+    static const int POLL_INTERVAL_MS = 200;
+
+    FileWatcher();
+    ~FileWatcher();
+
+    void      AddFile(const std::string& path);
+    // 'changed' receives the paths as they were passed to AddFile, each at most once
+    void      Poll(std::vector<std::string>& changed);
+
+private:
+    static std::string Normalize(const std::string& path);
+    static int64_t     GetModificationTime(const std::string& path);
+
+    std::unordered_map<std::string, std::string>  _files;       // normalized path -> path
+#ifdef __linux__
+    int                                           _inotify;
+    std::unordered_map<int, std::string>          _dirs;        // watch descriptor -> normalized directory
+#else
+    std::unordered_map<std::string, int64_t>      _mtimes;
+    std::chrono::steady_clock::time_point         _lastPoll;
+#endif
+};
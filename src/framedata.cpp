@@ -0,0 +1,116 @@
+#include "framedata.h"
+#include "scene.h"
+#include "camera.h"
+#include "light.h"
+
+#include <cstring>
+
+FrameUniforms::FrameUniforms()
+    : _buffer(0),
+    _slotSize(0),
+    _slot(0),
+    _persistent(nullptr)
+{
+    for (auto& f : _fences)
+        f = nullptr;
+}
+
+FrameUniforms::~FrameUniforms()
+{
+    for (auto& f : _fences) {
+        if (f)
+            glDeleteSync(f);
+    }
+    if (_buffer)
+        glDeleteBuffers(1, &_buffer);
+}
+
+void FrameUniforms::Initialize()
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    _slotSize = (sizeof(FrameData) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+    if (GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, _slotSize * RING_SIZE, nullptr, flags);
+        _persistent = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, _slotSize * RING_SIZE, flags));
+    }
+    else
+        glBufferData(GL_UNIFORM_BUFFER, _slotSize * RING_SIZE, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FrameUniforms::Fill(const ScenePtr& scene, FrameData& data)
+{
+    data = FrameData();
+
+    auto camera = scene->GetCamera();
+    if (camera != nullptr) {
+        data.view = camera->GetViewMatrix();
+        data.projection = camera->GetProjectionMatrix();
+        data.view_projection = data.projection * data.view;
+        data.camera_pos = glm::vec4(camera->GetPosition(), 1.0f);
+    }
+
+    auto& lights = scene->GetLights();
+    int count = std::min((int)lights.size(), FrameData::MAX_LIGHTS);
+    data.light_count.x = count;
+    for (int i = 0; i < count; i++) {
+        auto& l = lights[i];
+        auto& dst = data.lights[i];
+        dst.position = glm::vec4(l->GetPosition(), float(l->GetType()));
+        dst.direction = glm::vec4(l->GetDirection(), 0.0f);
+        dst.ambient = glm::vec4(l->GetAmbient(), 0.0f);
+        dst.diffuse = glm::vec4(l->GetDiffuse(), 0.0f);
+        dst.specular = glm::vec4(l->GetSpecular(), 0.0f);
+        dst.attenuation = glm::vec4(l->GetConstantAtten(), l->GetLinearAtten(), l->GetQuadraticAtten(), 0.0f);
+    }
+}
+
+void FrameUniforms::Update(const ScenePtr& scene)
+{
+    if (_buffer == 0)
+        return;
+
+    _slot = (_slot + 1) % RING_SIZE;
+    size_t offset = _slot * _slotSize;
+
+    // only waits when the GPU is more than RING_SIZE - 1 frames behind
+    if (_fences[_slot]) {
+        while (glClientWaitSync(_fences[_slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(_fences[_slot]);
+        _fences[_slot] = nullptr;
+    }
+
+    FrameData data;
+    Fill(scene, data);
+
+    if (_persistent)
+        memcpy(_persistent + offset, &data, sizeof(data));
+    else {
+        glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+        void* dst = glMapBufferRange(GL_UNIFORM_BUFFER, offset, sizeof(data),
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst) {
+            memcpy(dst, &data, sizeof(data));
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, _buffer, offset, sizeof(data));
+}
+
+void FrameUniforms::EndFrame()
+{
+    if (_buffer == 0)
+        return;
+
+    if (_fences[_slot])
+        glDeleteSync(_fences[_slot]);
+    _fences[_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+
+// std140 layout of the FrameData uniform block shared by all programs:
+//
+//  layout(std140) uniform FrameData {
+//      mat4  view;
+//      mat4  projection;
+//      mat4  view_projection;
+//      vec4  camera_pos;
+//      ivec4 light_count;
+//      Light lights[8];    // position, direction, ambient, diffuse, specular, attenuation as vec4
+//  };
+struct FrameLightData {
+    glm::vec4  position;       // w holds the Light::Type
+    glm::vec4  direction;
+    glm::vec4  ambient;
+    glm::vec4  diffuse;
+    glm::vec4  specular;
+    glm::vec4  attenuation;    // constant, linear, quadratic
+};
+
+struct FrameData {
+    static const int MAX_LIGHTS = 8;
+
+    glm::mat4      view;
+    glm::mat4      projection;
+    glm::mat4      view_projection;
+    glm::vec4      camera_pos;
+    glm::ivec4     light_count;
+    FrameLightData lights[MAX_LIGHTS];
+};
+
+// Uploads FrameData once per frame into one slot of a ring of buffer regions and binds that
+// slot to BINDING. A fence per slot keeps the CPU from overwriting a slot the GPU still reads.
+// The buffer is persistently mapped when ARB_buffer_storage is available, otherwise each slot
+// is mapped unsynchronized.
+class FrameUniforms {
+public:
+    static const GLuint BINDING = 0;
+    static const int    RING_SIZE = 3;
+
+    FrameUniforms();
+    ~FrameUniforms();
+
+    void   Initialize();
+    // writes and binds the data of the next frame
+    void   Update(const ScenePtr& scene);
+    // fences the slot of the frame whose commands were just submitted
+    void   EndFrame();
+    GLuint GetBuffer() const { return _buffer; }
+
+private:
+    void   Fill(const ScenePtr& scene, FrameData& data);
+
+    GLuint  _buffer;
+    size_t  _slotSize;
+    int     _slot;
+    char*   _persistent;
+    GLsync  _fences[RING_SIZE];
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cstdint>
+
+// axis aligned box in world space, independent of the GL side BoundingBox
+struct AABB {
+    AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+    AABB(const glm::vec3& lo, const glm::vec3& hi) : min(lo), max(hi) {}
+
+    void      Extend(const AABB& b)    { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+    glm::vec3 Center() const           { return (min + max) * 0.5f; }
+    bool      Empty()  const           { return min.x > max.x; }
+
+    // bounds of this box after transforming its eight corners
+    AABB Transform(const glm::mat4& m) const
+    {
+        AABB result;
+        for (int i = 0; i < 8; i++) {
+            glm::vec3 corner(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+            glm::vec3 p = glm::vec3(m * glm::vec4(corner, 1.0f));
+            result.min = glm::min(result.min, p);
+            result.max = glm::max(result.max, p);
+        }
+        return result;
+    }
+
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// six clip planes extracted from a view projection matrix (Gribb/Hartmann), normals point inwards
+class Frustum {
+public:
+    enum Result { OUTSIDE, INTERSECT, INSIDE };
+
+    static const uint32_t ALL_PLANES = 0x3f;
+
+    Frustum() {}
+    explicit Frustum(const glm::mat4& view_proj) { Extract(view_proj); }
+
+    void Extract(const glm::mat4& m)
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        _planes[0] = row3 + row0;   // left
+        _planes[1] = row3 - row0;   // right
+        _planes[2] = row3 + row1;   // bottom
+        _planes[3] = row3 - row1;   // top
+        _planes[4] = row3 + row2;   // near
+        _planes[5] = row3 - row2;   // far
+
+        for (auto& p : _planes) {
+            float len = glm::length(glm::vec3(p));
+            if (len > 0.0f)
+                p /= len;
+        }
+    }
+
+    // 'mask' holds the planes still to be tested; planes the box is fully inside of are cleared
+    // from it, so children of a box only test the planes their parent straddles
+    Result Classify(const AABB& box, uint32_t& mask) const
+    {
+        Result result = INSIDE;
+        for (int i = 0; i < 6; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+
+            const glm::vec4& p = _planes[i];
+            glm::vec3 positive(p.x >= 0.0f ? box.max.x : box.min.x,
+                               p.y >= 0.0f ? box.max.y : box.min.y,
+                               p.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(p), positive) + p.w < 0.0f)
+                return OUTSIDE;
+
+            glm::vec3 negative(p.x >= 0.0f ? box.min.x : box.max.x,
+                               p.y >= 0.0f ? box.min.y : box.max.y,
+                               p.z >= 0.0f ? box.min.z : box.max.z);
+            if (glm::dot(glm::vec3(p), negative) + p.w >= 0.0f)
+                mask &= ~(1u << i);
+            else
+                result = INTERSECT;
+        }
+        return result;
+    }
+
+    bool Intersects(const AABB& box) const
+    {
+        uint32_t mask = ALL_PLANES;
+        return Classify(box, mask) != OUTSIDE;
+    }
+
+    bool Intersects(const glm::vec3& center, float radius) const
+    {
+        for (int i = 0; i < 6; i++) {
+            if (glm::dot(glm::vec3(_planes[i]), center) + _planes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    glm::vec4 _planes[6];
+};
@@ -0,0 +1,123 @@
+#include "geometry.h"
+#include "glstate.h"
+#include "instanceculler.h"
+
+Geometry::~Geometry()
+{
+}
+
+void Geometry::CreateVBOForInstanceData()
+{
+    if (_instanceData.empty())
+        return;
+
+    if (_dynamicInstances) {
+        // the rings replace the VBOs; the parsed data or file mapping is copied once into
+        // memory UpdateInstanceData can write
+        _instance_data_vbos.resize(_instanceData.size());
+        _dynamicStreams.resize(_instanceData.size());
+        for (size_t i = 0; i < _instanceData.size(); i++) {
+            InstanceData& stream = _instanceData[i];
+            std::unique_ptr<DynamicInstanceStream> dynamic(new DynamicInstanceStream);
+            const char* src = static_cast<const char*>(stream.data.get());
+            dynamic->values = std::make_shared<std::vector<char>>(src, src + stream.size);
+            dynamic->pending = false;
+            stream.data = std::shared_ptr<const void>(dynamic->values, dynamic->values->data());
+
+            dynamic->ring.Initialize(stream.size);
+            dynamic->ring.Begin(dynamic->values->data());
+            dynamic->ring.End();
+            _instance_data_vbos[i] = dynamic->ring.GetBuffer();
+            _dynamicStreams[i] = std::move(dynamic);
+        }
+        return;
+    }
+
+    // uploaded straight from where the data lives; for binary sidecars that is the file
+    // mapping, so the pages go from the file to the driver without a copy on the heap
+    _instance_data_vbos.resize(_instanceData.size());
+    glGenBuffers((GLsizei)_instance_data_vbos.size(), _instance_data_vbos.data());
+    for (size_t i = 0; i < _instanceData.size(); i++) {
+        GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, _instance_data_vbos[i]);
+        // instance culling rewrites the buffer with the visible instances
+        glBufferData(GL_ARRAY_BUFFER, _instanceData[i].size, _instanceData[i].data.get(), GL_DYNAMIC_DRAW);
+    }
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Geometry::SetupInstanceAttributes(size_t stream, GLuint buffer)
+{
+    // the streams take consecutive locations after the vertex attributes, one per vec4
+    GLuint index = 4;
+    for (size_t s = 0; s < stream; s++)
+        index += (GLuint)std::max<size_t>(1, _instanceData[s].stride / (4 * sizeof(float)));
+
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, buffer);
+    size_t stride = _instanceData[stream].stride;
+    size_t total_attributes = stride / (4 * sizeof(float));
+    if (total_attributes > 0) {
+        size_t vec4_size = sizeof(glm::vec4);
+        for (size_t i = 0; i < total_attributes; i++) {
+            glEnableVertexAttribArray(index);
+            glVertexAttribPointer(index, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(i * vec4_size));
+            glVertexAttribDivisor(index, 1);
+            index++;
+        }
+    }
+    else {
+        glEnableVertexAttribArray(index);
+        glVertexAttribPointer(index, (GLint)(stride / sizeof(float)), GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(0));
+        glVertexAttribDivisor(index, 1);
+    }
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void* Geometry::UpdateInstanceData(size_t stream, uint32_t first, uint32_t count)
+{
+    if (!IsDynamicStream(stream))
+        return nullptr;
+    assert(uint64_t(first) + count <= _numInstances);
+
+    DynamicInstanceStream& dynamic = *_dynamicStreams[stream];
+    size_t stride = _instanceData[stream].stride;
+    dynamic.ring.Invalidate(first * stride, (first + count) * stride);
+    dynamic.pending = true;
+    _instanceDataChanged = true;
+    return dynamic.values->data() + first * stride;
+}
+
+const InstanceBufferRing* Geometry::GetInstanceRing(size_t stream) const
+{
+    return IsDynamicStream(stream) ? &_dynamicStreams[stream]->ring : nullptr;
+}
+
+void Geometry::UploadDynamicInstances()
+{
+    for (size_t i = 0; i < _dynamicStreams.size(); i++) {
+        DynamicInstanceStream& dynamic = *_dynamicStreams[i];
+        if (!dynamic.pending)
+            continue;
+
+        dynamic.ring.Begin(dynamic.values->data());
+        dynamic.ring.End();
+        dynamic.pending = false;
+        _instance_data_vbos[i] = dynamic.ring.GetBuffer();
+        GLStateCache::GetInstance()->BindVertexArray(_vao);
+        SetupInstanceAttributes(i, _instance_data_vbos[i]);
+    }
+}
+
+void Geometry::UploadVisibleInstances(size_t stream, const std::vector<uint32_t>& visible)
+{
+    DynamicInstanceStream& dynamic = *_dynamicStreams[stream];
+    size_t stride = _instanceData[stream].stride;
+    char* dst = dynamic.ring.BeginOverwrite(visible.size() * stride);
+    if (dst != nullptr)
+        InstanceCuller::Compact(dynamic.values->data(), stride, visible, dst);
+    dynamic.ring.End();
+    // the slot holds the latest data, packed
+    dynamic.pending = false;
+    _instance_data_vbos[stream] = dynamic.ring.GetBuffer();
+    GLStateCache::GetInstance()->BindVertexArray(_vao);
+    SetupInstanceAttributes(stream, _instance_data_vbos[stream]);
+}
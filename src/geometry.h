@@ -2,6 +2,11 @@
 
 #include "common.h"
 #include "material.h"
+#include "frustum.h"
+#include "meshlet.h"
+#include "occlusionculler.h"
+#include "geometryarena.h"
+#include "instancebuffer.h"
 
 struct BoundingBox {
     glm::vec3	min;
@@ -9,17 +14,55 @@ struct BoundingBox {
     glm::vec3	center;
 };
 
+// projects the object space error of a level of detail to pixels on screen
+struct LODSelector {
+    glm::vec3 eye;
+    float     pixels_per_unit;    // pixels covered by one unit at distance one
+    float     pixel_error;        // largest error allowed, in pixels
+};
+
+// a run of indices relative to the start of the geometry's indices
+struct IndexRange {
+    GLuint  first;
+    GLsizei count;
+};
+
 class Geometry {
     friend class ResourceManager;
+    friend class Scene;
 public:
     Geometry()
-        : _texture(0), _vao(0), _vbo(0), _ibo(0), _transparency(1.0f), _numInstances(0)
+        : _baseTransformation(1.0f), _texture(0), _vao(0), _vbo(0), _ibo(0), _transparency(1.0f), _numInstances(0),
+        _numVisibleInstances(0), _sceneIndex(-1), _transformDirty(true), _occluder(false),
+        _dynamicInstances(false), _instanceDataChanged(false)
     {}
 
     virtual ~Geometry();
 
     virtual void       Render() = 0;
-    void               ApplyTransformation(const glm::mat4& trans) { _transformation *= trans; }
+    // culls the instances against the view projection and returns how many are drawn; with a
+    // selector the visible instances also pick their level of detail
+    virtual uint32_t   CullInstances(const glm::mat4& view_proj, const LODSelector* lod = nullptr) { return _numInstances; }
+    // picks the level of detail drawn by the next Render; geometries without LODs ignore it
+    virtual void       SelectLOD(const LODSelector& selector)      {}
+    // indices drawn for the selected level, relative to the start of the geometry's indices
+    virtual void       GetLODIndexRange(GLuint& first, GLsizei& count) const { first = 0; count = _arenaRange.count; }
+    // culls the meshlets of the selected level against the view projection and the eye; returns
+    // nullptr for geometries without meshlets, otherwise the Render calls that follow draw only
+    // the ranges returned by GetMeshletRanges
+    virtual const MeshletStats* CullMeshlets(const glm::mat4& view_proj, const glm::vec3& eye) { return nullptr; }
+    virtual const MeshletStats* GetMeshletStats() const                  { return nullptr; }
+    virtual const std::vector<IndexRange>* GetMeshletRanges() const       { return nullptr; }
+    // triangles rasterized when the geometry is an occluder, or nullptr if it has none
+    virtual const OccluderMesh* GetOccluderMesh() const                  { return nullptr; }
+    virtual GLenum     GetIndexType() const                            { return GL_UNSIGNED_INT; }
+    void               SetOccluder(bool occluder)                  { _occluder = occluder; }
+    bool               IsOccluder()        const                   { return _occluder; }
+    void               ApplyTransformation(const glm::mat4& trans) { _transformation *= trans; _transformDirty = true; }
+    void               SetTransformation(const glm::mat4& trans)   { _transformation = trans; _transformDirty = true; }
+    // replaces the transformation of the scene description, keeping the base transformation
+    // that normalizes and decodes the geometry's own vertices
+    void               SetSceneTransformation(const glm::mat4& trans) { SetTransformation(trans * _baseTransformation); }
     void               SetTexture(GLenum type, GLuint texture)     { _textureType = type; _texture = texture; }
     bool               UsesTexture() const                         { return _texture != 0; }
     void               SetMaterial(const Material& mat)            { _material = mat; }
@@ -27,29 +70,58 @@ public:
     void               SetShaderProgram(GLuint program)            { _program = program; }
     const glm::mat4&   GetTransformation() const                   { return _transformation; }
     const BoundingBox& GetBoundingBox()    const                   { return _bbox; }
+    AABB               GetWorldBounds()    const                   { return AABB(_bbox.min, _bbox.max).Transform(_transformation); }
+    int32_t            GetSceneIndex()     const                   { return _sceneIndex; }
+    bool               IsInstanced()       const                   { return _numInstances > 0; }
+    uint32_t           GetInstanceNum()    const                   { return _numInstances; }
     GLuint             GetShaderProgram()  const                   { return _program; }
+    GLuint             GetVAO()            const                   { return _vao; }
+    GLuint             GetTexture()        const                   { return _texture; }
+    GLenum             GetTextureType()    const                   { return _textureType; }
+    const GeometryArena::Range& GetArenaRange() const              { return _arenaRange; }
     const std::string& GetName() const                             { return _id; }
     void               SetName(const std::string name)             { _id = name; }
-    void               SetInstanceNum(uint32_t num)                { _numInstances = num; }
-    void               SetInstanceData(void* data,
+    void               SetInstanceNum(uint32_t num)                { _numInstances = _numVisibleInstances = num; }
+    // 'data' owns or keeps alive the storage it points to, e.g. a parsed buffer or a file mapping
+    void               SetInstanceData(std::shared_ptr<const void> data,
                                        size_t size,
-                                       size_t stride)              { _instanceData.emplace_back(data, size, stride); }
+                                       size_t stride)              { _instanceData.emplace_back(std::move(data), size, stride); }
+    // keeps a writable copy of the instance data and draws it from a ring of buffers, so it can
+    // change every frame through UpdateInstanceData; set before the geometry is loaded
+    void               EnableDynamicInstances(bool enable)         { _dynamicInstances = enable; }
+    bool               HasDynamicInstances() const                 { return _dynamicInstances; }
+    size_t             GetInstanceStreamCount() const              { return _instanceData.size(); }
+    size_t             GetInstanceStride(size_t stream) const      { return _instanceData[stream].stride; }
+    // returns instances [first, first + count) of 'stream' to rewrite; the next Render draws
+    // them and uploads only the changed range. Call on the GL thread between frames, though
+    // jobs may fill the returned memory. nullptr unless the geometry is loaded with dynamic instances
+    void*              UpdateInstanceData(size_t stream, uint32_t first, uint32_t count);
+    const InstanceBufferRing* GetInstanceRing(size_t stream) const;
 
 protected:
     void               CreateVBOForInstanceData();
+    // the attributes of instance stream 'stream' in the bound VAO, read from 'buffer'
+    void               SetupInstanceAttributes(size_t stream, GLuint buffer);
+    // writes the changed instances of the dynamic streams into the next ring slots and points
+    // the VAO at them
+    void               UploadDynamicInstances();
+    // packs the 'visible' instances of the dynamic stream to the front of its next ring slot
+    void               UploadVisibleInstances(size_t stream, const std::vector<uint32_t>& visible);
+    bool               IsDynamicStream(size_t stream) const        { return stream < _dynamicStreams.size() && _dynamicStreams[stream]; }
 
     struct InstanceData {
-        InstanceData() : data(0), size(0), stride(0) {}
-        InstanceData(void* ptr, size_t size, size_t stride)
-            : data(ptr), size(size), stride(stride)
+        InstanceData() : size(0), stride(0) {}
+        InstanceData(std::shared_ptr<const void> ptr, size_t size, size_t stride)
+            : data(std::move(ptr)), size(size), stride(stride)
         {}
-        void* data;
+        std::shared_ptr<const void> data;
         size_t size;
         size_t stride;
     };
 
     BoundingBox               _bbox;
     glm::mat4                 _transformation;
+    glm::mat4                 _baseTransformation;
     Material                  _material;
     float                     _transparency;
     GLenum                    _textureType;
@@ -60,7 +132,23 @@ protected:
     GLuint                    _program;
     std::string               _id;
     uint32_t                  _numInstances;
+    uint32_t                  _numVisibleInstances;
     std::vector<InstanceData> _instanceData;
     std::vector<GLuint>       _instance_data_vbos;
+    // per instance stream when the instances are dynamic: the copy UpdateInstanceData writes,
+    // which _instanceData points to, and the ring of buffers it is drawn from
+    struct DynamicInstanceStream {
+        std::shared_ptr<std::vector<char>> values;
+        InstanceBufferRing        ring;
+        bool                      pending;    // changed since the last upload
+    };
+    std::vector<std::unique_ptr<DynamicInstanceStream>> _dynamicStreams;
+    GeometryArena::Range      _arenaRange;
+    int32_t                   _sceneIndex;
+    bool                      _transformDirty;
+    bool                      _occluder;
+    bool                      _dynamicInstances;
+    // dynamic instances were rewritten since the last instance culling
+    bool                      _instanceDataChanged;
 
 };
\ No newline at end of file
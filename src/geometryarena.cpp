@@ -0,0 +1,183 @@
+#include "geometryarena.h"
+#include "glstate.h"
+#include "profiler.h"
+
+#include <cstring>
+
+// the first pool allocation holds this many vertices, later ones grow by doubling
+static const size_t MIN_POOL_VERTICES = 1 << 16;
+
+GeometryArena* GeometryArena::GetInstance()
+{
+    static GeometryArena arena;
+    return &arena;
+}
+
+GeometryArena::GeometryArena()
+    : _enabled(false)
+{
+}
+
+bool GeometryArena::MultiDrawSupported() const
+{
+    return GLEW_ARB_multi_draw_indirect && GLEW_ARB_draw_indirect && GLEW_ARB_base_instance;
+}
+
+size_t GeometryArena::GetIndexSize(int32_t pool) const
+{
+    return _pools[pool].index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+void GeometryArena::ResetObjectTransform()
+{
+    for (GLuint i = 0; i < 4; i++) {
+        glm::vec4 column(0.0f);
+        column[i] = 1.0f;
+        glVertexAttrib4f(OBJECT_TRANSFORM_LOCATION + i, column.x, column.y, column.z, column.w);
+    }
+}
+
+int32_t GeometryArena::FindPool(const std::vector<VertexAttrib>& attribs, size_t vertex_size, GLenum index_type)
+{
+    for (size_t i = 0; i < _pools.size(); i++) {
+        const Pool& p = _pools[i];
+        if (p.vertex_size == vertex_size && p.index_type == index_type && p.attribs.size() == attribs.size() &&
+            memcmp(p.attribs.data(), attribs.data(), attribs.size() * sizeof(VertexAttrib)) == 0)
+            return (int32_t)i;
+    }
+
+    Pool pool;
+    pool.attribs = attribs;
+    pool.vertex_size = vertex_size;
+    pool.index_type = index_type;
+    pool.vertex_count = pool.vertex_capacity = 0;
+    pool.index_count = pool.index_capacity = 0;
+    pool.vbo = pool.ibo = 0;
+    glGenVertexArrays(1, &pool.vao);
+    glGenBuffers(1, &pool.transforms);
+    glGenBuffers(1, &pool.commands);
+    _pools.push_back(pool);
+    return (int32_t)_pools.size() - 1;
+}
+
+void GeometryArena::SetupVAO(Pool& pool)
+{
+    auto state = GLStateCache::GetInstance();
+    state->BindVertexArray(pool.vao);
+    state->BindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+    state->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.ibo);
+
+    for (auto& attrib : pool.attribs) {
+        glEnableVertexAttribArray(attrib.location);
+        glVertexAttribPointer(attrib.location, attrib.components, attrib.type, attrib.normalized ? GL_TRUE : GL_FALSE,
+            (GLsizei)pool.vertex_size, (GLvoid*)(size_t)(attrib.offset));
+    }
+
+    // object transforms advance once per instance, i.e. once per indirect command
+    if (MultiDrawSupported()) {
+        state->BindBuffer(GL_ARRAY_BUFFER, pool.transforms);
+        for (GLuint i = 0; i < 4; i++) {
+            glEnableVertexAttribArray(OBJECT_TRANSFORM_LOCATION + i);
+            glVertexAttribPointer(OBJECT_TRANSFORM_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(OBJECT_TRANSFORM_LOCATION + i, 1);
+        }
+    }
+    state->BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::Reserve(Pool& pool, size_t vertex_count, size_t index_count)
+{
+    if (vertex_count <= pool.vertex_capacity && index_count <= pool.index_capacity)
+        return;
+
+    size_t index_size = pool.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    size_t vertex_capacity = std::max(pool.vertex_capacity, MIN_POOL_VERTICES);
+    while (vertex_capacity < vertex_count)
+        vertex_capacity *= 2;
+    size_t index_capacity = std::max(pool.index_capacity, 3 * MIN_POOL_VERTICES);
+    while (index_capacity < index_count)
+        index_capacity *= 2;
+
+    // grow into new buffers and copy the existing ranges on the GPU
+    GLuint vbo, ibo;
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ibo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, vertex_capacity * pool.vertex_size, nullptr, GL_STATIC_DRAW);
+    if (pool.vbo) {
+        glBindBuffer(GL_COPY_READ_BUFFER, pool.vbo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.vertex_count * pool.vertex_size);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ibo);
+    glBufferData(GL_COPY_WRITE_BUFFER, index_capacity * index_size, nullptr, GL_STATIC_DRAW);
+    if (pool.ibo) {
+        glBindBuffer(GL_COPY_READ_BUFFER, pool.ibo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.index_count * index_size);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (pool.vbo) {
+        glDeleteBuffers(1, &pool.vbo);
+        glDeleteBuffers(1, &pool.ibo);
+        GLStateCache::GetInstance()->Invalidate();
+    }
+    pool.vbo = vbo;
+    pool.ibo = ibo;
+    pool.vertex_capacity = vertex_capacity;
+    pool.index_capacity = index_capacity;
+    SetupVAO(pool);
+}
+
+GeometryArena::Range GeometryArena::Allocate(const std::vector<VertexAttrib>& attribs, size_t vertex_size, GLenum index_type,
+    const void* vertices, size_t vertex_count, const void* indices, size_t index_count)
+{
+    Range range;
+    range.pool = FindPool(attribs, vertex_size, index_type);
+    Pool& pool = _pools[range.pool];
+    Reserve(pool, pool.vertex_count + vertex_count, pool.index_count + index_count);
+
+    size_t index_size = GetIndexSize(range.pool);
+    auto state = GLStateCache::GetInstance();
+    state->BindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, pool.vertex_count * vertex_size, vertex_count * vertex_size, vertices);
+    state->BindBuffer(GL_ARRAY_BUFFER, 0);
+    // the element buffer binding belongs to the VAO
+    state->BindVertexArray(pool.vao);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, pool.index_count * index_size, index_count * index_size, indices);
+
+    range.base_vertex = (GLint)pool.vertex_count;
+    range.first_index = (GLuint)pool.index_count;
+    range.count = (GLsizei)index_count;
+    pool.vertex_count += vertex_count;
+    pool.index_count += index_count;
+    return range;
+}
+
+void GeometryArena::MultiDraw(int32_t pool_id, const std::vector<DrawCommand>& commands, const std::vector<glm::mat4>& transforms)
+{
+    Pool& pool = _pools[pool_id];
+    auto state = GLStateCache::GetInstance();
+    state->BindVertexArray(pool.vao);
+
+    // both buffers are orphaned on every upload so the next batch never waits on this one
+    state->BindBuffer(GL_ARRAY_BUFFER, pool.transforms);
+    glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_STREAM_DRAW);
+    state->BindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, pool.commands);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_STREAM_DRAW);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, pool.index_type, nullptr, (GLsizei)commands.size(), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // the current generic value of an attribute is undefined after a draw that sourced it from
+    // an enabled array, and non-arena draws read their identity object transform from it
+    ResetObjectTransform();
+
+#ifdef GFXLAB_PROFILER
+    uint64_t triangles = 0;
+    for (auto& c : commands)
+        triangles += c.count / 3;
+    PROFILE_COUNT_DRAW(triangles);
+#endif
+}
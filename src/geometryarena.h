@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+#include "vertexformat.h"
+
+// Shared vertex and index buffers that static meshes are suballocated from, one pool per
+// vertex layout and index type, each with a single VAO. Draws from the same pool can then be
+// submitted together with glMultiDrawElementsIndirect; each command's base instance selects the
+// object transform, which the shaders read as the mat4 attribute at OBJECT_TRANSFORM_LOCATION.
+// Without multi-draw indirect, meshes draw one by one with glDrawElementsBaseVertex and the
+// transform stays in the model uniform.
+class GeometryArena {
+public:
+    struct Range {
+        Range() : pool(-1), base_vertex(0), first_index(0), count(0) {}
+        int32_t  pool;
+        GLint    base_vertex;
+        GLuint   first_index;
+        GLsizei  count;
+    };
+
+    // layout of glMultiDrawElementsIndirect commands
+    struct DrawCommand {
+        GLuint count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint  base_vertex;
+        GLuint base_instance;
+    };
+
+    static const GLuint OBJECT_TRANSFORM_LOCATION = 12;
+
+    static GeometryArena* GetInstance();
+
+    void         Enable(bool enable)        { _enabled = enable; }
+    bool         IsEnabled() const          { return _enabled; }
+    bool         MultiDrawSupported() const;
+
+    // copies the mesh buffers into the pool matching its layout
+    Range        Allocate(const std::vector<VertexAttrib>& attribs, size_t vertex_size, GLenum index_type,
+                          const void* vertices, size_t vertex_count, const void* indices, size_t index_count);
+    GLuint       GetVAO(int32_t pool) const  { return _pools[pool].vao; }
+    GLenum       GetIndexType(int32_t pool) const { return _pools[pool].index_type; }
+    size_t       GetIndexSize(int32_t pool) const;
+
+    // one indirect draw of 'commands'; transforms[i] is read by base instance i
+    void         MultiDraw(int32_t pool, const std::vector<DrawCommand>& commands, const std::vector<glm::mat4>& transforms);
+
+    // non-arena draws read an identity object transform from the generic attribute value;
+    // set once at init and again after every MultiDraw
+    static void  ResetObjectTransform();
+
+private:
+    GeometryArena();
+
+    struct Pool {
+        std::vector<VertexAttrib> attribs;
+        size_t                    vertex_size;
+        GLenum                    index_type;
+        GLuint                    vao;
+        GLuint                    vbo;
+        GLuint                    ibo;
+        GLuint                    transforms;
+        GLuint                    commands;
+        size_t                    vertex_count;
+        size_t                    vertex_capacity;
+        size_t                    index_count;
+        size_t                    index_capacity;
+    };
+
+    int32_t      FindPool(const std::vector<VertexAttrib>& attribs, size_t vertex_size, GLenum index_type);
+    void         Reserve(Pool& pool, size_t vertex_count, size_t index_count);
+    void         SetupVAO(Pool& pool);
+
+    std::vector<Pool> _pools;
+    bool              _enabled;
+};
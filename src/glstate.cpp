@@ -0,0 +1,162 @@
+#include "glstate.h"
+
+GLStateCache* GLStateCache::GetInstance()
+{
+    static GLStateCache cache;
+    return &cache;
+}
+
+GLStateCache::GLStateCache()
+{
+    Invalidate();
+    ResetStats();
+}
+
+void GLStateCache::Invalidate()
+{
+    _program = _vao = UNKNOWN;
+    _arrayBuffer = _elementBuffer = UNKNOWN;
+    _drawFramebuffer = _readFramebuffer = _renderbuffer = UNKNOWN;
+    _activeUnit = UNKNOWN;
+    for (auto& unit : _textures)
+        unit[0] = unit[1] = UNKNOWN;
+    for (auto& cap : _caps)
+        cap = UNKNOWN;
+    _clearColorValid = false;
+}
+
+bool GLStateCache::Changed(GLuint& shadow, GLuint value)
+{
+    _stats.requested++;
+    if (shadow == value)
+        return false;
+    shadow = value;
+    _stats.issued++;
+    return true;
+}
+
+void GLStateCache::UseProgram(GLuint program)
+{
+    if (Changed(_program, program))
+        glUseProgram(program);
+}
+
+void GLStateCache::BindVertexArray(GLuint vao)
+{
+    if (Changed(_vao, vao)) {
+        glBindVertexArray(vao);
+        // the element buffer binding is part of the VAO
+        _elementBuffer = UNKNOWN;
+    }
+}
+
+void GLStateCache::BindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint* shadow = nullptr;
+    switch (target) {
+    case GL_ARRAY_BUFFER:         shadow = &_arrayBuffer; break;
+    case GL_ELEMENT_ARRAY_BUFFER: shadow = &_elementBuffer; break;
+    }
+
+    if (shadow == nullptr) {
+        _stats.requested++;
+        _stats.issued++;
+        glBindBuffer(target, buffer);
+    }
+    else if (Changed(*shadow, buffer))
+        glBindBuffer(target, buffer);
+}
+
+void GLStateCache::BindFramebuffer(GLenum target, GLuint fbo)
+{
+    if (target == GL_FRAMEBUFFER) {
+        _stats.requested++;
+        if (_drawFramebuffer == fbo && _readFramebuffer == fbo)
+            return;
+        _stats.issued++;
+        _drawFramebuffer = _readFramebuffer = fbo;
+        glBindFramebuffer(target, fbo);
+    }
+    else if (Changed(target == GL_DRAW_FRAMEBUFFER ? _drawFramebuffer : _readFramebuffer, fbo))
+        glBindFramebuffer(target, fbo);
+}
+
+void GLStateCache::BindRenderbuffer(GLenum target, GLuint rbo)
+{
+    if (Changed(_renderbuffer, rbo))
+        glBindRenderbuffer(target, rbo);
+}
+
+void GLStateCache::ActiveTexture(GLenum unit)
+{
+    if (Changed(_activeUnit, unit - GL_TEXTURE0))
+        glActiveTexture(unit);
+}
+
+int GLStateCache::TargetSlot(GLenum target) const
+{
+    switch (target) {
+    case GL_TEXTURE_2D:       return 0;
+    case GL_TEXTURE_CUBE_MAP: return 1;
+    }
+    return -1;
+}
+
+void GLStateCache::BindTexture(GLenum target, GLuint texture)
+{
+    int slot = TargetSlot(target);
+    if (slot < 0 || _activeUnit >= MAX_TEXTURE_UNITS) {
+        _stats.requested++;
+        _stats.issued++;
+        glBindTexture(target, texture);
+    }
+    else if (Changed(_textures[_activeUnit][slot], texture))
+        glBindTexture(target, texture);
+}
+
+int GLStateCache::CapSlot(GLenum cap) const
+{
+    switch (cap) {
+    case GL_DEPTH_TEST:   return 0;
+    case GL_STENCIL_TEST: return 1;
+    case GL_BLEND:        return 2;
+    case GL_CULL_FACE:    return 3;
+    }
+    return -1;
+}
+
+void GLStateCache::Enable(GLenum cap)
+{
+    int slot = CapSlot(cap);
+    if (slot < 0) {
+        _stats.requested++;
+        _stats.issued++;
+        glEnable(cap);
+    }
+    else if (Changed(_caps[slot], GL_TRUE))
+        glEnable(cap);
+}
+
+void GLStateCache::Disable(GLenum cap)
+{
+    int slot = CapSlot(cap);
+    if (slot < 0) {
+        _stats.requested++;
+        _stats.issued++;
+        glDisable(cap);
+    }
+    else if (Changed(_caps[slot], GL_FALSE))
+        glDisable(cap);
+}
+
+void GLStateCache::ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+    glm::vec4 color(r, g, b, a);
+    _stats.requested++;
+    if (_clearColorValid && _clearColor == color)
+        return;
+    _stats.issued++;
+    _clearColor = color;
+    _clearColorValid = true;
+    glClearColor(r, g, b, a);
+}
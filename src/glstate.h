@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+// Shadow copy of the GL binding state. Binds matching the shadowed state are skipped;
+// code that changes state behind its back (e.g. the state callback DLLs) must call Invalidate.
+class GLStateCache {
+public:
+    struct Stats {
+        uint32_t requested;     // calls made through the cache
+        uint32_t issued;        // calls that reached GL
+    };
+
+    static const int MAX_TEXTURE_UNITS = 16;
+
+    static GLStateCache* GetInstance();
+
+    void         UseProgram(GLuint program);
+    void         BindVertexArray(GLuint vao);
+    void         BindBuffer(GLenum target, GLuint buffer);
+    void         BindFramebuffer(GLenum target, GLuint fbo);
+    void         BindRenderbuffer(GLenum target, GLuint rbo);
+    void         ActiveTexture(GLenum unit);
+    void         BindTexture(GLenum target, GLuint texture);
+    void         Enable(GLenum cap);
+    void         Disable(GLenum cap);
+    void         ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+
+    // forgets the shadowed state so that the next call of each kind reaches GL
+    void         Invalidate();
+    void         ResetStats()          { _stats = { 0, 0 }; }
+    const Stats& GetStats() const      { return _stats; }
+
+private:
+    GLStateCache();
+
+    static const GLuint UNKNOWN = GLuint(-1);
+
+    bool         Changed(GLuint& shadow, GLuint value);
+    int          TargetSlot(GLenum target) const;
+    int          CapSlot(GLenum cap) const;
+
+    GLuint       _program;
+    GLuint       _vao;
+    GLuint       _arrayBuffer;
+    GLuint       _elementBuffer;
+    GLuint       _drawFramebuffer;
+    GLuint       _readFramebuffer;
+    GLuint       _renderbuffer;
+    GLuint       _activeUnit;
+    GLuint       _textures[MAX_TEXTURE_UNITS][2];   // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP
+    GLuint       _caps[4];                          // GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND, GL_CULL_FACE
+    glm::vec4    _clearColor;
+    bool         _clearColorValid;
+    Stats        _stats;
+};
@@ -0,0 +1,49 @@
+#include "hotreload.h"
+#include "jsonparser.h"
+#include "renderer.h"
+#include "renderpass.h"
+#include "resourcemanager.h"
+
+#include <chrono>
+
+HotReloader::HotReloader(SceneParser& parser, RendererPtr renderer)
+    : _parser(parser),
+    _renderer(renderer)
+{
+    _watcher.AddFile(_parser.GetConfigPath());
+    WatchShaders();
+}
+
+void HotReloader::WatchShaders()
+{
+    std::vector<std::string> shader_files;
+    ResourceManager::GetInstance()->GetShaderFiles(shader_files);
+    for (auto& f : shader_files)
+        _watcher.AddFile(f);
+}
+
+void HotReloader::Update()
+{
+    std::vector<std::string> changed;
+    _watcher.Poll(changed);
+    if (changed.empty())
+        return;
+
+    std::vector<GLuint> relinked;
+    for (auto& file : changed) {
+        if (file == _parser.GetConfigPath()) {
+            // a reloaded config may reference new shaders
+            if (_parser.Reload())
+                WatchShaders();
+            continue;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t first = relinked.size();
+        bool success = ResourceManager::GetInstance()->ReloadShader(file, relinked);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+        printf("reloaded %s in %lld ms: %d programs relinked%s\n", file.c_str(), (long long)elapsed.count(),
+            (int)(relinked.size() - first), success ? "" : ", errors keep the previous version");
+    }
+    _renderer->OnResourcesReloaded(relinked);
+}
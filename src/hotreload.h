@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common.h"
+#include "filewatcher.h"
+
+class SceneParser;
+
+// Watches the config file and the shaders of its programs. Update, called before every frame,
+// recompiles an edited shader and relinks only the programs using it, or hands an edited config
+// to SceneParser::Reload, which rebuilds only what changed.
+class HotReloader {
+public:
+    HotReloader(SceneParser& parser, RendererPtr renderer);
+
+    void      Update();
+
+private:
+    void      WatchShaders();
+
+    SceneParser&   _parser;
+    RendererPtr    _renderer;
+    FileWatcher    _watcher;
+};
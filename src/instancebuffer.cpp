@@ -0,0 +1,198 @@
+#include "instancebuffer.h"
+#include "glstate.h"
+
+#include <cstring>
+
+InstanceBufferRing::InstanceBufferRing()
+    : _size(0),
+    _current(-1),
+    _persistent(false),
+    _writing(false),
+    _flushBegin(0),
+    _flushEnd(0),
+    _stats({ 0, 0, 0, 0 })
+{
+}
+
+InstanceBufferRing::~InstanceBufferRing()
+{
+    for (auto& slot : _slots) {
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        // deleting the buffer releases a persistent mapping with it
+        glDeleteBuffers(1, &slot.buffer);
+    }
+}
+
+void InstanceBufferRing::Initialize(size_t size)
+{
+    assert(_slots.empty());
+    if (size == 0)
+        return;
+
+    _size = size;
+    _persistent = GLEW_ARB_buffer_storage != 0;
+    for (int i = 0; i < RING_SIZE; i++)
+        AddSlot();
+}
+
+void InstanceBufferRing::AddSlot()
+{
+    Slot slot;
+    slot.mapped = nullptr;
+    slot.fence = nullptr;
+    // a new slot holds nothing of the caller's copy yet
+    slot.dirty_begin = 0;
+    slot.dirty_end = _size;
+
+    glGenBuffers(1, &slot.buffer);
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, slot.buffer);
+    if (_persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, _size, nullptr, flags);
+        slot.mapped = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, _size, flags));
+    }
+    else
+        glBufferData(GL_ARRAY_BUFFER, _size, nullptr, GL_STREAM_DRAW);
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, 0);
+
+    _slots.push_back(slot);
+    _stats.slots = (uint32_t)_slots.size();
+}
+
+void InstanceBufferRing::Invalidate(size_t begin, size_t end)
+{
+    assert(begin <= end && end <= _size);
+    if (begin == end)
+        return;
+    for (auto& slot : _slots) {
+        if (slot.dirty_begin >= slot.dirty_end) {
+            slot.dirty_begin = begin;
+            slot.dirty_end = end;
+        }
+        else {
+            slot.dirty_begin = std::min(slot.dirty_begin, begin);
+            slot.dirty_end = std::max(slot.dirty_end, end);
+        }
+    }
+}
+
+bool InstanceBufferRing::IsFree(Slot& slot)
+{
+    if (slot.fence == nullptr)
+        return true;
+    // polls without a timeout; the swap at the end of every frame flushes the fences
+    GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    return true;
+}
+
+int InstanceBufferRing::Acquire()
+{
+    // everything drawn from the current slot has been submitted by now
+    if (_current >= 0) {
+        Slot& last = _slots[_current];
+        if (last.fence)
+            glDeleteSync(last.fence);
+        last.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    int count = (int)_slots.size();
+    for (int i = 1; i <= count; i++) {
+        int index = (_current + i) % count;
+        if (IsFree(_slots[index]))
+            return index;
+    }
+    if (count < MAX_SLOTS) {
+        AddSlot();
+        _stats.grown++;
+        return count;
+    }
+
+    // the oldest slot is the next one
+    int index = (_current + 1) % count;
+    Slot& slot = _slots[index];
+    while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+        ;
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    _stats.waits++;
+    return index;
+}
+
+char* InstanceBufferRing::Map(Slot& slot)
+{
+    if (_persistent)
+        return slot.mapped;
+
+    // the fence already guarantees the GPU is done with the slot
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, slot.buffer);
+    return static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, _size,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
+}
+
+char* InstanceBufferRing::Begin(const char* source)
+{
+    assert(!_writing && source != nullptr);
+    if (_slots.empty())
+        return nullptr;
+
+    _current = Acquire();
+    Slot& slot = _slots[_current];
+    char* dst = Map(slot);
+    if (dst == nullptr)
+        return nullptr;
+    _writing = true;
+
+    _flushBegin = _flushEnd = 0;
+    if (slot.dirty_begin < slot.dirty_end) {
+        memcpy(dst + slot.dirty_begin, source + slot.dirty_begin, slot.dirty_end - slot.dirty_begin);
+        _stats.bytes_copied += slot.dirty_end - slot.dirty_begin;
+        _flushBegin = slot.dirty_begin;
+        _flushEnd = slot.dirty_end;
+    }
+    slot.dirty_begin = _size;
+    slot.dirty_end = 0;
+    return dst;
+}
+
+char* InstanceBufferRing::BeginOverwrite(size_t bytes)
+{
+    assert(!_writing && bytes <= _size);
+    if (_slots.empty())
+        return nullptr;
+
+    _current = Acquire();
+    Slot& slot = _slots[_current];
+    char* dst = Map(slot);
+    if (dst == nullptr)
+        return nullptr;
+    _writing = true;
+
+    _flushBegin = 0;
+    _flushEnd = bytes;
+    _stats.bytes_copied += bytes;
+    if (bytes > 0) {
+        slot.dirty_end = slot.dirty_begin < slot.dirty_end ? std::max(slot.dirty_end, bytes) : bytes;
+        slot.dirty_begin = 0;
+    }
+    return dst;
+}
+
+void InstanceBufferRing::End()
+{
+    if (!_writing)
+        return;
+    _writing = false;
+    if (_persistent)
+        return;
+
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, _slots[_current].buffer);
+    if (_flushBegin < _flushEnd)
+        glFlushMappedBufferRange(GL_ARRAY_BUFFER, _flushBegin, _flushEnd - _flushBegin);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, 0);
+}
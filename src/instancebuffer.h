@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common.h"
+
+// Ring of buffers for instance data rewritten every frame, so the CPU fills one slot while the
+// GPU still reads the others. A slot is fenced when the ring moves past it and only reused once
+// its fence has signaled; if every slot is still in flight another one is added instead of
+// waiting, and only a GPU more than MAX_SLOTS frames behind makes Begin block.
+// Slots are persistently mapped when ARB_buffer_storage is available, otherwise each one is
+// mapped unsynchronized while it is written, which the fences make just as safe.
+// The caller keeps the authoritative copy of the data: every slot remembers the bytes changed
+// since it was last written, so a partial update copies only the changed range into it.
+class InstanceBufferRing {
+public:
+    static const int RING_SIZE = 3;
+    static const int MAX_SLOTS = 8;
+
+    struct Stats {
+        uint32_t slots;
+        uint32_t grown;          // slots added because all were in flight
+        uint32_t waits;          // Begin calls that had to wait for the GPU
+        uint64_t bytes_copied;
+    };
+
+    InstanceBufferRing();
+    ~InstanceBufferRing();
+
+    // allocates RING_SIZE slots of 'size' bytes
+    void         Initialize(size_t size);
+    // bytes [begin, end) of the caller's copy changed
+    void         Invalidate(size_t begin, size_t end);
+    // moves to a free slot, copies the bytes it missed from 'source', which holds the full
+    // size, and returns the slot for further writes until End
+    char*        Begin(const char* source);
+    // moves to a free slot whose first 'bytes' the caller overwrites with data other than its
+    // copy, e.g. the visible instances packed to the front
+    char*        BeginOverwrite(size_t bytes);
+    // the slot may be drawn from until the next Begin
+    void         End();
+    // buffer of the slot written last
+    GLuint       GetBuffer() const     { return _current >= 0 ? _slots[_current].buffer : 0; }
+    size_t       GetSize() const       { return _size; }
+    bool         IsPersistent() const  { return _persistent; }
+    const Stats& GetStats() const      { return _stats; }
+
+private:
+    InstanceBufferRing(const InstanceBufferRing&) = delete;
+    InstanceBufferRing& operator=(const InstanceBufferRing&) = delete;
+
+    struct Slot {
+        GLuint  buffer;
+        char*   mapped;
+        GLsync  fence;
+        // bytes that differ from the caller's copy; empty when begin >= end
+        size_t  dirty_begin;
+        size_t  dirty_end;
+    };
+
+    void         AddSlot();
+    bool         IsFree(Slot& slot);
+    int          Acquire();
+    char*        Map(Slot& slot);
+
+    std::vector<Slot> _slots;
+    size_t       _size;
+    int          _current;
+    bool         _persistent;
+    bool         _writing;
+    // range flushed when an unsynchronized mapping is released
+    size_t       _flushBegin;
+    size_t       _flushEnd;
+    Stats        _stats;
+};
@@ -0,0 +1,58 @@
+#include "instanceculler.h"
+#include "jobsystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// fields below this size per batch are culled on the calling thread
+static const uint32_t PARALLEL_CULL_THRESHOLD = 16384;
+
+static void CullRange(const Frustum& frustum, const glm::vec3& center, const glm::vec3& extent,
+    const glm::mat4* instances, uint32_t begin, uint32_t end, std::vector<uint32_t>& visible)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        const glm::mat4& m = instances[i];
+
+        // transformed box from center and extents (Arvo) instead of eight corners
+        glm::vec3 c = glm::vec3(m * glm::vec4(center, 1.0f));
+        glm::vec3 e;
+        for (int r = 0; r < 3; r++)
+            e[r] = fabsf(m[0][r]) * extent.x + fabsf(m[1][r]) * extent.y + fabsf(m[2][r]) * extent.z;
+
+        if (frustum.Intersects(AABB(c - e, c + e)))
+            visible.push_back(i);
+    }
+}
+
+void InstanceCuller::Cull(const Frustum& frustum, const AABB& local_bounds,
+    const glm::mat4* instances, uint32_t count, std::vector<uint32_t>& visible)
+{
+    glm::vec3 center = local_bounds.Center();
+    glm::vec3 extent = (local_bounds.max - local_bounds.min) * 0.5f;
+
+    JobSystem* jobs = JobSystem::GetInstance();
+    uint32_t batches = jobs->GetBatchCount(count, PARALLEL_CULL_THRESHOLD);
+    if (batches <= 1) {
+        CullRange(frustum, center, extent, instances, 0, count, visible);
+        return;
+    }
+
+    // each batch culls a contiguous range; concatenating the results keeps the instance order
+    std::vector<std::vector<uint32_t>> results(batches);
+    jobs->ParallelFor(count, batches, [&](uint32_t batch, uint32_t begin, uint32_t end) {
+        CullRange(frustum, center, extent, instances, begin, end, results[batch]);
+    });
+    for (auto& r : results)
+        visible.insert(visible.end(), r.begin(), r.end());
+}
+
+void InstanceCuller::Compact(const void* src, size_t stride, const std::vector<uint32_t>& visible, void* dst)
+{
+    const char* in = static_cast<const char*>(src);
+    char* out = static_cast<char*>(dst);
+    for (auto i : visible) {
+        memcpy(out, in + i * stride, stride);
+        out += stride;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "frustum.h"
+
+#include <vector>
+
+// CPU culling of instanced draws. Instance i is placed at model * instances[i], matching
+// the convention of the instanced shaders where the first mat4 instance attribute is the
+// per-instance transformation.
+class InstanceCuller {
+public:
+    // appends the indices of the instances whose bounds overlap the frustum to 'visible'; pass
+    // the frustum of view_proj * model so the instance matrices are tested without the model matrix
+    static void Cull(const Frustum& frustum, const AABB& local_bounds,
+                     const glm::mat4* instances, uint32_t count, std::vector<uint32_t>& visible);
+
+    // gathers the 'visible' elements of a stream of 'stride' byte elements into 'dst'
+    static void Compact(const void* src, size_t stride, const std::vector<uint32_t>& visible, void* dst);
+};
@@ -0,0 +1,276 @@
+#include "jobsystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+// index of the worker running on this thread, or -1 outside the pool
+static thread_local int t_workerIndex = -1;
+
+JobSystem* JobSystem::GetInstance()
+{
+    static JobSystem jobs;
+    return &jobs;
+}
+
+JobSystem::JobSystem()
+    : _queued(0),
+    _quit(false)
+{
+    // the thread that submits the work helps with it, so it takes the place of one worker
+    uint32_t num_workers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    for (uint32_t i = 0; i <= num_workers; i++)
+        _queues.emplace_back(new Queue);
+    for (uint32_t i = 0; i < num_workers; i++)
+        _workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _quit = true;
+    }
+    _wake.notify_all();
+    for (auto& w : _workers)
+        w.join();
+}
+
+uint32_t JobSystem::GetBatchCount(uint32_t count, uint32_t min_batch_size) const
+{
+    return std::max(1u, std::min(GetThreadCount(), count / std::max(1u, min_batch_size)));
+}
+
+void JobSystem::Run(Job job, Counter* counter, Counter* after)
+{
+    if (counter != nullptr)
+        counter->_pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (after != nullptr) {
+        // Finish takes the continuations under the same lock after the count reaches zero, so
+        // a job parked here is always picked up
+        std::lock_guard<std::mutex> lock(after->_mutex);
+        if (!after->Done()) {
+            after->_continuations.push_back({ std::move(job), counter });
+            return;
+        }
+    }
+    Push({ std::move(job), counter }, false);
+}
+
+void JobSystem::RunBackground(Job job, Counter* counter)
+{
+    if (counter != nullptr)
+        counter->_pending.fetch_add(1, std::memory_order_relaxed);
+    Push({ std::move(job), counter }, true);
+}
+
+void JobSystem::Push(Task task, bool background)
+{
+    Queue& queue = background ? _background : *_queues[t_workerIndex >= 0 ? (size_t)t_workerIndex : _workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _queued++;
+    }
+    _wake.notify_one();
+}
+
+bool JobSystem::Pop(Queue& queue, bool back, Task& task)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    if (back) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+    }
+    else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+    }
+    return true;
+}
+
+bool JobSystem::RunOne(bool background)
+{
+    // own jobs newest first while they are still in cache, then the oldest of the submitting
+    // threads and of the other workers, which tend to be the largest
+    const size_t num_queues = _queues.size();
+    const size_t self = t_workerIndex >= 0 ? t_workerIndex : num_queues - 1;
+    Task task;
+    bool found = Pop(*_queues[self], t_workerIndex >= 0, task);
+    if (!found && t_workerIndex >= 0)
+        found = Pop(*_queues[num_queues - 1], false, task);
+    for (size_t i = 1; !found && i < num_queues; i++)
+        found = Pop(*_queues[(self + i) % num_queues], false, task);
+    if (!found && background)
+        found = Pop(_background, false, task);
+    if (!found)
+        return false;
+
+    _queued--;
+    task.job();
+    Finish(task.counter);
+    return true;
+}
+
+void JobSystem::Finish(Counter* counter)
+{
+    if (counter == nullptr)
+        return;
+
+    // jobs that are not the last one leave without the lock
+    uint32_t pending = counter->_pending.load(std::memory_order_relaxed);
+    while (pending > 1) {
+        if (counter->_pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel))
+            return;
+    }
+
+    // the last one drops the count to zero under the lock, which Wait takes before it returns,
+    // so the counter is not touched after its owner may have destroyed it
+    std::vector<Task> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->_mutex);
+        if (counter->_pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        continuations.swap(counter->_continuations);
+    }
+    for (auto& task : continuations)
+        Push(std::move(task), false);
+}
+
+void JobSystem::Wait(Counter& counter)
+{
+    while (!counter.Done()) {
+        if (!RunOne(false))
+            std::this_thread::yield();
+    }
+    // waits for Finish to release the counter
+    std::lock_guard<std::mutex> lock(counter._mutex);
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t batches, const RangeJob& job)
+{
+    batches = std::max(1u, std::min(batches, count));
+    uint32_t chunk = (count + batches - 1) / batches;
+
+    Counter counter;
+    for (uint32_t b = 1; b < batches; b++) {
+        uint32_t begin = std::min(count, b * chunk);
+        uint32_t end = std::min(count, begin + chunk);
+        Run([&job, b, begin, end] { job(b, begin, end); }, &counter);
+    }
+    job(0, 0, std::min(count, chunk));
+    Wait(counter);
+}
+
+void JobSystem::WorkerLoop(uint32_t index)
+{
+    t_workerIndex = (int)index;
+    for (;;) {
+        if (RunOne(true))
+            continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _wake.wait(lock, [this]() { return _quit || _queued > 0; });
+        if (_quit)
+            return;
+    }
+}
+
+// spins for roughly the time of a small culling or decoding job
+static float BenchmarkWork(uint32_t iterations, uint32_t seed)
+{
+    float x = float(seed);
+    for (uint32_t i = 0; i < iterations; i++)
+        x = sqrtf(x * 1.0001f + 1.0f);
+    return x;
+}
+
+void JobSystem::RunBenchmark(std::ostream& out)
+{
+    using clock = std::chrono::high_resolution_clock;
+    auto ms = [](clock::time_point start) { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+    static const uint32_t NUM_TASKS = 2000;
+    static const uint32_t NUM_ITEMS = 1 << 20;
+    static const uint32_t TASK_ITERATIONS[] = { 1000, 20000 };
+    std::vector<float> results(std::max(NUM_TASKS, NUM_ITEMS));
+    char line[256];
+
+    snprintf(line, sizeof(line), "[JOBS] %u threads\n", GetThreadCount());
+    out << line;
+
+    // independent tasks, one std::thread each against one job each
+    for (uint32_t iterations : TASK_ITERATIONS) {
+        auto start = clock::now();
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < NUM_TASKS; i++)
+            threads.emplace_back([&results, i, iterations] { results[i] = BenchmarkWork(iterations, i); });
+        for (auto& t : threads)
+            t.join();
+        double thread_ms = ms(start);
+
+        start = clock::now();
+        Counter counter;
+        for (uint32_t i = 0; i < NUM_TASKS; i++)
+            Run([&results, i, iterations] { results[i] = BenchmarkWork(iterations, i); }, &counter);
+        Wait(counter);
+        double job_ms = ms(start);
+
+        snprintf(line, sizeof(line), "[JOBS] %u tasks of %u iterations: thread per task %.2f ms, jobs %.2f ms (%.1fx)\n",
+            NUM_TASKS, iterations, thread_ms, job_ms, job_ms > 0.0 ? thread_ms / job_ms : 0.0);
+        out << line;
+    }
+
+    // a loop over many small items, split into a thread per range against ParallelFor; the
+    // repeated runs are how the culling calls it every frame
+    static const int LOOP_RUNS = 100;
+    uint32_t batches = GetThreadCount();
+    auto start = clock::now();
+    for (int run = 0; run < LOOP_RUNS; run++) {
+        std::vector<std::thread> threads;
+        uint32_t chunk = (NUM_ITEMS + batches - 1) / batches;
+        for (uint32_t t = 0; t < batches; t++) {
+            uint32_t begin = std::min(NUM_ITEMS, t * chunk);
+            uint32_t end = std::min(NUM_ITEMS, begin + chunk);
+            threads.emplace_back([&results, begin, end] {
+                for (uint32_t i = begin; i < end; i++)
+                    results[i] = BenchmarkWork(4, i);
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+    }
+    double thread_ms = ms(start) / LOOP_RUNS;
+
+    start = clock::now();
+    for (int run = 0; run < LOOP_RUNS; run++) {
+        ParallelFor(NUM_ITEMS, batches, [&results](uint32_t, uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++)
+                results[i] = BenchmarkWork(4, i);
+        });
+    }
+    double job_ms = ms(start) / LOOP_RUNS;
+
+    snprintf(line, sizeof(line), "[JOBS] parallel loop over %u items: thread per range %.3f ms, jobs %.3f ms (%.1fx)\n",
+        NUM_ITEMS, thread_ms, job_ms, job_ms > 0.0 ? thread_ms / job_ms : 0.0);
+    out << line;
+
+    // nested loops, as meshlet culling inside the parallel draw list building; with a thread
+    // per range these would multiply the thread count, jobs share the same workers
+    start = clock::now();
+    ParallelFor(64, 64, [this, &results](uint32_t batch, uint32_t, uint32_t) {
+        ParallelFor(NUM_ITEMS / 64, GetThreadCount(), [&results, batch](uint32_t, uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++)
+                results[batch * (NUM_ITEMS / 64) + i] = BenchmarkWork(4, i);
+        });
+    });
+    snprintf(line, sizeof(line), "[JOBS] 64 nested loops of %u items: jobs %.3f ms\n", NUM_ITEMS / 64, ms(start));
+    out << line;
+}
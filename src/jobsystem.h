@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Work-stealing job scheduler shared by the loaders, the mesh processing and the culling.
+// Every worker owns a deque: it pushes and pops its own jobs at the back and steals from the
+// front of the others. Threads outside the pool submit to a shared queue, and a thread waiting
+// for a counter runs queued jobs until the counter drops to zero, so the GL thread helps out
+// instead of blocking. Background jobs, such as texture decoding, are only picked up by the
+// workers, so a waiting GL thread never gets stuck behind one.
+class JobSystem {
+    struct Task;
+
+public:
+    using Job = std::function<void()>;
+    // runs 'begin' to 'end' of a ParallelFor; 'batch' indexes per-batch results
+    using RangeJob = std::function<void(uint32_t batch, uint32_t begin, uint32_t end)>;
+
+    // counts the unfinished jobs submitted with it; jobs submitted 'after' it run once it drops to zero
+    class Counter {
+    public:
+        Counter() : _pending(0) {}
+        bool Done() const { return _pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class JobSystem;
+        Counter(const Counter&) = delete;
+        Counter& operator=(const Counter&) = delete;
+
+        std::atomic<uint32_t>  _pending;
+        std::mutex             _mutex;
+        std::vector<Task>      _continuations;
+    };
+
+    static JobSystem* GetInstance();
+
+    // worker threads plus the calling thread
+    uint32_t  GetThreadCount() const { return (uint32_t)_workers.size() + 1; }
+    // batches a ParallelFor over 'count' items splits into, none smaller than 'min_batch_size';
+    // one means the loop is not worth distributing
+    uint32_t  GetBatchCount(uint32_t count, uint32_t min_batch_size) const;
+
+    // queues 'job', counted by 'counter', to start once 'after' is done
+    void      Run(Job job, Counter* counter = nullptr, Counter* after = nullptr);
+    // queues 'job' for the workers only
+    void      RunBackground(Job job, Counter* counter = nullptr);
+    // runs queued jobs on the calling thread until 'counter' is done
+    void      Wait(Counter& counter);
+    // splits [0, count) into 'batches' contiguous ranges, runs the first on the calling thread
+    // and returns when all are done
+    void      ParallelFor(uint32_t count, uint32_t batches, const RangeJob& job);
+
+    // times small jobs and parallel loops against a std::thread per task and prints the results
+    void      RunBenchmark(std::ostream& out);
+
+private:
+    JobSystem();
+    ~JobSystem();
+
+    struct Task {
+        Job      job;
+        Counter* counter;
+    };
+
+    struct Queue {
+        std::mutex        mutex;
+        std::deque<Task>  tasks;
+    };
+
+    void      Push(Task task, bool background);
+    // runs one queued job, background ones only if 'background'; false if none was found
+    bool      RunOne(bool background);
+    bool      Pop(Queue& queue, bool back, Task& task);
+    void      Finish(Counter* counter);
+    void      WorkerLoop(uint32_t index);
+
+    std::vector<std::thread>              _workers;
+    // one per worker, then the queue of the threads outside the pool
+    std::vector<std::unique_ptr<Queue>>   _queues;
+    Queue                                 _background;
+    std::mutex                            _sleepMutex;
+    std::condition_variable               _wake;
+    std::atomic<int32_t>                  _queued;
+    bool                                  _quit;
+};
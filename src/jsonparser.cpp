@@ -6,6 +6,10 @@
 #include "mesh.h"
 #include "rendererfactory.h"
 #include "renderpass.h"
+#include "geometryarena.h"
+#include "texturestreamer.h"
+#include "jobsystem.h"
+#include "mappedfile.h"
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -18,6 +22,7 @@
 #include <iostream>
 #include <cctype>
 #include <regex>
+#include <chrono>
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -34,6 +39,9 @@ static bool g_enable_logging = false;
 }
 
 SceneParser::SceneParser()
+    : _widthOverride(0),
+    _heightOverride(0),
+    _headless(false)
 {
     char* val = getenv("GFXLAB_ENABLE_PARSER_LOGGING");
     if (val && atoi(val) == 1)
@@ -103,17 +111,129 @@ void SceneParser::SetResourceLocations()
     }
 }
 
+// FNV-1a of the packed values, so that reloads notice edited instance data
+static uint64_t HashInstanceValues(const std::vector<float>& values, size_t stride)
+{
+    uint64_t hash = 14695981039346656037ull ^ stride;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values.data());
+    for (size_t i = 0; i < values.size() * sizeof(float); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+json SceneParser::ParseConfig(std::istream& input)
+{
+    // the parser is much faster on a buffer than on a stream
+    input.seekg(0, std::ios::end);
+    std::string text((size_t)std::max<std::streamoff>(input.tellg(), 0), '\0');
+    input.seekg(0, std::ios::beg);
+    input.read(&text[0], text.size());
+
+    _instanceStreams.clear();
+    _instanceStreamIndex.clear();
+    _parseFrames.clear();
+    return json::parse(text.c_str(), [this](int, json::parse_event_t event, json& parsed) {
+        return StreamInstanceData(event, parsed);
+    });
+}
+
+bool SceneParser::StreamInstanceData(json::parse_event_t event, json& parsed)
+{
+    // the numbers of Scene.geometries[i].instancing.data arrays go straight into packed
+    // buffers and are dropped from the DOM, which would otherwise hold every one of them as
+    // a json value; returning false discards the value
+    using event_t = json::parse_event_t;
+    switch (event) {
+    case event_t::key:
+        _parseFrames.back().key = parsed.get<std::string>();
+        return true;
+
+    case event_t::object_start:
+    case event_t::array_start: {
+        ParseFrame frame = { event == event_t::array_start, std::string(), -1, false, 0 };
+        const auto& f = _parseFrames;
+        if (frame.array && f.size() == 6 && f[0].key == "Scene" && f[1].key == "geometries" && f[2].array &&
+            f[3].key == "instancing" && f[4].key == "data" && !f[5].key.empty()) {
+            frame.stream = (int)_instanceStreams.size();
+            _instanceStreams.push_back({ std::make_shared<std::vector<float>>(), 0, 0, true });
+        }
+        else if (!f.empty() && f.back().stream >= 0 && !f.back().element) {
+            // a vector or a transformation of the stream
+            frame.stream = f.back().stream;
+            frame.element = true;
+            frame.first = _instanceStreams[frame.stream].values->size();
+        }
+        _parseFrames.push_back(frame);
+        return true;
+    }
+
+    case event_t::value: {
+        if (_parseFrames.empty() || _parseFrames.back().stream < 0 || !_parseFrames.back().array)
+            return true;
+        const ParseFrame& top = _parseFrames.back();
+        InstanceStream& stream = _instanceStreams[top.stream];
+        if (!parsed.is_number())
+            stream.valid = false;
+        else
+            stream.values->push_back(parsed.get<float>());
+        // numbers directly in the stream are instances of one component
+        if (!top.element) {
+            stream.valid = stream.valid && (stream.stride == 0 || stream.stride == sizeof(float));
+            stream.stride = sizeof(float);
+            stream.count++;
+        }
+        return false;
+    }
+
+    case event_t::object_end:
+    case event_t::array_end: {
+        ParseFrame frame = std::move(_parseFrames.back());
+        _parseFrames.pop_back();
+        if (frame.stream < 0)
+            return true;
+
+        InstanceStream& stream = _instanceStreams[frame.stream];
+        if (frame.element) {
+            if (!frame.array) {
+                glm::mat4 transformation;
+                ParseGeometryTransformation(parsed, transformation, "instancing.data[" + std::to_string(stream.count) + "].");
+                stream.values->insert(stream.values->end(), glm::value_ptr(transformation), glm::value_ptr(transformation) + 16);
+            }
+            size_t components = stream.values->size() - frame.first;
+            size_t stride = components * sizeof(float);
+            stream.valid = stream.valid && ((components >= 1 && components <= 4) || components == 16) &&
+                           (stream.stride == 0 || stream.stride == stride);
+            stream.stride = stride;
+            stream.count++;
+            return false;
+        }
+
+        // the DOM only keeps the hash, so reload comparisons do not depend on the position of
+        // the stream in the file; identical streams share the first one's buffer
+        uint64_t hash = HashInstanceValues(*stream.values, stream.stride);
+        if (!_instanceStreamIndex.emplace(hash, (size_t)frame.stream).second)
+            stream.values = std::make_shared<std::vector<float>>();
+        parsed = json::object();
+        parsed["hash"] = hash;
+        return true;
+    }
+    }
+    return true;
+}
+
 WindowPtr SceneParser::Parse(const char* file)
 {
     SetResourceLocations();
 
-    std::ifstream input(_gfxlab_config_dir+"/"+file);
+    _configPath = _gfxlab_config_dir + "/" + file;
+    std::ifstream input(_configPath);
     if (!input.is_open()) {
         std::cout << "failed to open " << file << std::endl;
         std::exit(-1);
     }
   
-    input >> _j;
+    _j = ParseConfig(input);
+    ParseBenchmark();
     auto window = ParseWindow();
     _renderer = ParseRenderer();
     auto scene = ParseScene();
@@ -122,9 +242,257 @@ WindowPtr SceneParser::Parse(const char* file)
     ParseStateCallbacks();
     ParseRenderPasses();
     window->SetRenderer(_renderer);
+    // the geometries keep the instance streams they use
+    _instanceStreams.clear();
+    _instanceStreamIndex.clear();
     return window;
 }
 
+static const json& GetSection(const json& j, const char* name)
+{
+    static const json none;
+    auto it = j.find(name);
+    return it == j.end() ? none : *it;
+}
+
+bool SceneParser::Reload()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // a half edited file must not end the session, so the parse error is caught here
+    std::ifstream input(_configPath);
+    json j;
+    try {
+        j = ParseConfig(input);
+    }
+    catch (const json::exception& e) {
+        _instanceStreams.clear();
+        _instanceStreamIndex.clear();
+        std::cout << "failed to parse " << _configPath << ": " << e.what() << ", keeping the current scene" << std::endl;
+        return false;
+    }
+    if (!j.is_object()) {
+        _instanceStreams.clear();
+        _instanceStreamIndex.clear();
+        std::cout << "failed to parse " << _configPath << ", keeping the current scene" << std::endl;
+        return false;
+    }
+    json old = std::move(_j);
+    _j = std::move(j);
+
+    for (auto name : { "Window", "Renderer", "SetStateCallbacks" }) {
+        if (GetSection(old, name) != GetSection(_j, name))
+            std::cout << "'" << name << "' changed, restart to apply it" << std::endl;
+    }
+    if (GetSection(old, "Benchmark") != GetSection(_j, "Benchmark")) {
+        _benchmark = Benchmark::Settings();
+        ParseBenchmark();
+    }
+
+    std::unordered_set<std::string> replaced, removed;
+    bool scene_changed = false;
+    ScenePtr scene = _renderer->GetScene();
+    if (GetSection(old, "Scene") != GetSection(_j, "Scene")) {
+        if (scene != nullptr && GetSection(_j, "Scene").is_object())
+            ReloadScene(scene, GetSection(old, "Scene"), replaced, removed, scene_changed);
+        else
+            std::cout << "'Scene' was added or removed, restart to apply it" << std::endl;
+    }
+
+    int rebuilt = ReloadRenderPasses(old, replaced, removed, scene_changed);
+    _instanceStreams.clear();
+    _instanceStreamIndex.clear();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+    printf("reloaded %s in %lld ms: %d geometries replaced, %d render passes rebuilt\n", _configPath.c_str(),
+        (long long)elapsed.count(), (int)replaced.size(), rebuilt);
+    return true;
+}
+
+void SceneParser::ReloadScene(ScenePtr scene, const json& old_scene, std::unordered_set<std::string>& replaced,
+    std::unordered_set<std::string>& removed, bool& scene_changed)
+{
+    const json& new_scene = _j["Scene"];
+
+    if (GetSection(old_scene, "camera") != GetSection(new_scene, "camera") && GetSection(new_scene, "camera").is_object())
+        ParseCamera(scene, new_scene["camera"]);
+
+    float lod_pixel_error = 1.0f;
+    ProcessFloatAttrib(new_scene, "lod_pixel_error", "Scene.lod_pixel_error", false, lod_pixel_error);
+    scene->SetLODPixelError(lod_pixel_error);
+
+    bool occlusion_culling = false;
+    ProcessBoolAttrib(new_scene, "occlusion_culling", "Scene.occlusion_culling", false, occlusion_culling);
+    scene->EnableOcclusionCulling(occlusion_culling);
+
+    if (GetSection(old_scene, "Lights") != GetSection(new_scene, "Lights")) {
+        scene->ClearLights();
+        if (GetSection(new_scene, "Lights").is_array())
+            ParseLights(scene, new_scene["Lights"]);
+    }
+
+    auto by_name = [](const json& geoms) {
+        std::unordered_map<std::string, const json*> result;
+        if (geoms.is_array()) {
+            for (auto& g : geoms) {
+                if (g.is_object() && g.find("name") != g.end() && g["name"].is_string())
+                    result[g["name"].get<std::string>()] = &g;
+            }
+        }
+        return result;
+    };
+    auto old_geoms = by_name(GetSection(old_scene, "geometries"));
+    auto new_geoms = by_name(GetSection(new_scene, "geometries"));
+
+    for (auto& it : old_geoms) {
+        if (new_geoms.find(it.first) == new_geoms.end() && _geometries.find(it.first) != _geometries.end()) {
+            scene->RemoveGeometry(_geometries[it.first]);
+            _geometries.erase(it.first);
+            removed.insert(it.first);
+            scene_changed = true;
+        }
+    }
+
+    // moving or retexturing a geometry updates it in place, any other edit loads it again
+    json reload = json::array();
+    for (auto& it : new_geoms) {
+        const json& geom = *it.second;
+        auto old_it = old_geoms.find(it.first);
+        if (old_it == old_geoms.end() || _geometries.find(it.first) == _geometries.end()) {
+            reload.push_back(geom);
+            scene_changed = true;
+            continue;
+        }
+        const json& old_geom = *old_it->second;
+        if (old_geom == geom)
+            continue;
+
+        json a = old_geom, b = geom;
+        for (auto key : { "transformation", "texture" }) {
+            a.erase(key);
+            b.erase(key);
+        }
+        if (a != b) {
+            reload.push_back(geom);
+            replaced.insert(it.first);
+            continue;
+        }
+
+        GeometryPtr g = _geometries[it.first];
+        std::string attrib_full_name = "Scene.geometries." + it.first + ".";
+        if (GetSection(old_geom, "transformation") != GetSection(geom, "transformation")) {
+            glm::mat4 transformation;
+            if (geom.find("transformation") != geom.end())
+                ParseGeometryTransformation(geom["transformation"], transformation, attrib_full_name);
+            g->SetSceneTransformation(transformation);
+        }
+        if (GetSection(old_geom, "texture") != GetSection(geom, "texture")) {
+            std::string tex;
+            ProcessStringAttrib(geom, "texture", attrib_full_name + "texture", false, tex);
+            if (tex.empty())
+                g->SetTexture(GL_TEXTURE_2D, 0);
+            else if (TextureStreamer::GetInstance()->IsEnabled()) {
+                std::weak_ptr<Geometry> weak = g;
+                g->SetTexture(GL_TEXTURE_2D, TextureStreamer::GetInstance()->Request("2D", _gfxlab_texture_dir + "/" + tex,
+                    [weak](GLuint id) {
+                        if (auto geom = weak.lock())
+                            geom->SetTexture(GL_TEXTURE_2D, id);
+                    }));
+            }
+            else
+                g->SetTexture(GL_TEXTURE_2D, ResourceManager::GetInstance()->LoadTexture("2D", _gfxlab_texture_dir + "/" + tex));
+        }
+    }
+
+    if (!reload.empty()) {
+        bool parallel_loading = false;
+        ProcessBoolAttrib(new_scene, "parallel_loading", "Scene.parallel_loading", false, parallel_loading);
+        ParseGeometries(scene, reload, parallel_loading);
+    }
+}
+
+int SceneParser::ReloadRenderPasses(const json& old, const std::unordered_set<std::string>& replaced,
+    const std::unordered_set<std::string>& removed, bool scene_changed)
+{
+    const json& old_passes = GetSection(old, "RenderPasses");
+    const json& new_passes = GetSection(_j, "RenderPasses");
+    if (!new_passes.is_array() || !old_passes.is_array()) {
+        std::cout << "'RenderPasses' must stay a JSON array, restart to apply it" << std::endl;
+        return 0;
+    }
+
+    // attachments, their sizes and their readers decide the graph
+    auto graph_signature = [](const json& rp) {
+        json signature = json::object();
+        if (rp.is_object()) {
+            for (auto key : { "fbo", "textures", "show_image" }) {
+                if (rp.find(key) != rp.end())
+                    signature[key] = rp[key];
+            }
+        }
+        return signature;
+    };
+    bool graph_changed = old_passes.size() != new_passes.size();
+    for (size_t i = 0; i < new_passes.size() && !graph_changed; i++)
+        graph_changed = graph_signature(old_passes[i]) != graph_signature(new_passes[i]);
+
+    if (graph_changed) {
+        _renderer->ClearRenderPasses();
+        _fboAttachments.clear();
+        _passSlots.clear();
+        _renderGraph.Reset();
+        ParseRenderPasses();
+        return (int)_renderer->GetRenderPassCount();
+    }
+
+    // programs are shared by name, so an edited program rebuilds every pass using it
+    std::unordered_set<std::string> changed_programs;
+    for (auto& rp : new_passes) {
+        if (!rp.is_object() || rp.find("program") == rp.end() || !rp["program"].is_object())
+            continue;
+        auto& prog = rp["program"];
+        if (prog.find("name") == prog.end() || !prog["name"].is_string())
+            continue;
+        std::string name = prog["name"].get<std::string>();
+        auto it = _programDescs.find(name);
+        if (it != _programDescs.end() && it->second != prog)
+            changed_programs.insert(name);
+    }
+
+    int rebuilt = 0;
+    for (size_t i = 0; i < new_passes.size(); i++) {
+        const json& rp = new_passes[i];
+        if (_passSlots[i] < 0 || !rp.is_object())
+            continue;
+
+        bool rebuild = rp != old_passes[i];
+        if (!rebuild && rp.find("program") != rp.end() && rp["program"].is_object() && rp["program"].find("name") != rp["program"].end())
+            rebuild = changed_programs.count(rp["program"]["name"].get<std::string>()) > 0;
+        if (!rebuild) {
+            // a pass without a geometry list draws the whole scene
+            std::vector<std::string> geom_names;
+            if (rp.find("geometries") == rp.end())
+                rebuild = scene_changed || !replaced.empty();
+            else if (rp["geometries"].is_array()) {
+                // a removed geometry must leave the lists that named it
+                for (auto& name : rp["geometries"]) {
+                    if (name.is_string())
+                        rebuild = rebuild || replaced.count(name.get<std::string>()) > 0 || removed.count(name.get<std::string>()) > 0;
+                }
+            }
+        }
+        if (!rebuild)
+            continue;
+
+        RenderPassPtr render_pass = ParseSingleRenderPass(rp, (int)i);
+        if (render_pass != nullptr) {
+            _renderer->ReplaceRenderPass(_passSlots[i], std::move(render_pass));
+            rebuilt++;
+        }
+    }
+    return rebuilt;
+}
+
 WindowPtr SceneParser::ParseWindow()
 {
     std::string title;
@@ -146,7 +514,50 @@ WindowPtr SceneParser::ParseWindow()
         }
     }
 
-    return std::shared_ptr<Window>(Window::Create(title.c_str(), _width, _height));
+    if (_widthOverride > 0 && _heightOverride > 0) {
+        _width = _widthOverride;
+        _height = _heightOverride;
+    }
+    return std::shared_ptr<Window>(Window::Create(title.c_str(), _width, _height, _headless));
+}
+
+void SceneParser::ParseBenchmark()
+{
+    if (_j.find("Benchmark") == _j.end())
+        return;
+
+    LOGINFO("Parsing attribute 'Benchmark'...\n");
+    const json& bench = _j["Benchmark"];
+    if (!bench.is_object()) {
+        LOGERR("Expects a JSON object for the attribute 'Benchmark'\n");
+        return;
+    }
+
+    ProcessIntAttrib(bench, "frames", "Benchmark.frames", false, _benchmark.frames);
+    ProcessIntAttrib(bench, "warmup", "Benchmark.warmup", false, _benchmark.warmup);
+    ProcessIntAttrib(bench, "instance_updates", "Benchmark.instance_updates", false, _benchmark.instance_updates);
+
+    if (bench.find("camera_path") != bench.end()) {
+        if (!bench["camera_path"].is_array()) {
+            LOGERR("Expects a JSON array for the attribute Benchmark.camera_path\n");
+            return;
+        }
+
+        int key_id = 0;
+        for (auto& key : bench["camera_path"]) {
+            std::string full_name = "Benchmark.camera_path[" + std::to_string(key_id++) + "]";
+            std::vector<float> pos, focus, up = { 0.0f, 1.0f, 0.0f };
+            ProcessNumberArrayAttrib(key, "pos", full_name + ".pos", true, pos);
+            ProcessNumberArrayAttrib(key, "focus", full_name + ".focus", true, focus);
+            ProcessNumberArrayAttrib(key, "up", full_name + ".up", false, up);
+            if (pos.size() != 3 || focus.size() != 3 || up.size() != 3) {
+                LOGERR("Expects 3 numbers for pos, focus and up of %s\n", full_name.c_str());
+                continue;
+            }
+            _benchmark.camera_path.push_back({ glm::vec3(pos[0], pos[1], pos[2]),
+                glm::vec3(focus[0], focus[1], focus[2]), glm::vec3(up[0], up[1], up[2]) });
+        }
+    }
 }
 
 ScenePtr SceneParser::ParseScene()
@@ -169,9 +580,32 @@ ScenePtr SceneParser::ParseScene()
                 scene->SetCamera(cam);
             }
 
+            bool parallel_loading = false;
+            ProcessBoolAttrib(scene_object, "parallel_loading", "Scene.parallel_loading", false, parallel_loading);
+
+            bool geometry_arena = false;
+            ProcessBoolAttrib(scene_object, "geometry_arena", "Scene.geometry_arena", false, geometry_arena);
+            GeometryArena::GetInstance()->Enable(geometry_arena);
+
+            bool texture_streaming = false;
+            ProcessBoolAttrib(scene_object, "texture_streaming", "Scene.texture_streaming", false, texture_streaming);
+            TextureStreamer::GetInstance()->Enable(texture_streaming);
+            int upload_budget_kb = 0;
+            ProcessIntAttrib(scene_object, "texture_upload_budget_kb", "Scene.texture_upload_budget_kb", false, upload_budget_kb);
+            if (upload_budget_kb > 0)
+                TextureStreamer::GetInstance()->SetUploadBudget(size_t(upload_budget_kb) << 10);
+
+            float lod_pixel_error = scene->GetLODPixelError();
+            ProcessFloatAttrib(scene_object, "lod_pixel_error", "Scene.lod_pixel_error", false, lod_pixel_error);
+            scene->SetLODPixelError(lod_pixel_error);
+
+            bool occlusion_culling = false;
+            ProcessBoolAttrib(scene_object, "occlusion_culling", "Scene.occlusion_culling", false, occlusion_culling);
+            scene->EnableOcclusionCulling(occlusion_culling);
+
             if (scene_object.find("geometries") != scene_object.end()) {
                 if (scene_object["geometries"].is_array())
-                    ParseGeometries(scene, scene_object["geometries"]);
+                    ParseGeometries(scene, scene_object["geometries"], parallel_loading);
                 else
                     LOGERR("Expects a JSON array for the attribute Scene.geometries!\n");
             }
@@ -208,13 +642,21 @@ void SceneParser::ParseCamera(ScenePtr scene, const json& cam_settings)
     scene->SetCamera(cam);
 }
 
-void SceneParser::ParseGeometries(ScenePtr scene, const json& geom_settings)
+void SceneParser::ParseGeometries(ScenePtr scene, const json& geom_settings, bool parallel)
 {
     LOGINFO("Parsing attribute 'Scene.geometries'...\n");
     if (geom_settings.size() == 0)
         LOGINFO("No geometries are added to the scene!\n");
     
-    std::string attib_full_name, source, id, tex;
+    struct PendingGeometry {
+        GeometryPtr mesh;
+        std::string source;
+        std::string texture;
+    };
+    std::vector<PendingGeometry> pending;
+    std::vector<std::string>     textures;
+
+    std::string attib_full_name, id, tex;
     int geom_id = 0;
     for (auto& geom : geom_settings) {
         GeometryPtr mesh = std::shared_ptr<Geometry>(new Mesh);
@@ -231,19 +673,156 @@ void SceneParser::ParseGeometries(ScenePtr scene, const json& geom_settings)
         if (geom.find("instancing") != geom.end())
             ParseGeometryInstanceData(geom["instancing"], mesh, geom_id);
 
-        source = _gfxlab_model_dir + "/" + id;
-        ResourceManager::GetInstance()->LoadMesh(source, std::static_pointer_cast<Mesh>(mesh));
+        bool optimize = false;
+        ProcessBoolAttrib(geom, "optimize", attib_full_name + "optimize", false, optimize);
+        std::static_pointer_cast<Mesh>(mesh)->EnableOptimization(optimize);
+
+        bool lod = false;
+        ProcessBoolAttrib(geom, "lod", attib_full_name + "lod", false, lod);
+        std::static_pointer_cast<Mesh>(mesh)->EnableLODs(lod);
+
+        bool meshlets = false, meshlet_backface_culling = true;
+        ProcessBoolAttrib(geom, "meshlets", attib_full_name + "meshlets", false, meshlets);
+        ProcessBoolAttrib(geom, "meshlet_backface_culling", attib_full_name + "meshlet_backface_culling", false, meshlet_backface_culling);
+        std::static_pointer_cast<Mesh>(mesh)->EnableMeshlets(meshlets);
+        std::static_pointer_cast<Mesh>(mesh)->EnableMeshletBackfaceCulling(meshlet_backface_culling);
 
-        _geometries[id] = mesh;
-        scene->AddGeometry(mesh);
+        bool occluder = false;
+        ProcessBoolAttrib(geom, "occluder", attib_full_name + "occluder", false, occluder);
+        mesh->SetOccluder(occluder);
 
+        if (geom.find("vertex_format") != geom.end()) {
+            VertexFormat format;
+            ParseGeometryVertexFormat(geom["vertex_format"], format, attib_full_name + "vertex_format");
+            std::static_pointer_cast<Mesh>(mesh)->SetVertexFormat(format);
+        }
+
+        tex.clear();
         ProcessStringAttrib(geom, "texture", attib_full_name + "texture", false, tex);
         if (!tex.empty()) {
-            source = _gfxlab_texture_dir + "/" + tex;
-            GLuint tex_id = ResourceManager::GetInstance()->LoadTexture("2D", source);
-            mesh->SetTexture(GL_TEXTURE_2D, tex_id);
+            tex = _gfxlab_texture_dir + "/" + tex;
+            if (std::find(textures.begin(), textures.end(), tex) == textures.end())
+                textures.push_back(tex);
         }
+
+        pending.push_back({ mesh, _gfxlab_model_dir + "/" + id, tex });
+        geom_id++;
     }
+
+    // file parsing, normal computation, buffer packing and image decoding run on the
+    // loader threads; only the GL objects are created here, in scene order
+    auto start = std::chrono::high_resolution_clock::now();
+    // streamed textures are decoded and uploaded in the background while the scene renders
+    bool streaming = TextureStreamer::GetInstance()->IsEnabled();
+    size_t num_decoded = streaming ? 0 : textures.size();
+    std::vector<ResourceManager::TextureImage> images(textures.size());
+    RunLoaders(pending.size() + num_decoded, parallel, [&](size_t i) {
+        if (i < pending.size()) {
+            MeshPtr mesh = std::static_pointer_cast<Mesh>(pending[i].mesh);
+            ResourceManager::GetInstance()->LoadMeshData(pending[i].source, mesh);
+        }
+        else
+            ResourceManager::GetInstance()->DecodeTexture("2D", textures[i - pending.size()], images[i - pending.size()]);
+    });
+
+    for (auto& p : pending) {
+        MeshPtr mesh = std::static_pointer_cast<Mesh>(p.mesh);
+        ResourceManager::GetInstance()->UploadMesh(p.source, mesh);
+        // a geometry parsed again by Reload takes the place of the old one
+        auto existing = _geometries.find(p.mesh->GetName());
+        if (existing != _geometries.end())
+            scene->ReplaceGeometry(existing->second, p.mesh);
+        else
+            scene->AddGeometry(p.mesh);
+        _geometries[p.mesh->GetName()] = p.mesh;
+
+        if (!p.texture.empty() && streaming) {
+            std::weak_ptr<Geometry> geom = p.mesh;
+            GLuint tex_id = TextureStreamer::GetInstance()->Request("2D", p.texture, [geom](GLuint id) {
+                if (auto g = geom.lock())
+                    g->SetTexture(GL_TEXTURE_2D, id);
+            });
+            p.mesh->SetTexture(GL_TEXTURE_2D, tex_id);
+        }
+        else if (!p.texture.empty()) {
+            size_t tex_idx = std::find(textures.begin(), textures.end(), p.texture) - textures.begin();
+            GLuint tex_id = ResourceManager::GetInstance()->UploadTexture("2D", p.texture, images[tex_idx]);
+            p.mesh->SetTexture(GL_TEXTURE_2D, tex_id);
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+    LOGINFO("Loaded %d geometries and %d textures in %lld ms (%s)\n", (int)pending.size(), (int)num_decoded,
+        (long long)elapsed.count(), parallel ? "parallel" : "serial");
+}
+
+void SceneParser::ParseGeometryVertexFormat(const json& j, VertexFormat& format, const std::string& full_name)
+{
+    // either "compressed", or an object selecting the format of each attribute
+    if (j.is_string()) {
+        if (j.get<std::string>() == "compressed") {
+            format.position = VertexFormat::POSITION_UNORM16;
+            format.normal = VertexFormat::NORMAL_INT_2_10_10_10;
+            format.color = VertexFormat::COLOR_UNORM8;
+            format.texcoord = VertexFormat::TEXCOORD_HALF;
+            LOGINFO("%s is set to compressed\n", full_name.c_str());
+        }
+        else if (j.get<std::string>() != "float")
+            LOGERR("Unknown vertex format '%s' for the attribute %s\n", j.get<std::string>().c_str(), full_name.c_str());
+        return;
+    }
+
+    if (!j.is_object()) {
+        LOGERR("Expects a string or a JSON object for the attribute %s\n", full_name.c_str());
+        return;
+    }
+
+    std::string value;
+    ProcessStringAttrib(j, "position", full_name + ".position", false, value);
+    if (value == "unorm16")
+        format.position = VertexFormat::POSITION_UNORM16;
+    else if (!value.empty() && value != "float")
+        LOGERR("Unknown format '%s' for the attribute %s.position\n", value.c_str(), full_name.c_str());
+
+    value.clear();
+    ProcessStringAttrib(j, "normal", full_name + ".normal", false, value);
+    if (value == "int2_10_10_10")
+        format.normal = VertexFormat::NORMAL_INT_2_10_10_10;
+    else if (value == "oct16")
+        format.normal = VertexFormat::NORMAL_OCT16;
+    else if (!value.empty() && value != "float")
+        LOGERR("Unknown format '%s' for the attribute %s.normal\n", value.c_str(), full_name.c_str());
+
+    value.clear();
+    ProcessStringAttrib(j, "color", full_name + ".color", false, value);
+    if (value == "unorm8")
+        format.color = VertexFormat::COLOR_UNORM8;
+    else if (!value.empty() && value != "float")
+        LOGERR("Unknown format '%s' for the attribute %s.color\n", value.c_str(), full_name.c_str());
+
+    value.clear();
+    ProcessStringAttrib(j, "texcoord", full_name + ".texcoord", false, value);
+    if (value == "half")
+        format.texcoord = VertexFormat::TEXCOORD_HALF;
+    else if (!value.empty() && value != "float")
+        LOGERR("Unknown format '%s' for the attribute %s.texcoord\n", value.c_str(), full_name.c_str());
+}
+
+void SceneParser::RunLoaders(size_t count, bool parallel, const std::function<void(size_t)>& task)
+{
+    if (!parallel || count <= 1) {
+        for (size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    // one job per loader, so the loaders that finish early pick up the mesh processing jobs
+    // the others submit; this thread helps until all are done
+    JobSystem* jobs = JobSystem::GetInstance();
+    JobSystem::Counter done;
+    for (size_t i = 0; i < count; i++)
+        jobs->Run([&task, i]() { task(i); }, &done);
+    jobs->Wait(done);
 }
 
 void SceneParser::ParseGeometryInstanceData(const json& instancing, GeometryPtr geom, int geom_id)
@@ -253,30 +832,47 @@ void SceneParser::ParseGeometryInstanceData(const json& instancing, GeometryPtr
         int num_instances;
         ProcessIntAttrib(instancing, "count", full_attrib_name + "count", true, num_instances);
         geom->SetInstanceNum(num_instances);
+        // dynamic instances can be rewritten every frame, e.g. by the benchmark's instance_updates
+        bool dynamic = false;
+        ProcessBoolAttrib(instancing, "dynamic", full_attrib_name + "dynamic", false, dynamic);
+        geom->EnableDynamicInstances(dynamic);
 
         if (instancing.find("data") != instancing.end()) {
             const json& data = instancing["data"];
-            auto it = data.begin();
-            static auto data_type = it.value().type();
-            for (; it != data.end(); ++it) {
+            for (auto it = data.begin(); it != data.end(); ++it) {
                 std::string prop_name = full_attrib_name + "data." + it.key();
-
-                if (!it.value().is_array()) {
-                    LOGERR("Expects ARRARY for %s!\n", prop_name.c_str());
+                const json& entry = it.value();
+
+                std::shared_ptr<const void> values;
+                size_t stride = 0, count = 0;
+                if (entry.is_object() && entry.find("hash") != entry.end()) {
+                    // arrays were packed by ParseConfig, the geometry takes over the buffer
+                    auto index = _instanceStreamIndex.find(entry["hash"].get<uint64_t>());
+                    assert(index != _instanceStreamIndex.end());
+                    const InstanceStream& stream = _instanceStreams[index->second];
+                    if (!stream.valid) {
+                        LOGERR("%s must hold only numbers, only vectors of 1 to 4 or 16 numbers, or only transformations!\n", prop_name.c_str());
+                        continue;
+                    }
+                    values = std::shared_ptr<const void>(stream.values, stream.values->data());
+                    stride = stream.stride;
+                    count = stream.count;
                 }
-
-                if (it.value().size() != num_instances) {
-                    LOGERR("The length of array %s must be %d!\n", prop_name.c_str(), num_instances);
+                else if (entry.is_object() && entry.find("file") != entry.end()) {
+                    if (!MapInstanceDataFile(entry, prop_name, (uint32_t)num_instances, values, stride))
+                        continue;
+                    count = num_instances;
                 }
-
-                if (it.value().type() != data_type) {
-                    LOGERR("%s contains incompatible data!", prop_name.c_str());
+                else {
+                    LOGERR("Expects an ARRAY or a binary file for %s!\n", prop_name.c_str());
+                    continue;
                 }
 
-                void* data;
-                size_t size, stride;
-                ParseGeometryInstanceDataHelper(it.value(), geom, prop_name, &data, size, stride);
-                geom->SetInstanceData(data, size, stride);
+                if (count != (size_t)num_instances) {
+                    LOGERR("The length of array %s must be %d!\n", prop_name.c_str(), num_instances);
+                    continue;
+                }
+                geom->SetInstanceData(values, count * stride, stride);
             }
         }
         else {
@@ -288,44 +884,40 @@ void SceneParser::ParseGeometryInstanceData(const json& instancing, GeometryPtr
     }
 }
 
-void SceneParser::ParseGeometryInstanceDataHelper(const json& data_agrregate, GeometryPtr geom,
-    const std::string& attrib_name, void** data, size_t& size, size_t& stride)
+bool SceneParser::MapInstanceDataFile(const json& entry, const std::string& attrib_name, uint32_t count,
+    std::shared_ptr<const void>& values, size_t& stride)
 {
-    *data = malloc(data_agrregate.size() * 16 * sizeof(float));
-    
-    if (data_agrregate[0].is_object()) {
-        stride = 16 * sizeof(float);
-    }
-    else if (data_agrregate[0].is_array()) {
-        size_t arr_len = data_agrregate[0][0].size();
-        assert(arr_len == 1 || arr_len == 2 || arr_len == 3 || arr_len == 4);
-        stride = arr_len * sizeof(float);
+    // raw floats, 'components' per instance, starting 'offset' bytes into a file next to the config
+    std::string file;
+    int components = 0, offset = 0;
+    ProcessStringAttrib(entry, "file", attrib_name + ".file", true, file);
+    ProcessIntAttrib(entry, "components", attrib_name + ".components", true, components);
+    ProcessIntAttrib(entry, "offset", attrib_name + ".offset", false, offset);
+    if ((components < 1 || components > 4) && components != 16) {
+        LOGERR("%s.components must be 1 to 4, or 16 for matrices!\n", attrib_name.c_str());
+        return false;
     }
-    else if (data_agrregate[0].is_number()) {
-        stride = sizeof(float);
-        size = sizeof(float) * data_agrregate.size();
-        memcpy(*data, data_agrregate.get<std::vector<float>>().data(), size);
+    if (offset < 0 || offset % sizeof(float) != 0) {
+        LOGERR("%s.offset must be a multiple of 4!\n", attrib_name.c_str());
+        return false;
     }
-    else
-        assert(0);
 
-    uint32_t counter = 0;
-    size = 0;
-    for (auto& data_item : data_agrregate) {
-        std::string full_attrib_name = attrib_name + "[" + std::to_string(counter) + "].";
-        if (data_item.is_object()) {
-            glm::mat4 transformation;
-            ParseGeometryTransformation(data_item, transformation, full_attrib_name);
-            size += stride;
-            memcpy((char*)(*data) + stride * counter, glm::value_ptr(transformation), stride);
-        }
-        else if (data_item.is_array()) {
-            static size_t vec_len = data_item.size() * sizeof(float);
-            size + stride;
-            memcpy((char*)(*data) + stride * counter, data_item.get<std::vector<float>>().data(), stride);
-        }
-        counter++;
+    std::string path = _configPath.substr(0, _configPath.find_last_of("/\\") + 1) + file;
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->Open(path)) {
+        LOGERR("Failed to map %s for %s!\n", path.c_str(), attrib_name.c_str());
+        return false;
     }
+    stride = components * sizeof(float);
+    if (mapping->GetSize() < offset + count * stride) {
+        LOGERR("%s holds fewer than %u instances of %d floats!\n", path.c_str(), count, components);
+        return false;
+    }
+
+    // the instances stay mapped for as long as the geometry uses them
+    values = std::shared_ptr<const void>(mapping, static_cast<const char*>(mapping->GetData()) + offset);
+    LOGINFO("Mapped %u instances of %s from %s\n", count, attrib_name.c_str(), path.c_str());
+    return true;
 }
 
 void SceneParser::ParseGeometryTransformation(const json& trans, glm::mat4& transformation, const std::string& attrib_name)
@@ -482,9 +1074,24 @@ void SceneParser::ParseRenderPasses()
 
         if (_j["RenderPasses"].is_array()) {
             auto render_passes = _j["RenderPasses"];
+
+            BuildRenderGraph(render_passes);
+
             int rp_counter = 0;
-            for (auto& rp : render_passes)
-                ParseSingleRenderPass(rp, rp_counter++);
+            for (auto& rp : render_passes) {
+                _passSlots.push_back(-1);
+                if (_renderGraph.IsCulled(rp_counter)) {
+                    LOGINFO("RenderPasses[%d] is culled, none of its attachments are read\n", rp_counter);
+                }
+                else {
+                    RenderPassPtr render_pass = ParseSingleRenderPass(rp, rp_counter);
+                    if (render_pass != nullptr) {
+                        _passSlots.back() = (int)_renderer->GetRenderPassCount();
+                        _renderer->AddRenderPass(std::move(render_pass));
+                    }
+                }
+                rp_counter++;
+            }
         }
         else {
             LOGERR("Expects a JSON array for the attribute 'RenderPasses'\n");
@@ -495,7 +1102,29 @@ void SceneParser::ParseRenderPasses()
     }
 }
 
-void SceneParser::ParseSingleRenderPass(const json& rp, int rp_counter)
+void SceneParser::BuildRenderGraph(const json& render_passes)
+{
+    // every attachment is declared before the passes read them, so a pass may read the
+    // previous frame's output of a later pass
+    int rp_counter = 0;
+    for (auto& rp : render_passes)
+        DeclareRenderPassOutputs(rp, rp_counter++);
+    rp_counter = 0;
+    for (auto& rp : render_passes)
+        DeclareRenderPassInputs(rp, rp_counter++);
+
+    char* val = getenv("GFXLAB_DISABLE_RENDER_GRAPH_ALIASING");
+    _renderGraph.EnableAliasing(!(val && atoi(val) == 1));
+    _renderGraph.Compile();
+    _renderGraph.Realize();
+
+    auto& stats = _renderGraph.GetStats();
+    printf("render graph: %u passes (%u culled), %u attachments in %u allocations, "
+        "render target memory %.2f MB -> %.2f MB\n", stats.passes, stats.culled_passes, stats.resources,
+        stats.allocations, stats.unaliased_bytes / 1048576.0, stats.aliased_bytes / 1048576.0);
+}
+
+RenderPassPtr SceneParser::ParseSingleRenderPass(const json& rp, int rp_counter)
 {
     std::string attrib_full_name = "RenderPasses[" + std::to_string(rp_counter) + "]";
 
@@ -504,6 +1133,12 @@ void SceneParser::ParseSingleRenderPass(const json& rp, int rp_counter)
         RenderPassPtr render_pass = std::make_unique<RenderPass>(_renderer);
         
         GLuint prog_id = ParseProgramInRenderPass(rp, attrib_full_name);
+        std::string pass_name = attrib_full_name;
+        for (auto& it : _programs) {
+            if (it.second == prog_id)
+                pass_name += " " + it.first;
+        }
+        render_pass->SetName(pass_name);
 
         std::vector<GeometryPtr> geometries;
         ParseGeometriesInRenderPass(rp, attrib_full_name, geometries);
@@ -511,6 +1146,11 @@ void SceneParser::ParseSingleRenderPass(const json& rp, int rp_counter)
             render_pass->SetProgram(prog_id);
         else
             render_pass->SetProgramForGeometries(prog_id, geometries);
+        if (rp.find("program") != rp.end()) {
+            auto scene = _renderer->GetScene();
+            CheckNormalFormat(rp["program"], attrib_full_name,
+                geometries.empty() && scene != nullptr ? scene->GetGeometries() : geometries);
+        }
 
         if (rp.find("fbo") != rp.end()) {
             std::vector<std::pair<GLuint, GLenum>> color_attachments;
@@ -518,7 +1158,7 @@ void SceneParser::ParseSingleRenderPass(const json& rp, int rp_counter)
             std::pair<GLuint, GLenum>              stencil_attachment;
             std::pair<GLuint, GLenum>              ds_attachment;
 
-            ParseFBOAttachmentsInRenderPass(rp["fbo"], color_attachments, depth_attachment, stencil_attachment, ds_attachment, attrib_full_name);
+            ParseFBOAttachmentsInRenderPass(rp_counter, color_attachments, depth_attachment, stencil_attachment, ds_attachment);
             bool success = render_pass->CreateFBO(color_attachments, depth_attachment, stencil_attachment, ds_attachment);
             if (!success) {
                 LOGERR("Failed to create FBO for %s\n", attrib_full_name.c_str());
@@ -526,12 +1166,18 @@ void SceneParser::ParseSingleRenderPass(const json& rp, int rp_counter)
             RecordFBOInfoForRenderPass(rp_counter, color_attachments, depth_attachment, stencil_attachment, ds_attachment);
         }
 
+        ParseAttachmentActions(rp, rp_counter, *render_pass, attrib_full_name);
+
         if (rp.find("textures") != rp.end()) {
             std::vector<GLuint> textures;
             ParseInputTextures(rp, rp_counter, textures);
             render_pass->SetInputTextures(textures);
         }
 
+        bool sort_draws = false;
+        ProcessBoolAttrib(rp, "sort_draws", attrib_full_name + ".sort_draws", false, sort_draws);
+        render_pass->SetSortDraws(sort_draws);
+
         if (rp.find("show_image") != rp.end()) {
             std::string tex_name;
             ProcessStringAttrib(rp, "show_image", attrib_full_name + ".show_image", true, tex_name);
@@ -540,11 +1186,12 @@ void SceneParser::ParseSingleRenderPass(const json& rp, int rp_counter)
             render_pass->SetDisplayImage(tex_id);
         }
             
-        _renderer->AddRenderPass(std::move(render_pass));
+        return render_pass;
     }
     else {
         LOGERR("Expects a JSON object for the attribute RenderPasses[%d]\n", rp_counter);
     }
+    return nullptr;
 }
 
 GLuint SceneParser::ParseProgramInRenderPass(const json& rp, const std::string& attrib_full_name)
@@ -556,13 +1203,16 @@ GLuint SceneParser::ParseProgramInRenderPass(const json& rp, const std::string&
         ProcessStringAttrib(rp["program"], "name", attrib_full_name + "name", true, prog_name);
         ProcessStringAttrib(rp["program"], "shaders", attrib_full_name + "shaders", true, shaders);
 
-        if (_programs.find(prog_name) == _programs.end()) {
-            std::vector<std::string> shader_files;
+        // a program whose description was edited is created again under the same name
+        if (_programs.find(prog_name) == _programs.end() || _programDescs[prog_name] != rp["program"]) {
+            std::vector<std::string> shader_files, defines;
             CollectShaderFiles(shaders, shader_files);
-            prog_id = ResourceManager::GetInstance()->CreateProgram(shader_files);
+            ProcessStringArrayAttrib(rp["program"], "defines", attrib_full_name + "defines", false, defines);
+            prog_id = ResourceManager::GetInstance()->CreateProgram(shader_files, defines);
             assert(prog_id != 0);
             _renderer->AddShaderProgram(prog_name, prog_id);
             _programs[prog_name] = prog_id;
+            _programDescs[prog_name] = rp["program"];
         }
         else {
             prog_id = _programs[prog_name];
@@ -578,8 +1228,40 @@ void SceneParser::ParseGeometriesInRenderPass(const json& rp, const std::string
 {
     std::vector<std::string> geom_names;
     ProcessStringArrayAttrib(rp, "geometries", attrib_full_name + ".geometries", false, geom_names);
-    for (auto& name : geom_names)
-        geometries.push_back(_geometries[name]);
+    for (auto& name : geom_names) {
+        auto it = _geometries.find(name);
+        if (it != _geometries.end())
+            geometries.push_back(it->second);
+        else
+            LOGERR("%s.geometries: %s is not in the scene\n", attrib_full_name.c_str(), name.c_str());
+    }
+}
+
+void SceneParser::CheckNormalFormat(const json& program, const std::string& attrib_full_name,
+    const std::vector<GeometryPtr>& geometries)
+{
+    // the vertex shaders decode octahedral normals only when built with NORMAL_OCT16, so the
+    // define has to match the normal format of every mesh the pass draws
+    bool oct_program = false;
+    auto defines = program.find("defines");
+    if (defines != program.end() && defines->is_array()) {
+        for (auto& d : *defines)
+            oct_program |= d.is_string() && d.get<std::string>() == "NORMAL_OCT16";
+    }
+    for (auto& g : geometries) {
+        auto mesh = std::dynamic_pointer_cast<Mesh>(g);
+        if (mesh == nullptr)
+            continue;
+        bool oct_mesh = mesh->GetVertexFormat().normal == VertexFormat::NORMAL_OCT16;
+        if (oct_mesh && !oct_program) {
+            LOGERR("%s draws %s with oct16 normals; add NORMAL_OCT16 to the defines of its program\n",
+                attrib_full_name.c_str(), g->GetName().c_str());
+        }
+        else if (!oct_mesh && oct_program) {
+            LOGERR("%s is built with NORMAL_OCT16 but draws %s without oct16 normals\n",
+                attrib_full_name.c_str(), g->GetName().c_str());
+        }
+    }
 }
 
 void SceneParser::RecordFBOInfoForRenderPass(GLuint fbo,
@@ -601,48 +1283,163 @@ void SceneParser::RecordFBOInfoForRenderPass(GLuint fbo,
     _fboAttachments[fbo] = info;
 }
 
-void SceneParser::ParseFBOAttachmentsInRenderPass(const json& fbo,
-                                      std::vector<std::pair<GLuint, GLenum>>& color_attachments,
-                                      std::pair<GLuint, GLenum>& depth_attachment,
-                                      std::pair<GLuint, GLenum>& stencil_attachment,
-                                      std::pair<GLuint, GLenum>& ds_attachment,
-                                      const std::string& rp_name)
+void SceneParser::ParseAttachmentActions(const json& rp, int rp_counter, RenderPass& render_pass, const std::string& attrib_full_name)
 {
-    GLint max_color_attachments;
-    glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &max_color_attachments);
+    // "load_store": { "color0": { "load": "clear", "store": "store" }, "depth": { "store": "discard" } }
+    static const std::unordered_map<std::string, RenderPass::LoadAction> load_actions = {
+        { "clear", RenderPass::LOAD_CLEAR }, { "load", RenderPass::LOAD_LOAD }, { "dont_care", RenderPass::LOAD_DONT_CARE }
+    };
+    static const std::unordered_map<std::string, RenderPass::StoreAction> store_actions = {
+        { "store", RenderPass::STORE_STORE }, { "discard", RenderPass::STORE_DISCARD }
+    };
+
+    auto attachments_of = [](const std::string& name) {
+        std::vector<int> result;
+        if (name == "depth")
+            result.push_back(RenderPass::DEPTH);
+        else if (name == "stencil")
+            result.push_back(RenderPass::STENCIL);
+        else if (name == "depth_stencil" || name == "ds")
+            result = { RenderPass::DEPTH, RenderPass::STENCIL };
+        else if (name.compare(0, 5, "color") == 0 && name.size() > 5 && isdigit(name[5])) {
+            int i = atoi(name.c_str() + 5);
+            if (i < RenderPass::MAX_COLOR)
+                result.push_back(RenderPass::COLOR0 + i);
+        }
+        return result;
+    };
+
+    if (rp.find("load_store") != rp.end()) {
+        const json& actions = rp["load_store"];
+        if (actions.is_object()) {
+            for (auto it = actions.begin(); it != actions.end(); ++it) {
+                std::string full_name = attrib_full_name + ".load_store." + it.key();
+                std::vector<int> attachments = attachments_of(it.key());
+                if (attachments.empty()) {
+                    LOGERR("Unknown attachment %s\n", full_name.c_str());
+                    continue;
+                }
 
-    std::string full_attrib_name = rp_name + ".fbo.";
-    std::string color_attachment_name;
-    FBOInfo fbo_info;
-    for (GLint i = 0; i < max_color_attachments; i++) {
-        color_attachment_name = "color" + std::to_string(i);
-        if (fbo.find(color_attachment_name) != fbo.end()) {
-            fbo_info = CreateFBOAttachment(fbo[color_attachment_name], "color", full_attrib_name + color_attachment_name);
-            color_attachments.push_back(std::make_pair(fbo_info.first, fbo_info.second));
+                std::string load, store;
+                ProcessStringAttrib(it.value(), "load", full_name + ".load", false, load);
+                ProcessStringAttrib(it.value(), "store", full_name + ".store", false, store);
+                RenderPass::LoadAction load_action = RenderPass::LOAD_DEFAULT;
+                RenderPass::StoreAction store_action = RenderPass::STORE_DEFAULT;
+                if (!load.empty()) {
+                    if (load_actions.find(load) != load_actions.end())
+                        load_action = load_actions.at(load);
+                    else
+                        LOGERR("%s.load must be 'clear', 'load' or 'dont_care'\n", full_name.c_str());
+                }
+                if (!store.empty()) {
+                    if (store_actions.find(store) != store_actions.end())
+                        store_action = store_actions.at(store);
+                    else
+                        LOGERR("%s.store must be 'store' or 'discard'\n", full_name.c_str());
+                }
+                for (int a : attachments)
+                    render_pass.SetAttachmentActions(a, load_action, store_action);
+            }
         }
         else {
-            break;
+            LOGERR("Expects a JSON object for the attribute %s.load_store\n", attrib_full_name.c_str());
         }
     }
 
-    if (fbo.find("depth") != fbo.end()) {
-        depth_attachment = CreateFBOAttachment(fbo["depth"], "depth", full_attrib_name + "depth");
+    // attachments no pass reads are discarded unless the pass says otherwise
+    std::string prefix = "fbo" + std::to_string(rp_counter) + ".";
+    for (auto name : { "color0", "color1", "color2", "color3", "color4", "color5", "color6", "color7", "depth", "stencil", "ds" }) {
+        int resource = _renderGraph.FindResource(prefix + name);
+        if (resource < 0 || _renderGraph.IsRead(resource))
+            continue;
+        for (int a : attachments_of(name)) {
+            auto actions = render_pass.GetAttachmentActions(a);
+            if (actions.store == RenderPass::STORE_DEFAULT)
+                render_pass.SetAttachmentActions(a, actions.load, RenderPass::STORE_DISCARD);
+        }
     }
-   
-    if (fbo.find("depth_stencil") != fbo.end()) {
-        ds_attachment = CreateFBOAttachment(fbo["depth_stencil"], "depth_stencil", full_attrib_name + "depth_stencil");
+}
+
+void SceneParser::DeclareRenderPassOutputs(const json& rp, int rp_counter)
+{
+    int pass = _renderGraph.AddPass("RenderPasses[" + std::to_string(rp_counter) + "]");
+    if (!rp.is_object() || rp.find("fbo") == rp.end())
+        return;
+
+    const json& fbo = rp["fbo"];
+    std::string full_attrib_name = "RenderPasses[" + std::to_string(rp_counter) + "].fbo.";
+    std::string prefix = "fbo" + std::to_string(rp_counter) + ".";
+
+    GLint max_color_attachments;
+    glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &max_color_attachments);
+    std::string color_attachment_name;
+    for (GLint i = 0; i < max_color_attachments; i++) {
+        color_attachment_name = "color" + std::to_string(i);
+        if (fbo.find(color_attachment_name) == fbo.end())
+            break;
+        _renderGraph.CreateResource(pass, prefix + color_attachment_name,
+            ParseFBOAttachmentDesc(fbo[color_attachment_name], "color", full_attrib_name + color_attachment_name));
     }
 
-    if (fbo.find("stencil") != fbo.end()) {
-        stencil_attachment = CreateFBOAttachment(fbo["stencil"], "stencil", full_attrib_name + "stencil");
+    if (fbo.find("depth") != fbo.end())
+        _renderGraph.CreateResource(pass, prefix + "depth", ParseFBOAttachmentDesc(fbo["depth"], "depth", full_attrib_name + "depth"));
+    if (fbo.find("depth_stencil") != fbo.end())
+        _renderGraph.CreateResource(pass, prefix + "ds", ParseFBOAttachmentDesc(fbo["depth_stencil"], "depth_stencil", full_attrib_name + "depth_stencil"));
+    if (fbo.find("stencil") != fbo.end())
+        _renderGraph.CreateResource(pass, prefix + "stencil", ParseFBOAttachmentDesc(fbo["stencil"], "stencil", full_attrib_name + "stencil"));
+}
+
+void SceneParser::DeclareRenderPassInputs(const json& rp, int rp_counter)
+{
+    if (!rp.is_object())
+        return;
+
+    std::vector<std::string> names;
+    if (rp.find("textures") != rp.end() && rp["textures"].is_array())
+        names = rp["textures"].get<std::vector<std::string>>();
+    if (rp.find("show_image") != rp.end() && rp["show_image"].is_string())
+        names.push_back(rp["show_image"].get<std::string>());
+
+    std::regex pattern("fbo[0-9]+\\.(color[0-9]+|depth|stencil|ds)");
+    for (auto& name : names) {
+        if (!std::regex_match(name, pattern))
+            continue;
+        int resource = _renderGraph.FindResource(name);
+        if (resource >= 0)
+            _renderGraph.Read(rp_counter, resource);
+        else
+            LOGERR("RenderPasses[%d] reads %s, which no render pass writes\n", rp_counter, name.c_str());
     }
 }
 
-FBOInfo SceneParser::CreateFBOAttachment(const json& attachment, const std::string& type, const std::string& full_attrib_name)
+void SceneParser::ParseFBOAttachmentsInRenderPass(int rp_counter,
+                                      std::vector<std::pair<GLuint, GLenum>>& color_attachments,
+                                      std::pair<GLuint, GLenum>& depth_attachment,
+                                      std::pair<GLuint, GLenum>& stencil_attachment,
+                                      std::pair<GLuint, GLenum>& ds_attachment)
 {
-    const static int TEXTURE = 0;
-    const static int RENDERBUFFER = 1;
+    // the attachments were declared by DeclareRenderPassOutputs and allocated by the render graph
+    std::string prefix = "fbo" + std::to_string(rp_counter) + ".";
+    auto attachment = [this](const std::string& name) {
+        int resource = _renderGraph.FindResource(name);
+        if (resource < 0)
+            return std::make_pair(GLuint(0), GLenum(0));
+        return std::make_pair(_renderGraph.GetGLObject(resource), _renderGraph.GetDesc(resource).type);
+    };
+
+    for (int i = 0; ; i++) {
+        auto color = attachment(prefix + "color" + std::to_string(i));
+        if (color.first == 0)
+            break;
+        color_attachments.push_back(color);
+    }
+    depth_attachment = attachment(prefix + "depth");
+    ds_attachment = attachment(prefix + "ds");
+    stencil_attachment = attachment(prefix + "stencil");
+}
 
+RenderGraph::ResourceDesc SceneParser::ParseFBOAttachmentDesc(const json& attachment, const std::string& type, const std::string& full_attrib_name)
+{
     GLsizei width, height;
     width = _width;
     height = _height;
@@ -673,22 +1470,17 @@ FBOInfo SceneParser::CreateFBOAttachment(const json& attachment, const std::stri
         }
     }
 
-    GLuint id;
-    if (attachment_type == GL_TEXTURE_2D) {
-        id = ResourceManager::GetInstance()->CreateTexture(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE);
-    }
-    else {
-        GLenum format;
-        if (type == "depth")
-            format = GL_DEPTH_COMPONENT;
-        else if (type == "stencil")
-            format = GL_STENCIL_INDEX;
-        else
-            format = GL_DEPTH24_STENCIL8;
-        id = ResourceManager::GetInstance()->CreateRenderBuffer(GL_RENDERBUFFER, format, width, height);
-    }
+    GLenum format;
+    if (attachment_type == GL_TEXTURE_2D)
+        format = GL_RGBA;
+    else if (type == "depth")
+        format = GL_DEPTH_COMPONENT;
+    else if (type == "stencil")
+        format = GL_STENCIL_INDEX;
+    else
+        format = GL_DEPTH24_STENCIL8;
 
-    return std::make_pair(id, attachment_type);
+    return { attachment_type, format, width, height };
 }
 
 
@@ -784,6 +1576,23 @@ void SceneParser::ProcessFloatAttrib(const json& j, const std::string& name, con
     }
 }
 
+void SceneParser::ProcessBoolAttrib(const json& j, const std::string& name, const std::string& full_name, bool required, bool& result)
+{
+    if (j.find(name) != j.end()) {
+        if (j[name].is_boolean()) {
+            result = j[name].get<bool>();
+            LOGINFO("%s is set to %s\n", full_name.c_str(), result ? "true" : "false");
+        }
+        else {
+            LOGERR("Expects a boolean for the attribute %s\n", full_name.c_str());
+        }
+    }
+    else {
+        if (required)
+            LOGERR("Missing attribute '%s'\n", full_name.c_str());
+    }
+}
+
 void SceneParser::ProcessStringAttrib(const json& j, const std::string& name, const std::string& full_name, bool required, std::string& result)
 {
     if (j.find(name) != j.end()) {
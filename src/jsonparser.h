@@ -2,6 +2,9 @@
 
 #include "common.h"
 #include "resourcemanager.h"
+#include "vertexformat.h"
+#include "benchmark.h"
+#include "rendergraph.h"
 
 #include <json/json.hpp>
 
@@ -13,29 +16,72 @@ class SceneParser {
 public:
     SceneParser();
     WindowPtr   Parse(const char* file);
+    // command line settings taking precedence over the 'Window' attributes
+    void        SetHeadless(bool headless)            { _headless = headless; }
+    void        SetWindowSize(int width, int height)  { _widthOverride = width; _heightOverride = height; }
+    int         GetWidth() const                      { return _width; }
+    int         GetHeight() const                     { return _height; }
+    // the optional 'Benchmark' attributes
+    const Benchmark::Settings& GetBenchmarkSettings() const { return _benchmark; }
+
+    // applies the edits of the config file passed to Parse to the running scene. The camera,
+    // the lights and the edited geometries and render passes are rebuilt; the render graph only
+    // if attachments or their readers changed. Window, Renderer and SetStateCallbacks edits need
+    // a restart. Returns false and keeps the current scene if the file does not parse
+    bool        Reload();
+    const std::string& GetConfigPath() const              { return _configPath; }
 
 private:
+    // an instancing.data array packed while the config is parsed; the DOM only keeps
+    // {"hash": hash} in its place, which _instanceStreamIndex maps to the stream
+    struct InstanceStream {
+        std::shared_ptr<std::vector<float>> values;
+        size_t                              stride;
+        size_t                              count;
+        bool                                valid;
+    };
+
+    // an object or array the parser is inside of
+    struct ParseFrame {
+        bool        array;
+        std::string key;            // the key being parsed, in objects
+        int         stream;         // the stream the container belongs to, or -1
+        bool        element;        // an element of the stream rather than the stream itself
+        size_t      first;          // values in the stream when the container started
+    };
+
     void        SetResourceLocations();
+    json        ParseConfig(std::istream&);
+    bool        StreamInstanceData(json::parse_event_t, json&);
     WindowPtr   ParseWindow();
     ScenePtr    ParseScene();
+    void        ReloadScene(ScenePtr, const json&, std::unordered_set<std::string>&, std::unordered_set<std::string>&, bool&);
+    int         ReloadRenderPasses(const json&, const std::unordered_set<std::string>&, const std::unordered_set<std::string>&, bool);
     void        ParseCamera(ScenePtr, const json&);
-    void        ParseGeometries(ScenePtr, const json&);
+    void        ParseGeometries(ScenePtr, const json&, bool);
+    void        RunLoaders(size_t, bool, const std::function<void(size_t)>&);
     void        ParseGeometryInstanceData(const json&, GeometryPtr, int);
-    void        ParseGeometryInstanceDataHelper(const json&, GeometryPtr, const std::string&, void**, size_t&, size_t&);
+    bool        MapInstanceDataFile(const json&, const std::string&, uint32_t, std::shared_ptr<const void>&, size_t&);
     void        ParseGeometryTransformation(const json&, glm::mat4&, const std::string&);
+    void        ParseGeometryVertexFormat(const json&, VertexFormat&, const std::string&);
     void        ParseLights(ScenePtr, const json&);
+    void        ParseBenchmark();
     RendererPtr ParseRenderer();
     void        ParseStateCallbacks();
     void        ParseRenderPasses();
-    void        ParseSingleRenderPass(const json&, int);
+    void        BuildRenderGraph(const json&);
+    void        DeclareRenderPassOutputs(const json&, int);
+    void        DeclareRenderPassInputs(const json&, int);
+    RenderPassPtr ParseSingleRenderPass(const json&, int);
+    void        ParseAttachmentActions(const json&, int, RenderPass&, const std::string&);
     GLuint      ParseProgramInRenderPass(const json&, const std::string&);
     void        ParseGeometriesInRenderPass(const json&, const std::string, std::vector<GeometryPtr>&);
-    void        ParseFBOAttachmentsInRenderPass(const json&,
+    void        CheckNormalFormat(const json&, const std::string&, const std::vector<GeometryPtr>&);
+    void        ParseFBOAttachmentsInRenderPass(int,
                                     std::vector<std::pair<GLuint, GLenum>>&,
                                     std::pair<GLuint, GLenum>&,
                                     std::pair<GLuint, GLenum>&,
-                                    std::pair<GLuint, GLenum>&,
-                                    const std::string&);
+                                    std::pair<GLuint, GLenum>&);
     void        RecordFBOInfoForRenderPass(GLuint fbo,
                                            std::vector<std::pair<GLuint, GLenum>>&,
                                            std::pair<GLuint, GLenum>&,
@@ -44,12 +90,13 @@ private:
 
     void        ParseInputTextures(const json&, int rp, std::vector<GLuint>&);
     GLuint      GetTextureObj(const std::string&);
-    FBOInfo     CreateFBOAttachment(const json&, const std::string&, const std::string&);
+    RenderGraph::ResourceDesc ParseFBOAttachmentDesc(const json&, const std::string&, const std::string&);
 
 
 
     void        ProcessFloatAttrib(const json&, const std::string&, const std::string&, bool, float&);
     void        ProcessIntAttrib(const json&, const std::string&, const std::string&, bool, int&);
+    void        ProcessBoolAttrib(const json&, const std::string&, const std::string&, bool, bool&);
     void        ProcessStringAttrib(const json&, const std::string&, const std::string&, bool, std::string&);
     void        ProcessNumberArrayAttrib(const json&, const std::string&, const std::string&, bool, std::vector<float>&);
     void        ProcessStringArrayAttrib(const json&, const std::string&, const std::string&, bool, std::vector<std::string>&);
@@ -59,9 +106,17 @@ private:
 
     json                                         _j;
     int                                          _width, _height;
+    int                                          _widthOverride, _heightOverride;
+    bool                                         _headless;
+    Benchmark::Settings                          _benchmark;
     RendererPtr                                  _renderer;
     std::unordered_map<std::string, GeometryPtr> _geometries;
     std::unordered_map<std::string, GLuint>      _programs;
+    std::unordered_map<std::string, json>        _programDescs;
+    std::vector<int>                             _passSlots;       // RenderPasses index -> renderer pass, -1 if culled
+    std::vector<InstanceStream>                  _instanceStreams;
+    std::unordered_map<uint64_t, size_t>         _instanceStreamIndex;
+    std::vector<ParseFrame>                      _parseFrames;
 
     struct FBOAttachments {
         std::vector<GLuint> color;
@@ -70,6 +125,8 @@ private:
         GLuint depth_stencil;
     };
     std::unordered_map<int, FBOAttachments>      _fboAttachments;
+    RenderGraph                                  _renderGraph;
+    std::string                                  _configPath;
     std::string                                  _gfxlab_root;
     std::string                                  _gfxlab_bin_dir;
     std::string                                  _gfxlab_shader_dir;
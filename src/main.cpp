@@ -2,18 +2,84 @@
 #include "rendererfactory.h"
 #include "renderpass.h"
 #include "window.h"
+#include "benchmark.h"
+#include "hotreload.h"
+#include "jobsystem.h"
 #include <iostream>
+#include <cstring>
+#include <cstdio>
+
+static void PrintUsage()
+{
+    std::cout << "Example Usage: gfxlab input.json" << std::endl;
+    std::cout << "               gfxlab [--headless] [--frames N] [--size WxH] [--output results.json] input.json" << std::endl;
+    std::cout << "               gfxlab --watch input.json   (reloads edited shaders and config)" << std::endl;
+    std::cout << "               gfxlab --job-benchmark      (times the job system against a thread per task)" << std::endl;
+}
 
 int main(int argc, char** argv)
 {
-    if (argc != 2) {
-        std::cout << "Example Usage: gfxlab input.json" << std::endl;
+    const char* config = nullptr;
+    bool headless = false;
+    bool watch = false;
+    int frames = 0, width = 0, height = 0;
+    const char* output = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--watch") == 0)
+            watch = true;
+        else if (strcmp(argv[i], "--job-benchmark") == 0) {
+            JobSystem::GetInstance()->RunBenchmark(std::cout);
+            return 0;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                std::cout << "invalid size " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (argv[i][0] != '-' && config == nullptr)
+            config = argv[i];
+        else {
+            PrintUsage();
+            return -1;
+        }
+    }
+
+    if (config == nullptr) {
+        PrintUsage();
         return -1;
     }
 
     RendererFactory::Init();
     SceneParser parser;
-    auto window = parser.Parse(argv[1]);
+    parser.SetHeadless(headless);
+    parser.SetWindowSize(width, height);
+    auto window = parser.Parse(config);
+
+    // headless runs and runs with a frame count are benchmarks
+    if (headless || frames > 0) {
+        Benchmark::Settings settings = parser.GetBenchmarkSettings();
+        if (frames > 0)
+            settings.frames = frames;
+        if (output)
+            settings.output = output;
+        Benchmark benchmark(window, settings);
+        return benchmark.Run(config, parser.GetWidth(), parser.GetHeight()) ? 0 : -1;
+    }
+
+    std::unique_ptr<HotReloader> reloader;
+    if (watch) {
+        reloader.reset(new HotReloader(parser, window->GetRenderer()));
+        window->SetFrameCallback([&reloader]() { reloader->Update(); });
+    }
+
     window->Display();
     return 0;
-}
\ No newline at end of file
+}
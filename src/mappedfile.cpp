@@ -0,0 +1,92 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : _data(nullptr),
+    _size(0)
+#ifdef _WIN32
+    , _fileHandle(nullptr),
+    _mappingHandle(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return false;
+    }
+    _fileHandle = file;
+    _mappingHandle = mapping;
+    _data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    _size = (size_t)file_size.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping != MAP_FAILED) {
+        _data = mapping;
+        _size = (size_t)sb.st_size;
+    }
+#endif
+
+    if (_data == nullptr) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+    if (_data)
+        UnmapViewOfFile(_data);
+    if (_mappingHandle)
+        CloseHandle(_mappingHandle);
+    if (_fileHandle)
+        CloseHandle(_fileHandle);
+    _fileHandle = nullptr;
+    _mappingHandle = nullptr;
+#else
+    if (_data)
+        munmap(_data, _size);
+#endif
+    _data = nullptr;
+    _size = 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The pages are loaded on first access, so data can
+// be handed to GL straight from the mapping without a copy on the heap.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // fails for missing and empty files
+    bool        Open(const std::string& path);
+    void        Close();
+    bool        IsOpen()  const { return _data != nullptr; }
+    const void* GetData() const { return _data; }
+    size_t      GetSize() const { return _size; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void*       _data;
+    size_t      _size;
+#ifdef _WIN32
+    void*       _fileHandle;
+    void*       _mappingHandle;
+#endif
+};
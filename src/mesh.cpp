@@ -1,18 +1,267 @@
 #include "mesh.h"
+#include "meshcache.h"
+#include "meshoptimizer.h"
+#include "instanceculler.h"
+#include "meshlet.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "jobsystem.h"
+
+#include <chrono>
+
+#include <glm/gtc/packing.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+static bool BaseInstanceSupported()
+{
+    static bool supported = GLEW_ARB_base_instance != 0;
+    return supported;
+}
 
 void Mesh::Render()
 {
+    UploadDynamicInstances();
+
     if (_texture != 0) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(_textureType, _texture);
+        GLStateCache::GetInstance()->ActiveTexture(GL_TEXTURE0);
+        GLStateCache::GetInstance()->BindTexture(_textureType, _texture);
+    }
+    GLStateCache::GetInstance()->BindVertexArray(_vao);
+
+    size_t index_size = _indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    GLuint first;
+    GLsizei count;
+    GetLODIndexRange(first, count);
+    const std::vector<IndexRange>* meshlet_ranges = GetMeshletRanges();
+    if (_arenaRange.pool >= 0 && GeometryArena::GetInstance()->MultiDrawSupported())
+        RenderArena(meshlet_ranges, first, count);
+    else if (meshlet_ranges != nullptr)
+        RenderIndexRanges(*meshlet_ranges);
+    else if (_arenaRange.pool >= 0) {
+        glDrawElementsBaseVertex(GL_TRIANGLES, count, _indexType,
+            (GLvoid*)((_arenaRange.first_index + first) * index_size), _arenaRange.base_vertex);
+        PROFILE_COUNT_DRAW(count / 3);
+    }
+    else if (_numInstances && !_instanceLodRanges.empty()) {
+        for (auto& range : _instanceLodRanges) {
+            const MeshCache::LOD& lod = _lods[range.lod];
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, lod.index_count, _indexType,
+                (GLvoid*)(lod.first_index * index_size), range.count, range.first);
+            PROFILE_COUNT_DRAW(uint64_t(lod.index_count / 3) * range.count);
+        }
+    }
+    else if (_numInstances) {
+        glDrawElementsInstanced(GL_TRIANGLES, count, _indexType, (GLvoid*)(first * index_size), _numVisibleInstances);
+        PROFILE_COUNT_DRAW(uint64_t(count / 3) * _numVisibleInstances);
+    }
+    else {
+        glDrawElements(GL_TRIANGLES, count, _indexType, (GLvoid*)(first * index_size));
+        PROFILE_COUNT_DRAW(count / 3);
+    }
+}
+
+void Mesh::GetLODIndexRange(GLuint& first, GLsizei& count) const
+{
+    if (_lods.empty()) {
+        first = 0;
+        count = _numIndices;
+    }
+    else {
+        first = _lods[_lod].first_index;
+        count = (GLsizei)_lods[_lod].index_count;
+    }
+}
+
+void Mesh::RenderArena(const std::vector<IndexRange>* ranges, GLuint first, GLsizei count)
+{
+    // the pool VAO reads the object transform from an instanced array, which only the indirect
+    // draw fills; the model uniform already holds the transformation
+    static const std::vector<glm::mat4> identity(1, glm::mat4(1.0f));
+    _arenaCommands.clear();
+    if (ranges != nullptr) {
+        for (auto& range : *ranges)
+            _arenaCommands.push_back({ (GLuint)range.count, 1, _arenaRange.first_index + range.first, _arenaRange.base_vertex, 0 });
     }
-    glBindVertexArray(_vao);
-    if (_numInstances)
-        glDrawElementsInstanced(GL_TRIANGLES, _indices.size(), GL_UNSIGNED_INT, (GLvoid*)(0), _numInstances);
     else
-        glDrawElements(GL_TRIANGLES, _indices.size(), GL_UNSIGNED_INT, (GLvoid*)(0));
+        _arenaCommands.push_back({ (GLuint)count, 1, _arenaRange.first_index + first, _arenaRange.base_vertex, 0 });
+    if (!_arenaCommands.empty())
+        GeometryArena::GetInstance()->MultiDraw(_arenaRange.pool, _arenaCommands, identity);
+}
+
+void Mesh::RenderIndexRanges(const std::vector<IndexRange>& ranges)
+{
+    if (ranges.empty())
+        return;
+
+    size_t index_size = _indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    GLuint base = _arenaRange.pool >= 0 ? _arenaRange.first_index : 0;
+    GLsizei total = 0;
+    _multiDrawCounts.clear();
+    _multiDrawOffsets.clear();
+    for (auto& range : ranges) {
+        _multiDrawCounts.push_back(range.count);
+        _multiDrawOffsets.push_back((const GLvoid*)((base + range.first) * index_size));
+        total += range.count;
+    }
+
+    if (_arenaRange.pool >= 0) {
+        _multiDrawBaseVertices.assign(ranges.size(), _arenaRange.base_vertex);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, _multiDrawCounts.data(), _indexType, _multiDrawOffsets.data(),
+            (GLsizei)ranges.size(), _multiDrawBaseVertices.data());
+    }
+    else
+        glMultiDrawElements(GL_TRIANGLES, _multiDrawCounts.data(), _indexType, _multiDrawOffsets.data(), (GLsizei)ranges.size());
+    PROFILE_COUNT_DRAW(total / 3);
+}
+
+const std::vector<IndexRange>* Mesh::GetMeshletRanges() const
+{
+    return _meshletCullValid && _lod == 0 && !IsInstanced() ? &_meshletRanges : nullptr;
+}
+
+const MeshletStats* Mesh::CullMeshlets(const glm::mat4& view_proj, const glm::vec3& eye)
+{
+    // meshlets partition the full mesh; coarser levels and instanced draws go without them
+    if (_meshlets.empty() || _lod != 0 || IsInstanced())
+        return nullptr;
+
+    // render passes sharing the camera reuse the result
+    if (_meshletCullValid && view_proj == _meshletViewProj && _transformation == _meshletModel && eye == _meshletEye)
+        return &_meshletStats;
+
+    glm::mat4 model = _transformation * _meshletToObject;
+    glm::vec3 local_eye = glm::vec3(glm::inverse(model) * glm::vec4(eye, 1.0f));
+    _visibleMeshlets.clear();
+    Meshlets::Cull(Frustum(view_proj * model), local_eye, _meshletBackfaceCulling, _meshlets.data(),
+        (uint32_t)_meshlets.size(), _visibleMeshlets, _meshletStats);
+
+    // visible neighbours are adjacent in the index buffer and merge into one range
+    _meshletRanges.clear();
+    for (auto i : _visibleMeshlets) {
+        const Meshlet& m = _meshlets[i];
+        if (!_meshletRanges.empty() && _meshletRanges.back().first + _meshletRanges.back().count == m.first_index)
+            _meshletRanges.back().count += m.index_count;
+        else
+            _meshletRanges.push_back({ m.first_index, (GLsizei)m.index_count });
+    }
+    _meshletViewProj = view_proj;
+    _meshletModel = _transformation;
+    _meshletEye = eye;
+    _meshletCullValid = true;
+    return &_meshletStats;
+}
+
+uint32_t Mesh::ChooseLOD(const AABB& world_bounds, const LODSelector& selector) const
+{
+    // the coarsest level whose error, scaled by the projected size of the bounds, stays in budget
+    float radius = 0.5f * glm::length(world_bounds.max - world_bounds.min);
+    float distance = glm::length(world_bounds.Center() - selector.eye) - radius;
+    if (distance <= 0.0f || selector.pixel_error <= 0.0f)
+        return 0;
+
+    float projected_size = 2.0f * radius * selector.pixels_per_unit / distance;
+    uint32_t lod = 0;
+    while (lod + 1 < _lods.size() && _lods[lod + 1].error * projected_size <= selector.pixel_error)
+        lod++;
+    return lod;
+}
+
+void Mesh::SelectLOD(const LODSelector& selector)
+{
+    // instances pick their levels in CullInstances
+    if (_lods.size() > 1 && !IsInstanced())
+        _lod = ChooseLOD(GetWorldBounds(), selector);
+}
+
+void Mesh::SortInstancesByLOD(const glm::mat4* transforms, const LODSelector& selector)
+{
+    // without base instances every instance draws the finest level any of them needs
+    AABB bounds(_bbox.min, _bbox.max);
+    std::vector<uint32_t> levels(_visibleInstances.size());
+    uint32_t finest = (uint32_t)_lods.size() - 1;
+    for (size_t i = 0; i < _visibleInstances.size(); i++) {
+        levels[i] = ChooseLOD(bounds.Transform(_transformation * transforms[_visibleInstances[i]]), selector);
+        finest = std::min(finest, levels[i]);
+    }
+    _lod = _visibleInstances.empty() ? 0 : finest;
+    if (!BaseInstanceSupported())
+        return;
+
+    // counting sort keeps the instance order within a level
+    std::vector<uint32_t> offsets(_lods.size() + 1, 0);
+    for (auto l : levels)
+        offsets[l + 1]++;
+    for (size_t l = 1; l < offsets.size(); l++)
+        offsets[l] += offsets[l - 1];
+    for (size_t l = 0; l < _lods.size(); l++) {
+        if (offsets[l + 1] > offsets[l])
+            _instanceLodRanges.push_back({ (uint32_t)l, offsets[l], offsets[l + 1] - offsets[l] });
+    }
+    std::vector<uint32_t> sorted(_visibleInstances.size());
+    for (size_t i = 0; i < _visibleInstances.size(); i++)
+        sorted[offsets[levels[i]]++] = _visibleInstances[i];
+    _visibleInstances.swap(sorted);
+}
+
+uint32_t Mesh::CullInstances(const glm::mat4& view_proj, const LODSelector* lod)
+{
+    // render passes sharing the camera reuse the result
+    float pixel_error = lod && _lods.size() > 1 ? lod->pixel_error : -1.0f;
+    if (_instanceCullValid && !_instanceDataChanged && view_proj == _cullViewProj && _transformation == _cullModel && pixel_error == _cullPixelError)
+        return _numVisibleInstances;
+
+    const InstanceData* transforms = nullptr;
+    for (auto& stream : _instanceData) {
+        if (stream.stride == sizeof(glm::mat4)) {
+            transforms = &stream;
+            break;
+        }
+    }
+    if (transforms == nullptr)
+        return _numInstances;
+
+    _visibleInstances.clear();
+    InstanceCuller::Cull(Frustum(view_proj * _transformation), AABB(_bbox.min, _bbox.max),
+        static_cast<const glm::mat4*>(transforms->data.get()), _numInstances, _visibleInstances);
+    _cullViewProj = view_proj;
+    _cullModel = _transformation;
+    _cullPixelError = pixel_error;
+    _instanceCullValid = true;
+    _instanceDataChanged = false;
+    _numVisibleInstances = (uint32_t)_visibleInstances.size();
+
+    _instanceLodRanges.clear();
+    if (pixel_error >= 0.0f)
+        SortInstancesByLOD(static_cast<const glm::mat4*>(transforms->data.get()), *lod);
+
+    // instances grouped by level are reordered even if all of them are visible
+    bool all_visible = _numVisibleInstances == _numInstances && _instanceLodRanges.size() <= 1;
+    if (all_visible && !_instancesCompacted)
+        return _numVisibleInstances;
+
+    for (size_t i = 0; i < _instance_data_vbos.size(); i++) {
+        // dynamic streams pack straight into their next ring slot
+        if (IsDynamicStream(i)) {
+            UploadVisibleInstances(i, _visibleInstances);
+            continue;
+        }
+        const InstanceData& stream = _instanceData[i];
+        _compactedInstances.resize(_numVisibleInstances * stream.stride);
+        InstanceCuller::Compact(stream.data.get(), stream.stride, _visibleInstances, _compactedInstances.data());
+
+        // orphan the old storage so the upload does not wait for draws still reading it
+        GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, _instance_data_vbos[i]);
+        glBufferData(GL_ARRAY_BUFFER, _numInstances * stream.stride, nullptr, GL_DYNAMIC_DRAW);
+        if (!_compactedInstances.empty())
+            glBufferSubData(GL_ARRAY_BUFFER, 0, _compactedInstances.size(), _compactedInstances.data());
+    }
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, 0);
+    _instancesCompacted = !all_visible;
 
-    glBindVertexArray(0);
+    return _numVisibleInstances;
 }
 
 void Mesh::EnablePerFaceShading(bool enable)
@@ -57,17 +306,41 @@ void Mesh::ComputeBoundingBox()
 
 void Mesh::SetInitialTransformation()
 {
-    _transformation = glm::translate(_transformation, -_bbox.center);
+    _meshletToObject = glm::mat4(1.0f);
+    glm::mat4 base = glm::translate(glm::mat4(1.0f), -_bbox.center);
     float scaleX = 2 / (_bbox.max.x - _bbox.min.x);
     float scaleY = 2 / (_bbox.max.y - _bbox.min.y);
     float scaleZ = 2 / (_bbox.max.z - _bbox.min.z);
-    _transformation = glm::scale(_transformation, glm::vec3(scaleX, scaleY, scaleZ));
+    base = glm::scale(base, glm::vec3(scaleX, scaleY, scaleZ));
+
+    // quantized positions are relative to the bounding box; decoding them is folded into the
+    // model matrix, and the bounding box is moved into the same quantized space
+    if (_vertexFormat.position == VertexFormat::POSITION_UNORM16) {
+        glm::vec3 extent = GetQuantizationExtent();
+        _meshletToObject = glm::translate(glm::scale(glm::mat4(1.0f), 1.0f / extent), -_bbox.min);
+        base = glm::translate(base, _bbox.min);
+        base = glm::scale(base, extent);
+        _bbox.center = (_bbox.center - _bbox.min) / extent;
+        _bbox.max = (_bbox.max - _bbox.min) / extent;
+        _bbox.min = glm::vec3(0.0f);
+    }
+    _baseTransformation = base;
+    _transformation *= base;
+    _transformDirty = true;
+}
+
+glm::vec3 Mesh::GetQuantizationExtent() const
+{
+    glm::vec3 extent = _bbox.max - _bbox.min;
+    for (int i = 0; i < 3; i++) {
+        if (extent[i] <= 0.0f)
+            extent[i] = 1.0f;
+    }
+    return extent;
 }
 
-void Mesh::SetupVAO()
+void Mesh::SetupVAO(const VBOInfo& info, const void* vertices, const void* indices)
 {
-    VBOInfo info;
-    PopulateVBO(info);
     CreateVBOForInstanceData();
 
 
@@ -75,63 +348,349 @@ void Mesh::SetupVAO()
     glGenBuffers(1, &_vbo);
     glGenBuffers(1, &_ibo);
 
-    glBindVertexArray(_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-    glBufferData(GL_ARRAY_BUFFER, info.size, info.data.get(), GL_STATIC_DRAW);
+    GLStateCache::GetInstance()->BindVertexArray(_vao);
+    GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, _vbo);
+    glBufferData(GL_ARRAY_BUFFER, info.size, vertices, GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indices.size() * sizeof(GLuint), _indices.data(), GL_STATIC_DRAW);
+    size_t index_size = info.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    GLStateCache::GetInstance()->BindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, _numIndices * index_size, indices, GL_STATIC_DRAW);
 
-    // vertex positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, info.vertex_size, (GLvoid*)0);
+    // 0: position, 1: normal, 2: color, 3: texcoord
+    for (auto& attrib : info.attribs) {
+        glEnableVertexAttribArray(attrib.location);
+        glVertexAttribPointer(attrib.location, attrib.components, attrib.type, attrib.normalized ? GL_TRUE : GL_FALSE,
+            info.vertex_size, (GLvoid*)(size_t)(attrib.offset));
+    }
 
-    // vertex normals
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, info.vertex_size, (GLvoid*)(info.normal_offset));
+    for (size_t i = 0; i < _instance_data_vbos.size(); i++)
+        SetupInstanceAttributes(i, _instance_data_vbos[i]);
 
-    if (VertexHasColorAttrib()) {
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, info.vertex_size, (GLvoid*)(info.color_offset));
+    GLStateCache::GetInstance()->BindVertexArray(0);
+
+}
+
+void Mesh::LoadFromCache(const MeshCache& cache, VBOInfo& info)
+{
+    const MeshCache::Header& header = cache.GetHeader();
+    info.size = (size_t)header.vertex_data_size;
+    info.vertex_size = header.vertex_size;
+    info.attribs.assign(header.attribs, header.attribs + header.num_attribs);
+    info.index_type = header.index_type;
+
+    _per_face_shading = (header.flags & MeshCache::PER_FACE_SHADING) != 0;
+    _numIndices = (GLsizei)header.num_indices;
+    _indexType = header.index_type;
+    _bbox.min = glm::vec3(header.bbox_min[0], header.bbox_min[1], header.bbox_min[2]);
+    _bbox.max = glm::vec3(header.bbox_max[0], header.bbox_max[1], header.bbox_max[2]);
+    _bbox.center = glm::vec3(header.bbox_center[0], header.bbox_center[1], header.bbox_center[2]);
+    _lods.assign(header.lods, header.lods + header.num_lods);
+    _meshlets.assign(cache.GetMeshlets(), cache.GetMeshlets() + header.num_meshlets);
+}
+
+void Mesh::ExtractOccluder(const VBOInfo& info, const void* vertices, const void* indices)
+{
+    uint32_t first = 0, count = (uint32_t)_numIndices;
+    if (!_lods.empty()) {
+        size_t lod = 0;
+        while (lod + 1 < _lods.size() && _lods[lod].index_count / 3 > OCCLUDER_MAX_TRIANGLES)
+            lod++;
+        first = _lods[lod].first_index;
+        count = _lods[lod].index_count;
     }
 
-    if (_mesh.has_vertex_texcoords2D()) {
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, info.vertex_size, (GLvoid*)(info.texcoord_offset));
-    }
-
-    GLuint index = 4;
-    int counter = 0;
-    for (auto vbo : _instance_data_vbos) {
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        size_t total_attributes = _instanceData[counter].stride / (4 * sizeof(float));
-        if (total_attributes > 0) {
-            size_t vec4_size = sizeof(glm::vec4);
-            for (size_t i = 0; i < total_attributes; i++) {
-                glEnableVertexAttribArray(index);
-                glVertexAttribPointer(index, 4, GL_FLOAT, GL_FALSE, 4 * vec4_size, (void*)(i * vec4_size));
-                glVertexAttribDivisor(index, 1);
-                index++;
+    // only the vertices the level uses are kept, decoded to floats
+    const VertexAttrib& position = info.attribs[0];
+    const char* vertex_data = static_cast<const char*>(vertices);
+    std::unordered_map<uint32_t, uint32_t> remap;
+    _occluderMesh.positions.clear();
+    _occluderMesh.indices.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t v = info.index_type == GL_UNSIGNED_SHORT ? static_cast<const GLushort*>(indices)[first + i]
+                                                          : static_cast<const GLuint*>(indices)[first + i];
+        auto it = remap.find(v);
+        if (it == remap.end()) {
+            const char* src = vertex_data + v * info.vertex_size + position.offset;
+            glm::vec3 p;
+            if (position.type == GL_UNSIGNED_SHORT) {
+                GLushort q[3];
+                memcpy(q, src, sizeof(q));
+                p = glm::vec3(q[0], q[1], q[2]) / 65535.0f;
             }
+            else
+                memcpy(&p, src, sizeof(p));
+            it = remap.emplace(v, (uint32_t)_occluderMesh.positions.size()).first;
+            _occluderMesh.positions.push_back(p);
         }
-        else {
-            glEnableVertexAttribArray(index);
-            glVertexAttribPointer(index, _instanceData[counter].stride/ sizeof(float), GL_FLOAT, GL_FALSE, _instanceData[counter].stride, (void*)(0));
-            glVertexAttribDivisor(index, 1);
-            index++;
-        }
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        counter++;
+        _occluderMesh.indices[i] = it->second;
     }
+}
 
-    glBindVertexArray(0);
+void Mesh::WriteCache(const std::string& file, uint32_t options, const VBOInfo& info)
+{
+    MeshCache::Header header;
+    memset(&header, 0, sizeof(header));
+    header.options = options;
+    header.flags = _per_face_shading ? MeshCache::PER_FACE_SHADING : 0;
+    header.vertex_data_size = info.size;
+    header.index_data_size = info.index_data.size();
+    header.num_indices = _indices.size();
+    header.index_type = info.index_type;
+    header.vertex_size = (uint32_t)info.vertex_size;
+    header.num_attribs = (uint32_t)info.attribs.size();
+    assert(info.attribs.size() <= MeshCache::MAX_ATTRIBS);
+    std::copy(info.attribs.begin(), info.attribs.end(), header.attribs);
+    for (int i = 0; i < 3; i++) {
+        header.bbox_min[i] = _bbox.min[i];
+        header.bbox_max[i] = _bbox.max[i];
+        header.bbox_center[i] = _bbox.center[i];
+    }
+    assert(_lods.size() <= MeshCache::MAX_LODS);
+    header.num_lods = (uint32_t)_lods.size();
+    std::copy(_lods.begin(), _lods.end(), header.lods);
+    header.num_meshlets = (uint32_t)_meshlets.size();
 
+    MeshCache::Write(file, header, info.data.get(), info.index_data.data(), _meshlets.data());
 }
 
 void Mesh::PopulateVBO(VBOInfo& info)
 {
     CalculateVBOSize(info);
     PopulateVBOData(info);
+    if (_generateLods)
+        GenerateLODs(info);
+    if (_optimize)
+        OptimizeBuffers(info);
+    if (_buildMeshlets)
+        BuildMeshlets(info);
+    EncodeVertices(info);
+    EncodeIndices(info);
+}
+
+static glm::vec2 OctahedralEncode(glm::vec3 n)
+{
+    float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    // degenerate source normals would encode as NaN; they point along +z instead
+    if (!(sum > 0.0f))
+        return glm::vec2(0.0f);
+    n /= sum;
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f) {
+        p.x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        p.y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return p;
+}
+
+void Mesh::EncodeVertices(VBOInfo& info)
+{
+    const VertexFormat& fmt = _vertexFormat;
+    info.attribs.clear();
+
+    uint32_t offset = 0;
+    auto add_attrib = [&](uint32_t location, uint32_t components, uint32_t type, bool normalized, uint32_t size) {
+        info.attribs.push_back({ location, components, type, normalized ? 1u : 0u, offset });
+        offset += size;
+    };
+
+    if (fmt.position == VertexFormat::POSITION_UNORM16)
+        add_attrib(0, 3, GL_UNSIGNED_SHORT, true, 4 * sizeof(GLushort));
+    else
+        add_attrib(0, 3, GL_FLOAT, false, 3 * sizeof(float));
+
+    if (fmt.normal == VertexFormat::NORMAL_INT_2_10_10_10)
+        add_attrib(1, 4, GL_INT_2_10_10_10_REV, true, sizeof(GLuint));
+    else if (fmt.normal == VertexFormat::NORMAL_OCT16)
+        add_attrib(1, 2, GL_SHORT, true, 2 * sizeof(GLshort));
+    else
+        add_attrib(1, 3, GL_FLOAT, false, 3 * sizeof(float));
+
+    if (info.has_color) {
+        if (fmt.color == VertexFormat::COLOR_UNORM8)
+            add_attrib(2, 3, GL_UNSIGNED_BYTE, true, 4 * sizeof(GLubyte));
+        else
+            add_attrib(2, 3, GL_FLOAT, false, 3 * sizeof(float));
+    }
+
+    if (info.has_texcoord) {
+        if (fmt.texcoord == VertexFormat::TEXCOORD_HALF)
+            add_attrib(3, 2, GL_HALF_FLOAT, false, 2 * sizeof(GLushort));
+        else
+            add_attrib(3, 2, GL_FLOAT, false, 2 * sizeof(float));
+    }
+
+    // the all-float format is exactly the layout PopulateVBOData produced
+    if (fmt.Key() == 0) {
+        assert(offset == info.vertex_size);
+        return;
+    }
+
+    const size_t vertex_count = info.size / info.vertex_size;
+    const size_t vertex_size = offset;
+    const glm::vec3 extent = GetQuantizationExtent();
+    char* buffer = new char[vertex_count * vertex_size];
+    memset(buffer, 0, vertex_count * vertex_size);
+
+    for (size_t v = 0; v < vertex_count; v++) {
+        const char* src = info.data.get() + v * info.vertex_size;
+        char* dst = buffer + v * vertex_size;
+        const float* pos = reinterpret_cast<const float*>(src);
+        const float* nrm = reinterpret_cast<const float*>(src + info.normal_offset);
+        glm::vec3 normal(nrm[0], nrm[1], nrm[2]);
+
+        const VertexAttrib* attrib = info.attribs.data();
+        if (fmt.position == VertexFormat::POSITION_UNORM16) {
+            GLushort q[3];
+            for (int i = 0; i < 3; i++)
+                q[i] = glm::packUnorm1x16((pos[i] - _bbox.min[i]) / extent[i]);
+            memcpy(dst + attrib->offset, q, sizeof(q));
+            // the normal matrix derived from the folded decode scale is undone by pre-scaling
+            normal *= extent;
+        }
+        else
+            memcpy(dst + attrib->offset, pos, 3 * sizeof(float));
+        attrib++;
+
+        float len = glm::length(normal);
+        if (len > 0.0f)
+            normal /= len;
+        if (fmt.normal == VertexFormat::NORMAL_INT_2_10_10_10) {
+            GLuint packed = glm::packSnorm3x10_1x2(glm::vec4(normal, 0.0f));
+            memcpy(dst + attrib->offset, &packed, sizeof(packed));
+        }
+        else if (fmt.normal == VertexFormat::NORMAL_OCT16) {
+            glm::vec2 oct = OctahedralEncode(normal);
+            GLushort packed[2] = { glm::packSnorm1x16(oct.x), glm::packSnorm1x16(oct.y) };
+            memcpy(dst + attrib->offset, packed, sizeof(packed));
+        }
+        else
+            memcpy(dst + attrib->offset, &normal[0], 3 * sizeof(float));
+        attrib++;
+
+        if (info.has_color) {
+            const float* color = reinterpret_cast<const float*>(src + info.color_offset);
+            if (fmt.color == VertexFormat::COLOR_UNORM8) {
+                GLubyte packed[3];
+                for (int i = 0; i < 3; i++)
+                    packed[i] = glm::packUnorm1x8(color[i]);
+                memcpy(dst + attrib->offset, packed, sizeof(packed));
+            }
+            else
+                memcpy(dst + attrib->offset, color, 3 * sizeof(float));
+            attrib++;
+        }
+
+        if (info.has_texcoord) {
+            const float* uv = reinterpret_cast<const float*>(src + info.texcoord_offset);
+            if (fmt.texcoord == VertexFormat::TEXCOORD_HALF) {
+                GLushort packed[2] = { glm::packHalf1x16(uv[0]), glm::packHalf1x16(uv[1]) };
+                memcpy(dst + attrib->offset, packed, sizeof(packed));
+            }
+            else
+                memcpy(dst + attrib->offset, uv, 2 * sizeof(float));
+        }
+    }
+
+    info.data = std::unique_ptr<char>(buffer);
+    info.vertex_size = vertex_size;
+    info.size = vertex_count * vertex_size;
+}
+
+void Mesh::EncodeIndices(VBOInfo& info)
+{
+    // meshes under 65536 vertices get 16 bit indices
+    const size_t vertex_count = info.size / info.vertex_size;
+    if (vertex_count < 65536) {
+        info.index_type = GL_UNSIGNED_SHORT;
+        info.index_data.resize(_indices.size() * sizeof(GLushort));
+        GLushort* dst = reinterpret_cast<GLushort*>(info.index_data.data());
+        for (size_t i = 0; i < _indices.size(); i++)
+            dst[i] = (GLushort)_indices[i];
+    }
+    else {
+        info.index_type = GL_UNSIGNED_INT;
+        info.index_data.resize(_indices.size() * sizeof(GLuint));
+        memcpy(info.index_data.data(), _indices.data(), info.index_data.size());
+    }
+    _indexType = info.index_type;
+}
+
+void Mesh::GenerateLODs(VBOInfo& info)
+{
+    // decimating per-face shaded meshes would leave faces without their own corner vertices
+    if (_per_face_shading) {
+        printf("[LOD] %s: per-face shaded meshes have no LODs\n", _id.c_str());
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t vertex_count = info.size / info.vertex_size;
+    float diagonal = glm::length(_bbox.max - _bbox.min);
+
+    // every level simplifies the previous one, so the errors add up
+    _lods.clear();
+    _lods.push_back({ 0, (uint32_t)_indices.size(), 0.0f });
+    std::vector<GLuint> level(_indices), next;
+    float error = 0.0f;
+    while (_lods.size() < MeshCache::MAX_LODS && level.size() / 3 >= 2 * MIN_LOD_TRIANGLES) {
+        error += MeshOptimizer::SimplifyIndices(level, info.data.get(), vertex_count, info.vertex_size, level.size() / 6 * 3, next);
+        // stop once the collapses that are left would fold the surface
+        if (next.size() * 10 > level.size() * 9)
+            break;
+        _lods.push_back({ (uint32_t)_indices.size(), (uint32_t)next.size(), diagonal > 0.0f ? error / diagonal : 0.0f });
+        _indices.insert(_indices.end(), next.begin(), next.end());
+        level.swap(next);
+    }
+    _numIndices = (GLsizei)_indices.size();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+    printf("[LOD] %s: %d levels, %d -> %d triangles in %lld ms\n", _id.c_str(), (int)_lods.size(),
+        (int)(_lods[0].index_count / 3), (int)(_lods.back().index_count / 3), (long long)elapsed.count());
+}
+
+void Mesh::OptimizeBuffers(VBOInfo& info)
+{
+    size_t vertex_count = info.size / info.vertex_size;
+    size_t original_count = vertex_count;
+    auto before = MeshOptimizer::AnalyzeVertexCache(_indices, vertex_count);
+
+    vertex_count = MeshOptimizer::WeldVertices(info.data.get(), vertex_count, info.vertex_size, _indices);
+    // triangles are reordered within each level of detail only, so the levels are independent jobs
+    std::vector<MeshCache::LOD> ranges = _lods;
+    if (ranges.empty())
+        ranges.push_back({ 0, (uint32_t)_indices.size(), 0.0f });
+    JobSystem::GetInstance()->ParallelFor((uint32_t)ranges.size(), (uint32_t)ranges.size(), [&](uint32_t, uint32_t begin, uint32_t end) {
+        std::vector<GLuint> range_indices;
+        for (uint32_t r = begin; r < end; r++) {
+            const MeshCache::LOD& range = ranges[r];
+            range_indices.assign(_indices.begin() + range.first_index, _indices.begin() + range.first_index + range.index_count);
+            MeshOptimizer::OptimizeVertexCache(range_indices, vertex_count);
+            MeshOptimizer::OptimizeOverdraw(range_indices, info.data.get(), vertex_count, info.vertex_size);
+            std::copy(range_indices.begin(), range_indices.end(), _indices.begin() + range.first_index);
+        }
+    });
+    vertex_count = MeshOptimizer::OptimizeVertexFetch(info.data.get(), vertex_count, info.vertex_size, _indices);
+    info.size = vertex_count * info.vertex_size;
+
+    auto after = MeshOptimizer::AnalyzeVertexCache(_indices, vertex_count);
+    printf("[MESH OPTIMIZER] %s: vertices %d -> %d, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+        _id.c_str(), (int)original_count, (int)vertex_count, before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+void Mesh::BuildMeshlets(VBOInfo& info)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t vertex_count = info.size / info.vertex_size;
+    size_t index_count = _lods.empty() ? _indices.size() : _lods[0].index_count;
+
+    _meshlets.clear();
+    Meshlets::Build(_indices.data(), index_count, info.data.get(), vertex_count, info.vertex_size, info.normal_offset, _meshlets);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+    size_t cones = std::count_if(_meshlets.begin(), _meshlets.end(), [](const Meshlet& m) { return m.cone_cutoff <= 1.0f; });
+    printf("[MESHLET] %s: %d meshlets, %.1f triangles per meshlet, %d with normal cones, in %lld ms\n", _id.c_str(),
+        (int)_meshlets.size(), _meshlets.empty() ? 0.0f : float(index_count / 3) / _meshlets.size(), (int)cones,
+        (long long)elapsed.count());
 }
 
 void Mesh::CalculateVBOSize(VBOInfo& info)
@@ -141,36 +700,165 @@ void Mesh::CalculateVBOSize(VBOInfo& info)
     info.normal_offset = vertex_size;
     vertex_size += sizeof(TriMesh::Normal);
 
-    if (VertexHasColorAttrib()) {
+    info.has_color = VertexHasColorAttrib();
+    info.has_texcoord = _mesh.has_vertex_texcoords2D();
+    info.color_offset = 0;
+    info.texcoord_offset = 0;
+
+    if (info.has_color) {
         info.color_offset = vertex_size;
         // TriMesh::Color is a unsigned char array of 3 elements
         // we convert it into a float array 
         vertex_size += 3 * sizeof(float);
     }
 
-    if (_mesh.has_vertex_texcoords2D()) {
+    if (info.has_texcoord) {
         info.texcoord_offset = vertex_size;
         vertex_size += sizeof(TriMesh::TexCoord2D);
     }
 
     info.vertex_size = vertex_size;
 
-    size_t total_vertices = 0;
+    // per-face shading emits one vertex per face corner
+    size_t total_vertices = _per_face_shading ? 3 * _mesh.n_faces() : _mesh.n_vertices();
+
+    info.size = info.vertex_size * total_vertices;
+}
+
+void Mesh::PopulateVBOData(VBOInfo& info)
+{
+    const size_t n_vertices = _mesh.n_vertices();
+    const size_t n_faces = _mesh.n_faces();
+    const size_t vertex_size = info.vertex_size;
+
+    _indices.resize(n_faces * 3);
+    char* buffer = new char[info.size];
+
+    // read OpenMesh's property arrays directly instead of going through the handle accessors
+    const TriMesh::Point*      points = _mesh.points();
+    const TriMesh::Normal*     normals = _mesh.vertex_normals();
+    const TriMesh::TexCoord2D* texcoords = info.has_texcoord ? _mesh.texcoords2D() : nullptr;
+
+    // colors are converted to floats once per mesh; per-face shading reads the face colors
+    std::vector<float> colors;
+    if (info.has_color) {
+        const TriMesh::Color* src = _per_face_shading ? _mesh.property(_mesh.face_colors_pph()).data() : _mesh.vertex_colors();
+        size_t count = _per_face_shading ? n_faces : n_vertices;
+        colors.resize(count * 3);
+        ConvertColorsToFloat(reinterpret_cast<const unsigned char*>(src), colors.data(), count * 3);
+    }
+
+    GLuint* indices = _indices.data();
+
     if (_per_face_shading) {
-        for (TriMesh::ConstVertexIter v_it = _mesh.vertices_begin(); v_it != _mesh.vertices_end(); ++v_it) {
-            if (_mesh.is_boundary(*v_it))
-                total_vertices += _mesh.valence(*v_it) - 1;
-            else
-                total_vertices += _mesh.valence(*v_it);
+        // corner slot of every face halfedge, in the same order as the CCW face circulator
+        std::vector<GLuint> corner_slot(_mesh.n_halfedges());
+        for (size_t f = 0; f < n_faces; f++) {
+            TriMesh::HalfedgeHandle hh = _mesh.halfedge_handle(TriMesh::FaceHandle((int)f));
+            for (GLuint k = 0; k < 3; k++) {
+                corner_slot[hh.idx()] = GLuint(3 * f + k);
+                hh = _mesh.next_halfedge_handle(hh);
+            }
         }
+
+        // one VBO vertex per face corner, emitted vertex by vertex so the layout stays unchanged
+        char* dst = buffer;
+        GLuint v_count = 0;
+        for (size_t v = 0; v < n_vertices; v++) {
+            TriMesh::HalfedgeHandle start = _mesh.halfedge_handle(TriMesh::VertexHandle((int)v));
+            TriMesh::HalfedgeHandle hh = start;
+            do {
+                TriMesh::FaceHandle fh = _mesh.face_handle(hh);
+                if (fh.is_valid()) {
+                    memcpy(dst, points[v].data(), sizeof(TriMesh::Point));
+                    memcpy(dst + info.normal_offset, normals[v].data(), sizeof(TriMesh::Normal));
+                    if (info.has_color)
+                        memcpy(dst + info.color_offset, &colors[3 * fh.idx()], 3 * sizeof(float));
+                    if (texcoords)
+                        memcpy(dst + info.texcoord_offset, texcoords[v].data(), sizeof(TriMesh::TexCoord2D));
+                    indices[corner_slot[hh.idx()]] = v_count++;
+                    dst += vertex_size;
+                }
+                hh = _mesh.ccw_rotated_halfedge_handle(hh);
+            } while (hh != start);
+        }
+        assert(v_count * vertex_size == info.size);
     }
-    else
-        total_vertices = _mesh.n_vertices();
+    else {
+        char* dst = buffer;
+        for (size_t v = 0; v < n_vertices; v++, dst += vertex_size) {
+            memcpy(dst, points[v].data(), sizeof(TriMesh::Point));
+            memcpy(dst + info.normal_offset, normals[v].data(), sizeof(TriMesh::Normal));
+            if (info.has_color)
+                memcpy(dst + info.color_offset, &colors[3 * v], 3 * sizeof(float));
+            if (texcoords)
+                memcpy(dst + info.texcoord_offset, texcoords[v].data(), sizeof(TriMesh::TexCoord2D));
+        }
 
-    info.size = info.vertex_size * total_vertices;
+        for (size_t f = 0; f < n_faces; f++) {
+            TriMesh::HalfedgeHandle hh = _mesh.halfedge_handle(TriMesh::FaceHandle((int)f));
+            for (size_t k = 0; k < 3; k++) {
+                indices[3 * f + k] = _mesh.to_vertex_handle(hh).idx();
+                hh = _mesh.next_halfedge_handle(hh);
+            }
+        }
+    }
+
+    info.data = std::unique_ptr<char>(buffer);
+    _numIndices = (GLsizei)_indices.size();
 }
 
-void Mesh::PopulateVBOData(VBOInfo& info)
+void Mesh::ConvertColorsToFloat(const unsigned char* src, float* dst, size_t count)
+{
+    size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    // divide rather than multiply by 1/255 so the result matches the scalar conversion bit for bit
+    const __m128  scale = _mm_set1_ps(255.0f);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_ps(dst + i,      _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dst + i + 4,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dst + i + 8,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+        _mm_storeu_ps(dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = float((unsigned)src[i]) / 255.0f;
+}
+
+void Mesh::BenchmarkVBOPacking(int iterations, const std::string& name)
+{
+    using clock = std::chrono::high_resolution_clock;
+    VBOInfo info, ref_info;
+    CalculateVBOSize(info);
+    CalculateVBOSize(ref_info);
+
+    double ref_ms = 0, ms = 0;
+    std::vector<GLuint> ref_indices;
+    for (int i = 0; i < iterations; i++) {
+        auto t0 = clock::now();
+        PopulateVBODataReference(ref_info);
+        auto t1 = clock::now();
+        ref_indices.swap(_indices);
+        PopulateVBOData(info);
+        auto t2 = clock::now();
+        ref_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+
+    bool identical = info.size == ref_info.size &&
+                     memcmp(info.data.get(), ref_info.data.get(), info.size) == 0 &&
+                     ref_indices == _indices;
+    printf("[VBO PACKING] %s: %d faces, reference %.3f ms, packed %.3f ms, speedup %.2fx, output %s\n",
+        name.c_str(), (int)_mesh.n_faces(), ref_ms / iterations, ms / iterations, ref_ms / ms,
+        identical ? "identical" : "DIFFERS");
+}
+
+// halfedge based packing kept as the reference for BenchmarkVBOPacking
+void Mesh::PopulateVBODataReference(VBOInfo& info)
 {
     _indices.resize(_mesh.n_faces() * 3);
 
@@ -210,6 +898,7 @@ void Mesh::PopulateVBOData(VBOInfo& info)
     }
 
     info.data = std::unique_ptr<char>(buffer);
+    _numIndices = (GLsizei)_indices.size();
 
 }
 
@@ -3,6 +3,8 @@
 
 #include "common.h"
 #include "geometry.h"
+#include "meshcache.h"
+#include "vertexformat.h"
 
 #include <OpenMesh\Core\IO\MeshIO.hh>
 #include <OpenMesh\Core\Mesh\TriMesh_ArrayKernelT.hh>
@@ -13,28 +15,92 @@ class Mesh : public Geometry {
     friend class ResourceManager;
 
     struct VBOInfo {
-        std::unique_ptr<char> data;
-        size_t                size;
-        size_t                vertex_size;
-        size_t                normal_offset;
-        size_t                texcoord_offset;
-        size_t                color_offset;
+        std::unique_ptr<char>     data;
+        size_t                    size;
+        size_t                    vertex_size;
+        // float layout written by PopulateVBOData
+        size_t                    normal_offset;
+        size_t                    texcoord_offset;
+        size_t                    color_offset;
+        bool                      has_color;
+        bool                      has_texcoord;
+        // final layout of 'data' after EncodeVertices, and the packed index buffer
+        std::vector<VertexAttrib> attribs;
+        std::vector<char>         index_data;
+        GLenum                    index_type;
+    };
+
+    // CPU side results of loading a mesh, kept until the buffers are uploaded
+    struct StagingData {
+        VBOInfo                    info;
+        std::unique_ptr<MeshCache> cache;
     };
 
 public:
-    Mesh() : _per_face_shading(false) {}
+    // import settings that change the generated buffers; they are part of the mesh cache key
+    enum ImportOptions {
+        IMPORT_MESHLETS            = 1 << 22,
+        IMPORT_LODS                = 1 << 23,
+        IMPORT_OPTIMIZE            = 1 << 24,
+        IMPORT_VERTEX_FORMAT_SHIFT = 25
+    };
+
+    // each level halves the triangles of the previous one until MIN_LOD_TRIANGLES are left
+    static const size_t MIN_LOD_TRIANGLES = 256;
+    // occluders rasterize the finest level of detail within this budget
+    static const size_t OCCLUDER_MAX_TRIANGLES = 4096;
+
+    Mesh() : _numIndices(0), _indexType(GL_UNSIGNED_INT), _per_face_shading(false), _optimize(false),
+        _generateLods(false), _lod(0), _instanceCullValid(false), _instancesCompacted(false), _cullPixelError(-1.0f),
+        _buildMeshlets(false), _meshletBackfaceCulling(true), _meshletStats({ 0, 0, 0, 0 }), _meshletCullValid(false) {}
 
     TriMesh&         GetMeshObj()                       { return _mesh; }
     void             EnablePerFaceShading(bool enable);
+    void             EnableOptimization(bool enable)    { _optimize = enable; }
+    void             EnableLODs(bool enable)            { _generateLods = enable; }
+    void             EnableMeshlets(bool enable)        { _buildMeshlets = enable; }
+    // the cone test drops meshlets facing away from the eye; open meshes seen from behind need it off
+    void             EnableMeshletBackfaceCulling(bool enable) { _meshletBackfaceCulling = enable; }
+    void             SetVertexFormat(const VertexFormat& format) { _vertexFormat = format; }
+    const VertexFormat& GetVertexFormat() const         { return _vertexFormat; }
+    uint32_t         GetImportOptions() const
+    {
+        return (_optimize ? IMPORT_OPTIMIZE : 0) | (_generateLods ? IMPORT_LODS : 0) | (_buildMeshlets ? IMPORT_MESHLETS : 0) |
+               (_vertexFormat.Key() << IMPORT_VERTEX_FORMAT_SHIFT);
+    }
     virtual void     Render();
+    virtual uint32_t CullInstances(const glm::mat4& view_proj, const LODSelector* lod = nullptr);
+    virtual void     SelectLOD(const LODSelector& selector);
+    virtual void     GetLODIndexRange(GLuint& first, GLsizei& count) const;
+    virtual const MeshletStats* CullMeshlets(const glm::mat4& view_proj, const glm::vec3& eye);
+    virtual const MeshletStats* GetMeshletStats() const { return _meshlets.empty() ? nullptr : &_meshletStats; }
+    virtual const std::vector<IndexRange>* GetMeshletRanges() const;
+    virtual const OccluderMesh* GetOccluderMesh() const { return _occluder && !IsInstanced() ? &_occluderMesh : nullptr; }
+    virtual GLenum   GetIndexType() const { return _indexType; }
 
 private:
     void     ComputeBoundingBox();
     void     SetInitialTransformation();
-    void     SetupVAO();
+    void     SetupVAO(const VBOInfo&, const void* vertices, const void* indices);
+    void     LoadFromCache(const MeshCache& cache, VBOInfo&);
+    void     ExtractOccluder(const VBOInfo&, const void* vertices, const void* indices);
+    void     WriteCache(const std::string& file, uint32_t options, const VBOInfo&);
     void     PopulateVBO(VBOInfo&);
     void     CalculateVBOSize(VBOInfo&);
     void     PopulateVBOData(VBOInfo&);
+    void     GenerateLODs(VBOInfo&);
+    uint32_t ChooseLOD(const AABB& world_bounds, const LODSelector& selector) const;
+    void     SortInstancesByLOD(const glm::mat4* transforms, const LODSelector& selector);
+    void     OptimizeBuffers(VBOInfo&);
+    void     BuildMeshlets(VBOInfo&);
+    void     RenderIndexRanges(const std::vector<IndexRange>& ranges);
+    void     RenderArena(const std::vector<IndexRange>* ranges, GLuint first, GLsizei count);
+    void     EncodeVertices(VBOInfo&);
+    void     EncodeIndices(VBOInfo&);
+    glm::vec3 GetQuantizationExtent() const;
+    void     PopulateVBODataReference(VBOInfo&);
+    void     BenchmarkVBOPacking(int iterations, const std::string& name);
+    static void ConvertColorsToFloat(const unsigned char* src, float* dst, size_t count);
     void     PopulateVertexData(const TriMesh::HalfedgeHandle& hh, char* data, const VBOInfo&);
     void     PopulateIBO(const TriMesh::HalfedgeHandle&, int);
     bool     VertexHasColorAttrib();
@@ -43,7 +109,50 @@ private:
 private:
     TriMesh             _mesh;
     std::vector<GLuint> _indices;
+    GLsizei             _numIndices;
+    GLenum              _indexType;
+    VertexFormat        _vertexFormat;
+    std::unique_ptr<StagingData> _staging;
     bool                _per_face_shading;
+    bool                _optimize;
+    bool                _generateLods;
+    // LOD 0 is the full mesh; all levels index the same vertices
+    std::vector<MeshCache::LOD> _lods;
+    uint32_t            _lod;
+    // visible instances grouped by level of detail, drawn with one base instance per group
+    struct InstanceLODRange {
+        uint32_t lod;
+        uint32_t first;
+        uint32_t count;
+    };
+    std::vector<InstanceLODRange> _instanceLodRanges;
+    // per-instance culling; the instance VBOs hold the visible instances packed to the front
+    std::vector<uint32_t> _visibleInstances;
+    std::vector<char>   _compactedInstances;
+    glm::mat4           _cullViewProj;
+    glm::mat4           _cullModel;
+    bool                _instanceCullValid;
+    bool                _instancesCompacted;
+    float               _cullPixelError;
+    // meshlets partition the LOD 0 indices; their bounds are in the unquantized positions,
+    // which _meshletToObject maps to the space of the vertex buffer
+    bool                _buildMeshlets;
+    bool                _meshletBackfaceCulling;
+    std::vector<Meshlet> _meshlets;
+    std::vector<uint32_t> _visibleMeshlets;
+    std::vector<IndexRange> _meshletRanges;
+    MeshletStats        _meshletStats;
+    glm::mat4           _meshletToObject;
+    glm::mat4           _meshletViewProj;
+    glm::mat4           _meshletModel;
+    glm::vec3           _meshletEye;
+    bool                _meshletCullValid;
+    std::vector<GLsizei> _multiDrawCounts;
+    std::vector<const GLvoid*> _multiDrawOffsets;
+    std::vector<GLint>  _multiDrawBaseVertices;
+    std::vector<GeometryArena::DrawCommand> _arenaCommands;
+    // positions are in the space of the vertex buffer, so the model matrix places them
+    OccluderMesh        _occluderMesh;
 };
 
 
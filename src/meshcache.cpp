@@ -0,0 +1,154 @@
+#include "meshcache.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+const uint32_t MeshCache::MAGIC   = 0x434d4647; // "GFMC"
+const uint32_t MeshCache::VERSION = 4;
+
+MeshCache::MeshCache()
+    : _header(nullptr),
+    _vertices(nullptr),
+    _indices(nullptr),
+    _meshlets(nullptr)
+{
+}
+
+MeshCache::~MeshCache()
+{
+    Close();
+}
+
+std::string MeshCache::GetCachePath(const std::string& source, uint32_t options)
+{
+    // imports of the same file with different options get sidecars of their own
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4; i++)
+        hash = (hash ^ ((options >> (i * 8)) & 0xff)) * 16777619u;
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%08x.gfxcache", hash);
+    return source + suffix;
+}
+
+bool MeshCache::GetSourceStamp(const std::string& source, int64_t& mtime, uint64_t& size)
+{
+    struct stat sb;
+    if (stat(source.c_str(), &sb) != 0)
+        return false;
+    mtime = (int64_t)sb.st_mtime;
+    size = (uint64_t)sb.st_size;
+    return true;
+}
+
+bool MeshCache::Open(const std::string& source, uint32_t options)
+{
+    Close();
+
+    int64_t mtime;
+    uint64_t size;
+    if (!GetSourceStamp(source, mtime, size))
+        return false;
+
+    if (!_file.Open(GetCachePath(source, options)) || _file.GetSize() < sizeof(Header)) {
+        Close();
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(_file.GetData());
+    const Header* header = reinterpret_cast<const Header*>(base);
+    if (header->magic != MAGIC || header->version != VERSION) {
+        Close();
+        return false;
+    }
+
+    // the sizes come from the file, so each section is checked against what is left of it
+    // before it is added; the offsets then never pass the file size and cannot wrap
+    size_t file_size = _file.GetSize();
+    size_t path_offset = sizeof(Header);
+    size_t vertex_offset, index_offset, meshlet_offset, end;
+    bool valid = NextSection(path_offset, header->source_path_size, file_size, vertex_offset) &&
+                 NextSection(vertex_offset, header->vertex_data_size, file_size, index_offset) &&
+                 NextSection(index_offset, header->index_data_size, file_size, meshlet_offset) &&
+                 NextSection(meshlet_offset, uint64_t(header->num_meshlets) * sizeof(Meshlet), file_size, end) &&
+                 header->options == options &&
+                 header->source_mtime == mtime &&
+                 header->source_size == size &&
+                 header->source_path_size == source.size() &&
+                 header->num_attribs <= MAX_ATTRIBS &&
+                 memcmp(base + path_offset, source.data(), source.size()) == 0;
+    if (!valid) {
+        Close();
+        return false;
+    }
+
+    _header = header;
+    _vertices = base + vertex_offset;
+    _indices = base + index_offset;
+    _meshlets = reinterpret_cast<const Meshlet*>(base + meshlet_offset);
+    return true;
+}
+
+bool MeshCache::NextSection(size_t offset, uint64_t bytes, size_t file_size, size_t& next)
+{
+    if (offset > file_size || bytes > file_size - offset)
+        return false;
+    next = Align(offset + (size_t)bytes);
+    return true;
+}
+
+void MeshCache::Close()
+{
+    _file.Close();
+    _header = nullptr;
+    _vertices = nullptr;
+    _indices = nullptr;
+    _meshlets = nullptr;
+}
+
+bool MeshCache::Write(const std::string& source, Header& header, const void* vertices, const void* indices,
+    const Meshlet* meshlets)
+{
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.source_path_size = (uint32_t)source.size();
+    if (!GetSourceStamp(source, header.source_mtime, header.source_size))
+        return false;
+
+    // write to a temporary file first so that a concurrent reader never maps a partial sidecar
+    std::string path = GetCachePath(source, header.options);
+    std::string tmp_path = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cout << "failed to write mesh cache " << path << std::endl;
+        return false;
+    }
+
+    static const char padding[8] = { 0 };
+    size_t vertex_offset = Align(sizeof(Header) + source.size());
+    size_t index_offset = Align(vertex_offset + (size_t)header.vertex_data_size);
+    size_t meshlet_offset = Align(index_offset + (size_t)header.index_data_size);
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    out.write(source.data(), source.size());
+    out.write(padding, vertex_offset - sizeof(Header) - source.size());
+    out.write(static_cast<const char*>(vertices), (std::streamsize)header.vertex_data_size);
+    out.write(padding, index_offset - vertex_offset - (size_t)header.vertex_data_size);
+    out.write(static_cast<const char*>(indices), (std::streamsize)header.index_data_size);
+    out.write(padding, meshlet_offset - index_offset - (size_t)header.index_data_size);
+    out.write(reinterpret_cast<const char*>(meshlets), (std::streamsize)(header.num_meshlets * sizeof(Meshlet)));
+    out.close();
+
+    if (!out) {
+        std::remove(tmp_path.c_str());
+        std::cout << "failed to write mesh cache " << path << std::endl;
+        return false;
+    }
+
+    std::remove(path.c_str());
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
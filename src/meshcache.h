@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.h"
+#include "vertexformat.h"
+#include "meshlet.h"
+#include "mappedfile.h"
+
+#include <cstdint>
+
+// Versioned binary sidecar holding the packed GPU buffers of an imported mesh.
+// The sidecar lives next to the source file, named after a hash of the import options used to
+// build it, and is keyed by the source path, its modification time and size, and those options.
+class MeshCache {
+public:
+    enum Flags {
+        PER_FACE_SHADING = 1 << 0
+    };
+
+    static const int MAX_ATTRIBS = 4;
+    static const int MAX_LODS = 8;
+
+    // a level of detail is a range of the index data; 'error' is relative to the bounding box diagonal
+    struct LOD {
+        uint32_t first_index;
+        uint32_t index_count;
+        float    error;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t options;
+        uint32_t flags;
+        int64_t  source_mtime;
+        uint64_t source_size;
+        uint64_t vertex_data_size;
+        uint64_t index_data_size;
+        uint64_t num_indices;
+        uint32_t index_type;
+        uint32_t vertex_size;
+        uint32_t num_attribs;
+        VertexAttrib attribs[MAX_ATTRIBS];
+        float    bbox_min[3];
+        float    bbox_max[3];
+        float    bbox_center[3];
+        uint32_t num_lods;
+        LOD      lods[MAX_LODS];
+        uint32_t num_meshlets;
+        uint32_t source_path_size;
+    };
+
+    static const uint32_t MAGIC;
+    static const uint32_t VERSION;
+
+    MeshCache();
+    ~MeshCache();
+
+    // maps the sidecar of 'source'; fails if it is missing, corrupt or stale
+    bool               Open(const std::string& source, uint32_t options);
+    void               Close();
+    const Header&      GetHeader()     const { return *_header; }
+    const void*        GetVertexData() const { return _vertices; }
+    const void*        GetIndexData()  const { return _indices; }
+    const Meshlet*     GetMeshlets()   const { return _meshlets; }
+
+    // fills in the magic, version and source stamp of 'header' and writes the sidecar
+    static bool        Write(const std::string& source, Header& header, const void* vertices, const void* indices,
+                             const Meshlet* meshlets);
+    static std::string GetCachePath(const std::string& source, uint32_t options);
+
+private:
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    static bool        GetSourceStamp(const std::string& source, int64_t& mtime, uint64_t& size);
+    static size_t      Align(size_t offset) { return (offset + 7) & ~size_t(7); }
+    // aligned start of the section after 'bytes' at 'offset', if they fit in the file
+    static bool        NextSection(size_t offset, uint64_t bytes, size_t file_size, size_t& next);
+
+    const Header*      _header;
+    const void*        _vertices;
+    const void*        _indices;
+    const Meshlet*     _meshlets;
+    MappedFile         _file;
+};
@@ -0,0 +1,274 @@
+#include "meshlet.h"
+#include "jobsystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+
+// meshlet lists below this size per batch are culled on the calling thread
+static const uint32_t PARALLEL_CULL_THRESHOLD = 4096;
+
+// cones whose triangles spread further than this from the axis cull too little to be worth testing
+static const float MIN_CONE_SPREAD = 0.1f;
+
+// a meshlet past MIN_TRIANGLES only takes triangles within about 60 degrees of its average normal
+static const float MIN_CANDIDATE_FACING = 0.5f;
+
+static const uint32_t UNASSIGNED = ~0u;
+
+static glm::vec3 ReadVec3(const char* vertices, size_t vertex_size, size_t offset, uint32_t v)
+{
+    glm::vec3 p;
+    memcpy(&p, vertices + v * vertex_size + offset, sizeof(p));
+    return p;
+}
+
+static glm::vec3 SafeNormalize(const glm::vec3& v)
+{
+    float len = glm::length(v);
+    return len > 0.0f ? v / len : glm::vec3(0.0f);
+}
+
+static void ComputeBounds(const uint32_t* indices, const glm::vec3* normals, const char* vertices,
+    size_t vertex_size, Meshlet& m)
+{
+    AABB box;
+    for (uint32_t i = 0; i < m.index_count; i++) {
+        glm::vec3 p = ReadVec3(vertices, vertex_size, 0, indices[m.first_index + i]);
+        box.Extend(AABB(p, p));
+    }
+    m.center = box.Center();
+    m.radius = 0.0f;
+    for (uint32_t i = 0; i < m.index_count; i++)
+        m.radius = std::max(m.radius, glm::length(ReadVec3(vertices, vertex_size, 0, indices[m.first_index + i]) - m.center));
+
+    // the axis averages the triangle normals; the cutoff comes from the normal furthest from it
+    uint32_t first_tri = m.first_index / 3, tri_count = m.index_count / 3;
+    glm::vec3 sum(0.0f);
+    for (uint32_t t = 0; t < tri_count; t++)
+        sum += normals[first_tri + t];
+    glm::vec3 axis = SafeNormalize(sum);
+    float min_dot = glm::length(axis) > 0.0f ? 1.0f : -1.0f;
+    for (uint32_t t = 0; t < tri_count; t++) {
+        const glm::vec3& n = normals[first_tri + t];
+        if (n != glm::vec3(0.0f))
+            min_dot = std::min(min_dot, glm::dot(n, axis));
+    }
+
+    m.cone_axis = axis;
+    m.cone_apex = m.center;
+    if (min_dot <= MIN_CONE_SPREAD) {
+        m.cone_cutoff = 2.0f;
+        return;
+    }
+
+    // move the apex back along the axis until it is behind the plane of every triangle, so the
+    // test holds for any eye position and not only for distant ones
+    float max_t = 0.0f;
+    for (uint32_t t = 0; t < tri_count; t++) {
+        const glm::vec3& n = normals[first_tri + t];
+        if (n == glm::vec3(0.0f))
+            continue;
+        glm::vec3 corner = ReadVec3(vertices, vertex_size, 0, indices[3 * (first_tri + t)]);
+        max_t = std::max(max_t, glm::dot(m.center - corner, n) / glm::dot(axis, n));
+    }
+    m.cone_apex = m.center - axis * max_t;
+    m.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+}
+
+void Meshlets::Build(uint32_t* indices, size_t index_count, const char* vertices, size_t vertex_count,
+    size_t vertex_size, size_t normal_offset, std::vector<Meshlet>& meshlets)
+{
+    const size_t tri_count = index_count / 3;
+    if (tri_count == 0)
+        return;
+
+    // corners sharing a position are one vertex for adjacency, so per-face shaded meshes cluster too
+    std::vector<uint32_t> order(vertex_count);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return memcmp(vertices + a * vertex_size, vertices + b * vertex_size, 3 * sizeof(float)) < 0;
+    });
+    std::vector<uint32_t> welded(vertex_count);
+    uint32_t welded_count = 0;
+    for (size_t i = 0; i < vertex_count; i++) {
+        if (i > 0 && memcmp(vertices + order[i] * vertex_size, vertices + order[i - 1] * vertex_size, 3 * sizeof(float)) != 0)
+            welded_count++;
+        welded[order[i]] = welded_count;
+    }
+    welded_count++;
+
+    // triangles around each welded vertex
+    std::vector<uint32_t> adjacency_offsets(welded_count + 1, 0);
+    for (size_t i = 0; i < tri_count * 3; i++)
+        adjacency_offsets[welded[indices[i]] + 1]++;
+    for (uint32_t v = 0; v < welded_count; v++)
+        adjacency_offsets[v + 1] += adjacency_offsets[v];
+    std::vector<uint32_t> adjacency(tri_count * 3);
+    std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < tri_count * 3; i++)
+        adjacency[fill[welded[indices[i]]]++] = uint32_t(i / 3);
+
+    // face normals oriented by the vertex normals, and centroids
+    std::vector<glm::vec3> normals(tri_count), centroids(tri_count);
+    for (size_t t = 0; t < tri_count; t++) {
+        glm::vec3 p[3], vertex_normal(0.0f);
+        for (int k = 0; k < 3; k++) {
+            p[k] = ReadVec3(vertices, vertex_size, 0, indices[3 * t + k]);
+            vertex_normal += ReadVec3(vertices, vertex_size, normal_offset, indices[3 * t + k]);
+        }
+        glm::vec3 n = SafeNormalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+        normals[t] = glm::dot(n, vertex_normal) < 0.0f ? -n : n;
+        centroids[t] = (p[0] + p[1] + p[2]) / 3.0f;
+    }
+
+    std::vector<uint32_t> meshlet_of(tri_count, UNASSIGNED);
+    std::vector<uint32_t> candidate_of(tri_count, UNASSIGNED);
+    std::vector<uint32_t> vertex_owner(welded_count, UNASSIGNED);
+    std::vector<uint32_t> candidates, members, reordered;
+    std::vector<glm::vec3> reordered_normals;
+    reordered.reserve(tri_count * 3);
+    reordered_normals.reserve(tri_count);
+
+    const uint32_t first_meshlet = (uint32_t)meshlets.size();
+    size_t next_unassigned = 0;
+    uint32_t seed = UNASSIGNED;
+    for (uint32_t id = 0; ; id++) {
+        if (seed == UNASSIGNED) {
+            while (next_unassigned < tri_count && meshlet_of[next_unassigned] != UNASSIGNED)
+                next_unassigned++;
+            if (next_unassigned == tri_count)
+                break;
+            seed = (uint32_t)next_unassigned;
+        }
+
+        members.clear();
+        candidates.clear();
+        glm::vec3 normal_sum(0.0f), centroid_sum(0.0f);
+        auto add = [&](uint32_t t) {
+            meshlet_of[t] = id;
+            members.push_back(t);
+            normal_sum += normals[t];
+            centroid_sum += centroids[t];
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = welded[indices[3 * t + k]];
+                vertex_owner[v] = id;
+                for (uint32_t a = adjacency_offsets[v]; a < adjacency_offsets[v + 1]; a++) {
+                    uint32_t n = adjacency[a];
+                    if (meshlet_of[n] == UNASSIGNED && candidate_of[n] != id) {
+                        candidate_of[n] = id;
+                        candidates.push_back(n);
+                    }
+                }
+            }
+        };
+        add(seed);
+
+        // grow towards the candidate that adds the fewest vertices close to the center and
+        // facing along the meshlet, which keeps both the sphere and the cone tight
+        while (members.size() < MAX_TRIANGLES) {
+            glm::vec3 center = centroid_sum / float(members.size());
+            glm::vec3 axis = SafeNormalize(normal_sum);
+            float best_score = FLT_MAX;
+            size_t best = SIZE_MAX;
+            for (size_t c = 0; c < candidates.size(); ) {
+                uint32_t t = candidates[c];
+                if (meshlet_of[t] != UNASSIGNED) {
+                    candidates[c] = candidates.back();
+                    candidates.pop_back();
+                    continue;
+                }
+                float facing = glm::dot(normals[t], axis);
+                if (members.size() < MIN_TRIANGLES || facing >= MIN_CANDIDATE_FACING) {
+                    int new_vertices = 0;
+                    for (int k = 0; k < 3; k++)
+                        new_vertices += vertex_owner[welded[indices[3 * t + k]]] != id;
+                    float score = (1 + new_vertices) * (glm::length(centroids[t] - center) + 1e-6f) * (2.0f - facing);
+                    if (score < best_score) {
+                        best_score = score;
+                        best = c;
+                    }
+                }
+                c++;
+            }
+            if (best == SIZE_MAX)
+                break;
+            add(candidates[best]);
+        }
+
+        // triangles keep their relative order so the vertex cache optimization mostly survives
+        std::sort(members.begin(), members.end());
+        Meshlet m;
+        m.first_index = (uint32_t)reordered.size();
+        m.index_count = (uint32_t)members.size() * 3;
+        for (auto t : members) {
+            reordered.insert(reordered.end(), indices + 3 * t, indices + 3 * t + 3);
+            reordered_normals.push_back(normals[t]);
+        }
+        meshlets.push_back(m);
+
+        // the next meshlet starts on the border of this one
+        seed = UNASSIGNED;
+        for (auto t : candidates) {
+            if (meshlet_of[t] == UNASSIGNED) {
+                seed = t;
+                break;
+            }
+        }
+    }
+
+    memcpy(indices, reordered.data(), reordered.size() * sizeof(uint32_t));
+    for (size_t i = first_meshlet; i < meshlets.size(); i++)
+        ComputeBounds(indices, reordered_normals.data(), vertices, vertex_size, meshlets[i]);
+}
+
+static void CullRange(const Frustum& frustum, const glm::vec3& eye, bool backface, const Meshlet* meshlets,
+    uint32_t begin, uint32_t end, std::vector<uint32_t>& visible, MeshletStats& stats)
+{
+    for (uint32_t i = begin; i < end; i++) {
+        const Meshlet& m = meshlets[i];
+        if (!frustum.Intersects(m.center, m.radius)) {
+            stats.frustum_culled++;
+            continue;
+        }
+
+        // dot(normalize(apex - eye), axis) >= cutoff without the square root
+        if (backface && m.cone_cutoff <= 1.0f) {
+            glm::vec3 dir = m.cone_apex - eye;
+            if (glm::dot(dir, m.cone_axis) >= m.cone_cutoff * glm::length(dir)) {
+                stats.backface_culled++;
+                continue;
+            }
+        }
+        visible.push_back(i);
+    }
+}
+
+void Meshlets::Cull(const Frustum& frustum, const glm::vec3& eye, bool backface, const Meshlet* meshlets,
+    uint32_t count, std::vector<uint32_t>& visible, MeshletStats& stats)
+{
+    stats = { count, 0, 0, 0 };
+
+    JobSystem* jobs = JobSystem::GetInstance();
+    uint32_t batches = jobs->GetBatchCount(count, PARALLEL_CULL_THRESHOLD);
+    if (batches <= 1) {
+        CullRange(frustum, eye, backface, meshlets, 0, count, visible, stats);
+        stats.visible = count - stats.frustum_culled - stats.backface_culled;
+        return;
+    }
+
+    // contiguous ranges per batch; concatenating the results keeps the meshlets in index order
+    std::vector<std::vector<uint32_t>> results(batches);
+    std::vector<MeshletStats> batch_stats(batches, MeshletStats{ 0, 0, 0, 0 });
+    jobs->ParallelFor(count, batches, [&](uint32_t batch, uint32_t begin, uint32_t end) {
+        CullRange(frustum, eye, backface, meshlets, begin, end, results[batch], batch_stats[batch]);
+    });
+    for (uint32_t t = 0; t < batches; t++) {
+        visible.insert(visible.end(), results[t].begin(), results[t].end());
+        stats.frustum_culled += batch_stats[t].frustum_culled;
+        stats.backface_culled += batch_stats[t].backface_culled;
+    }
+    stats.visible = count - stats.frustum_culled - stats.backface_culled;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "frustum.h"
+
+#include <vector>
+
+// A cluster of neighbouring triangles stored as a contiguous range of a mesh's indices,
+// with the bounds used to cull the whole cluster on the CPU.
+struct Meshlet {
+    uint32_t  first_index;
+    uint32_t  index_count;
+    glm::vec3 center;
+    float     radius;
+    // every triangle faces away from eyes inside the cone at 'cone_apex' around 'cone_axis';
+    // a cutoff above one disables the test
+    glm::vec3 cone_apex;
+    glm::vec3 cone_axis;
+    float     cone_cutoff;
+};
+
+struct MeshletStats {
+    uint32_t meshlets;
+    uint32_t visible;
+    uint32_t frustum_culled;
+    uint32_t backface_culled;
+};
+
+class Meshlets {
+public:
+    // meshlets grow to MAX_TRIANGLES; past MIN_TRIANGLES they stop taking triangles that bend the cone
+    static const uint32_t MAX_TRIANGLES = 124;
+    static const uint32_t MIN_TRIANGLES = 64;
+
+    // partitions the triangles of 'indices' into meshlets and reorders them in place so that each
+    // meshlet is contiguous. Vertices hold the position and the normal as floats at offset 0 and
+    // 'normal_offset'; the normals only orient the triangles, the winding is not relied on.
+    static void Build(uint32_t* indices, size_t index_count, const char* vertices, size_t vertex_count,
+                      size_t vertex_size, size_t normal_offset, std::vector<Meshlet>& meshlets);
+
+    // appends the indices of the meshlets that overlap the frustum and, with 'backface', have a
+    // triangle facing 'eye'. Frustum and eye are in the space of the meshlet bounds.
+    static void Cull(const Frustum& frustum, const glm::vec3& eye, bool backface, const Meshlet* meshlets,
+                     uint32_t count, std::vector<uint32_t>& visible, MeshletStats& stats);
+};
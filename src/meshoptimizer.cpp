@@ -0,0 +1,454 @@
+#include "meshoptimizer.h"
+
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <queue>
+
+static const int   FORSYTH_CACHE_SIZE = 32;
+static const float FORSYTH_LAST_TRI_SCORE = 0.75f;
+static const float FORSYTH_CACHE_DECAY = 1.5f;
+static const float FORSYTH_VALENCE_SCALE = 2.0f;
+static const float FORSYTH_VALENCE_POWER = 0.5f;
+
+static float VertexScore(int cache_pos, unsigned live_triangles)
+{
+    if (live_triangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cache_pos >= 0) {
+        if (cache_pos < 3)
+            score = FORSYTH_LAST_TRI_SCORE;
+        else {
+            float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = powf(1.0f - (cache_pos - 3) * scaler, FORSYTH_CACHE_DECAY);
+        }
+    }
+
+    return score + FORSYTH_VALENCE_SCALE * powf((float)live_triangles, -FORSYTH_VALENCE_POWER);
+}
+
+size_t MeshOptimizer::WeldVertices(char* vertices, size_t vertex_count, size_t vertex_size, std::vector<GLuint>& indices)
+{
+    std::vector<GLuint> remap(vertex_count);
+    std::unordered_multimap<uint64_t, GLuint> lookup;
+    lookup.reserve(vertex_count);
+
+    size_t unique_count = 0;
+    for (size_t v = 0; v < vertex_count; v++) {
+        const char* vertex = vertices + v * vertex_size;
+
+        // FNV-1a over the packed vertex
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t b = 0; b < vertex_size; b++)
+            hash = (hash ^ (unsigned char)vertex[b]) * 1099511628211ull;
+
+        GLuint target = GLuint(-1);
+        auto range = lookup.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (memcmp(vertices + it->second * vertex_size, vertex, vertex_size) == 0) {
+                target = it->second;
+                break;
+            }
+        }
+
+        if (target == GLuint(-1)) {
+            target = GLuint(unique_count++);
+            if (target != v)
+                memcpy(vertices + target * vertex_size, vertex, vertex_size);
+            lookup.emplace(hash, target);
+        }
+        remap[v] = target;
+    }
+
+    for (auto& idx : indices)
+        idx = remap[idx];
+
+    return unique_count;
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertex_count)
+{
+    const size_t tri_count = indices.size() / 3;
+    if (tri_count == 0)
+        return;
+
+    // vertex to triangle adjacency; each vertex's list shrinks as its triangles are emitted
+    std::vector<unsigned> live(vertex_count, 0);
+    for (auto idx : indices)
+        live[idx]++;
+
+    std::vector<unsigned> offsets(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+
+    std::vector<unsigned> adjacency(indices.size());
+    std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < tri_count; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[3 * t + k]]++] = unsigned(t);
+
+    std::vector<int>   cache_pos(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    for (size_t v = 0; v < vertex_count; v++)
+        vertex_score[v] = VertexScore(-1, live[v]);
+
+    std::vector<float> tri_score(tri_count);
+    for (size_t t = 0; t < tri_count; t++)
+        tri_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] + vertex_score[indices[3 * t + 2]];
+
+    std::vector<bool>   emitted(tri_count, false);
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+
+    std::vector<GLuint> cache, new_cache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    new_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    size_t next_unemitted = 0;
+    int best_tri = -1;
+    for (size_t emitted_count = 0; emitted_count < tri_count; emitted_count++) {
+        if (best_tri < 0) {
+            while (emitted[next_unemitted])
+                next_unemitted++;
+            best_tri = int(next_unemitted);
+        }
+
+        const GLuint* tri = &indices[3 * best_tri];
+        result.insert(result.end(), tri, tri + 3);
+        emitted[best_tri] = true;
+
+        for (int k = 0; k < 3; k++) {
+            GLuint v = tri[k];
+            unsigned* begin = &adjacency[offsets[v]];
+            unsigned* end = begin + live[v];
+            unsigned* pos = std::find(begin, end, unsigned(best_tri));
+            *pos = *(end - 1);
+            live[v]--;
+        }
+
+        // the emitted triangle moves to the front of the LRU cache
+        new_cache.assign(tri, tri + 3);
+        for (auto v : cache)
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                new_cache.push_back(v);
+
+        for (size_t i = 0; i < new_cache.size(); i++) {
+            GLuint v = new_cache[i];
+            cache_pos[v] = i < FORSYTH_CACHE_SIZE ? int(i) : -1;
+            vertex_score[v] = VertexScore(cache_pos[v], live[v]);
+        }
+
+        best_tri = -1;
+        float best_score = -1.0f;
+        for (auto v : new_cache) {
+            for (unsigned i = 0; i < live[v]; i++) {
+                unsigned t = adjacency[offsets[v] + i];
+                const GLuint* adj = &indices[3 * t];
+                tri_score[t] = vertex_score[adj[0]] + vertex_score[adj[1]] + vertex_score[adj[2]];
+                if (tri_score[t] > best_score) {
+                    best_score = tri_score[t];
+                    best_tri = int(t);
+                }
+            }
+        }
+
+        if (new_cache.size() > FORSYTH_CACHE_SIZE)
+            new_cache.resize(FORSYTH_CACHE_SIZE);
+        cache.swap(new_cache);
+    }
+
+    indices.swap(result);
+}
+
+void MeshOptimizer::OptimizeOverdraw(std::vector<GLuint>& indices, const char* vertices, size_t vertex_count, size_t vertex_size)
+{
+    const size_t tri_count = indices.size() / 3;
+    if (tri_count == 0)
+        return;
+
+    auto position = [&](GLuint v) {
+        const float* p = reinterpret_cast<const float*>(vertices + v * vertex_size);
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+
+    // a triangle whose three vertices all miss the cache starts a new cluster; reordering
+    // whole clusters keeps the vertex cache behaviour of the previous pass
+    std::vector<size_t> cluster_begin;
+    std::vector<unsigned> timestamp(vertex_count, 0);
+    unsigned time = 16 + 1;
+    for (size_t t = 0; t < tri_count; t++) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+            GLuint v = indices[3 * t + k];
+            if (time - timestamp[v] > 16) {
+                timestamp[v] = time++;
+                misses++;
+            }
+        }
+        if (misses == 3 || t == 0)
+            cluster_begin.push_back(t);
+    }
+    cluster_begin.push_back(tri_count);
+
+    glm::vec3 mesh_centroid(0.0f);
+    for (size_t v = 0; v < vertex_count; v++)
+        mesh_centroid += position(GLuint(v));
+    mesh_centroid /= float(vertex_count);
+
+    // clusters facing away from the mesh center are likely occluders and are drawn first
+    const size_t cluster_count = cluster_begin.size() - 1;
+    std::vector<float> sort_key(cluster_count);
+    for (size_t c = 0; c < cluster_count; c++) {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = cluster_begin[c]; t < cluster_begin[c + 1]; t++) {
+            glm::vec3 p0 = position(indices[3 * t]);
+            glm::vec3 p1 = position(indices[3 * t + 1]);
+            glm::vec3 p2 = position(indices[3 * t + 2]);
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float a = glm::length(n);
+            centroid += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float len = glm::length(normal);
+        sort_key[c] = len > 0.0f ? glm::dot(centroid - mesh_centroid, normal / len) : 0.0f;
+    }
+
+    std::vector<size_t> order(cluster_count);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sort_key[a] > sort_key[b]; });
+
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+    for (auto c : order)
+        result.insert(result.end(), indices.begin() + 3 * cluster_begin[c], indices.begin() + 3 * cluster_begin[c + 1]);
+    indices.swap(result);
+}
+
+size_t MeshOptimizer::OptimizeVertexFetch(char* vertices, size_t vertex_count, size_t vertex_size, std::vector<GLuint>& indices)
+{
+    std::vector<GLuint> remap(vertex_count, GLuint(-1));
+    std::vector<char> reordered(vertex_count * vertex_size);
+
+    GLuint next = 0;
+    for (auto& idx : indices) {
+        if (remap[idx] == GLuint(-1)) {
+            memcpy(&reordered[next * vertex_size], vertices + idx * vertex_size, vertex_size);
+            remap[idx] = next++;
+        }
+        idx = remap[idx];
+    }
+
+    memcpy(vertices, reordered.data(), next * vertex_size);
+    return next;
+}
+
+// symmetric 4x4 matrix summing the squared distances to a set of planes
+struct Quadric {
+    Quadric() { memset(a, 0, sizeof(a)); }
+
+    void AddPlane(const glm::dvec3& n, double d, double weight)
+    {
+        double p[4] = { n.x, n.y, n.z, d };
+        int k = 0;
+        for (int i = 0; i < 4; i++) {
+            for (int j = i; j < 4; j++)
+                a[k++] += weight * p[i] * p[j];
+        }
+    }
+
+    void Add(const Quadric& q)
+    {
+        for (int i = 0; i < 10; i++)
+            a[i] += q.a[i];
+    }
+
+    double Evaluate(const glm::vec3& v) const
+    {
+        double x = v.x, y = v.y, z = v.z;
+        double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+                 + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+                 + a[7] * z * z + 2 * a[8] * z
+                 + a[9];
+        return e > 0.0 ? e : 0.0;
+    }
+
+    double a[10];     // upper triangle, row by row
+};
+
+// open edges are kept in place by planes through them, perpendicular to their triangle
+static const double SIMPLIFY_BORDER_WEIGHT = 10.0;
+
+float MeshOptimizer::SimplifyIndices(const std::vector<GLuint>& indices, const char* vertices, size_t vertex_count,
+    size_t vertex_size, size_t target_index_count, std::vector<GLuint>& result)
+{
+    auto position = [&](GLuint v) { return *reinterpret_cast<const glm::vec3*>(vertices + v * vertex_size); };
+    auto edge_key = [](GLuint a, GLuint b) { return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a; };
+
+    std::vector<GLuint> tris(indices);
+    size_t num_tris = tris.size() / 3;
+    std::vector<bool> tri_alive(num_tris, true);
+    std::vector<std::vector<uint32_t>> vertex_tris(vertex_count);
+    std::vector<Quadric> quadrics(vertex_count);
+
+    std::unordered_map<uint64_t, uint32_t> edge_use;
+    for (size_t t = 0; t < num_tris; t++) {
+        for (int k = 0; k < 3; k++) {
+            vertex_tris[tris[3 * t + k]].push_back((uint32_t)t);
+            edge_use[edge_key(tris[3 * t + k], tris[3 * t + (k + 1) % 3])]++;
+        }
+    }
+
+    for (size_t t = 0; t < num_tris; t++) {
+        glm::dvec3 p[3] = { glm::dvec3(position(tris[3 * t])), glm::dvec3(position(tris[3 * t + 1])), glm::dvec3(position(tris[3 * t + 2])) };
+        glm::dvec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+        double len = glm::length(n);
+        if (len == 0.0)
+            continue;
+        n /= len;
+        for (int k = 0; k < 3; k++)
+            quadrics[tris[3 * t + k]].AddPlane(n, -glm::dot(n, p[0]), 1.0);
+
+        for (int k = 0; k < 3; k++) {
+            GLuint a = tris[3 * t + k], b = tris[3 * t + (k + 1) % 3];
+            if (edge_use[edge_key(a, b)] != 1)
+                continue;
+            glm::dvec3 e = p[(k + 1) % 3] - p[k];
+            glm::dvec3 border = glm::cross(e, n);
+            double border_len = glm::length(border);
+            if (border_len == 0.0)
+                continue;
+            border /= border_len;
+            quadrics[a].AddPlane(border, -glm::dot(border, p[k]), SIMPLIFY_BORDER_WEIGHT);
+            quadrics[b].AddPlane(border, -glm::dot(border, p[k]), SIMPLIFY_BORDER_WEIGHT);
+        }
+    }
+
+    // candidates are invalidated lazily: a collapse bumps the version of the vertex it keeps
+    struct Collapse {
+        double   cost;
+        GLuint   from, to;
+        uint32_t from_version, to_version;
+        bool operator>(const Collapse& o) const { return cost > o.cost; }
+    };
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    std::vector<uint32_t> version(vertex_count, 0);
+    std::vector<bool> removed(vertex_count, false);
+
+    auto push = [&](GLuint from, GLuint to) {
+        Quadric q = quadrics[from];
+        q.Add(quadrics[to]);
+        heap.push({ q.Evaluate(position(to)), from, to, version[from], version[to] });
+    };
+    for (size_t t = 0; t < num_tris; t++) {
+        for (int k = 0; k < 3; k++) {
+            push(tris[3 * t + k], tris[3 * t + (k + 1) % 3]);
+            push(tris[3 * t + (k + 1) % 3], tris[3 * t + k]);
+        }
+    }
+
+    size_t alive = num_tris;
+    double max_cost = 0.0;
+    while (alive * 3 > target_index_count && !heap.empty()) {
+        Collapse c = heap.top();
+        heap.pop();
+        if (removed[c.from] || removed[c.to] || version[c.from] != c.from_version || version[c.to] != c.to_version)
+            continue;
+
+        // reject collapses that flip a remaining triangle or that no longer follow an edge
+        bool shares_edge = false, flips = false;
+        glm::vec3 target = position(c.to);
+        for (uint32_t t : vertex_tris[c.from]) {
+            if (!tri_alive[t])
+                continue;
+            GLuint* tri = &tris[3 * t];
+            if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+                shares_edge = true;
+                continue;
+            }
+            glm::vec3 p[3], q[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = position(tri[k]);
+                q[k] = tri[k] == c.from ? target : p[k];
+            }
+            glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if (glm::dot(n0, n1) <= 0.0f) {
+                flips = true;
+                break;
+            }
+        }
+        if (!shares_edge || flips)
+            continue;
+
+        for (uint32_t t : vertex_tris[c.from]) {
+            if (!tri_alive[t])
+                continue;
+            GLuint* tri = &tris[3 * t];
+            if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+                tri_alive[t] = false;
+                alive--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                if (tri[k] == c.from)
+                    tri[k] = c.to;
+            }
+            vertex_tris[c.to].push_back(t);
+        }
+        quadrics[c.to].Add(quadrics[c.from]);
+        removed[c.from] = true;
+        version[c.to]++;
+        max_cost = std::max(max_cost, c.cost);
+
+        // drop dead triangles so the lists of much collapsed vertices stay short
+        auto& around = vertex_tris[c.to];
+        around.erase(std::remove_if(around.begin(), around.end(), [&](uint32_t t) { return !tri_alive[t]; }), around.end());
+        for (uint32_t t : around) {
+            for (int k = 0; k < 3; k++) {
+                GLuint w = tris[3 * t + k];
+                if (w != c.to) {
+                    push(c.to, w);
+                    push(w, c.to);
+                }
+            }
+        }
+    }
+
+    result.clear();
+    result.reserve(alive * 3);
+    for (size_t t = 0; t < num_tris; t++) {
+        if (tri_alive[t])
+            result.insert(result.end(), tris.begin() + 3 * t, tris.begin() + 3 * t + 3);
+    }
+    return (float)sqrt(max_cost);
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertex_count, unsigned cache_size)
+{
+    std::vector<unsigned> timestamp(vertex_count, 0);
+    std::vector<bool> referenced(vertex_count, false);
+    unsigned time = cache_size + 1;
+    size_t misses = 0, unique = 0;
+
+    for (auto v : indices) {
+        if (time - timestamp[v] > cache_size) {
+            timestamp[v] = time++;
+            misses++;
+        }
+        if (!referenced[v]) {
+            referenced[v] = true;
+            unique++;
+        }
+    }
+
+    CacheStats stats;
+    stats.acmr = indices.empty() ? 0.0f : float(misses) / float(indices.size() / 3);
+    stats.atvr = unique == 0 ? 0.0f : float(misses) / float(unique);
+    return stats;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+
+// Index and vertex buffer optimizations run at mesh import time. All functions
+// work on packed interleaved vertices with the position as three floats at offset 0.
+class MeshOptimizer {
+public:
+    struct CacheStats {
+        float acmr;     // average cache miss ratio, misses per triangle
+        float atvr;     // average transformed vertex ratio, misses per vertex
+    };
+
+    // merges bitwise identical vertices in place and returns the new vertex count
+    static size_t     WeldVertices(char* vertices, size_t vertex_count, size_t vertex_size, std::vector<GLuint>& indices);
+
+    // reorders triangles for post-transform cache reuse (Forsyth's linear-speed algorithm)
+    static void       OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertex_count);
+
+    // splits the cache optimized order into clusters and sorts them front to back by facing (Tipsify-style)
+    static void       OptimizeOverdraw(std::vector<GLuint>& indices, const char* vertices, size_t vertex_count, size_t vertex_size);
+
+    // remaps vertices into first-use order, drops unreferenced ones and returns the new vertex count
+    static size_t     OptimizeVertexFetch(char* vertices, size_t vertex_count, size_t vertex_size, std::vector<GLuint>& indices);
+
+    // collapses edges in order of their quadric error (Garland-Heckbert) until at most
+    // 'target_index_count' indices are left or no collapse keeps the surface from folding over.
+    // Vertices only move onto one of their neighbours, so the result indexes the same vertices.
+    // Returns the error of the worst collapse as a distance in position units
+    static float      SimplifyIndices(const std::vector<GLuint>& indices, const char* vertices, size_t vertex_count,
+                                      size_t vertex_size, size_t target_index_count, std::vector<GLuint>& result);
+
+    // simulates a FIFO post-transform cache of the given size
+    static CacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertex_count, unsigned cache_size = 16);
+};
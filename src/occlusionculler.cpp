@@ -0,0 +1,230 @@
+#include "occlusionculler.h"
+#include "jobsystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+// occluder sets below this many triangles are rasterized on the calling thread
+static const size_t PARALLEL_RASTER_THRESHOLD = 2048;
+
+OcclusionCuller::OcclusionCuller()
+    : _depth(WIDTH * HEIGHT, 1.0f),
+    _blockMaxDepth(BLOCKS_X * BLOCKS_Y, 1.0f),
+    _bins(TILES_X * TILES_Y),
+    _stats({ 0, 0, 0, 0, 0.0f })
+{
+}
+
+void OcclusionCuller::Begin(const glm::mat4& view_proj)
+{
+    _viewProj = view_proj;
+    _triangles.clear();
+    for (auto& bin : _bins)
+        bin.clear();
+    _stats = { 0, 0, 0, 0, 0.0f };
+}
+
+void OcclusionCuller::AddOccluder(const OccluderMesh& mesh, const glm::mat4& model)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    glm::mat4 mvp = _viewProj * model;
+    _clip.resize(mesh.positions.size());
+    for (size_t i = 0; i < mesh.positions.size(); i++)
+        _clip[i] = mvp * glm::vec4(mesh.positions[i], 1.0f);
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        const glm::vec4* v[3] = { &_clip[mesh.indices[i]], &_clip[mesh.indices[i + 1]], &_clip[mesh.indices[i + 2]] };
+
+        // there is no clipping; a triangle reaching behind the near plane only loses its occlusion
+        if (v[0]->z < -v[0]->w || v[1]->z < -v[1]->w || v[2]->z < -v[2]->w ||
+            v[0]->w <= 0.0f || v[1]->w <= 0.0f || v[2]->w <= 0.0f)
+            continue;
+
+        float x[3], y[3], z[3];
+        for (int k = 0; k < 3; k++) {
+            float inv_w = 1.0f / v[k]->w;
+            x[k] = (v[k]->x * inv_w * 0.5f + 0.5f) * WIDTH;
+            y[k] = (v[k]->y * inv_w * 0.5f + 0.5f) * HEIGHT;
+            z[k] = v[k]->z * inv_w;
+        }
+        if (z[0] > 1.0f && z[1] > 1.0f && z[2] > 1.0f)
+            continue;
+
+        // both windings occlude; counter-clockwise order keeps the inside of every edge positive
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (!(fabsf(area) > 0.0f) || !std::isfinite(area))
+            continue;
+        if (area < 0.0f) {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        float min_x = std::max(0.0f, std::floor(std::min(x[0], std::min(x[1], x[2]))));
+        float max_x = std::min(float(WIDTH - 1), std::floor(std::max(x[0], std::max(x[1], x[2]))));
+        float min_y = std::max(0.0f, std::floor(std::min(y[0], std::min(y[1], y[2]))));
+        float max_y = std::min(float(HEIGHT - 1), std::floor(std::max(y[0], std::max(y[1], y[2]))));
+        if (min_x > max_x || min_y > max_y)
+            continue;
+
+        Triangle t;
+        t.x0 = x[0];
+        t.y0 = y[0];
+        t.z0 = z[0];
+        t.dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+        t.dzdy = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+        for (int e = 0; e < 3; e++) {
+            int a = e, b = (e + 1) % 3;
+            t.edge[e][0] = -(y[b] - y[a]);
+            t.edge[e][1] = x[b] - x[a];
+            t.edge[e][2] = (y[b] - y[a]) * x[a] - (x[b] - x[a]) * y[a];
+        }
+        t.min_x = (int)min_x;
+        t.max_x = (int)max_x;
+        t.min_y = (int)min_y;
+        t.max_y = (int)max_y;
+
+        uint32_t index = (uint32_t)_triangles.size();
+        _triangles.push_back(t);
+        for (int ty = t.min_y / TILE_HEIGHT; ty <= t.max_y / TILE_HEIGHT; ty++) {
+            for (int tx = t.min_x / TILE_WIDTH; tx <= t.max_x / TILE_WIDTH; tx++)
+                _bins[ty * TILES_X + tx].push_back(index);
+        }
+    }
+    _stats.occluders++;
+    _stats.raster_ms += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void OcclusionCuller::RasterizeTile(int tile)
+{
+    const int tile_x = (tile % TILES_X) * TILE_WIDTH;
+    const int tile_y = (tile / TILES_X) * TILE_HEIGHT;
+    for (int y = tile_y; y < tile_y + TILE_HEIGHT; y++)
+        std::fill(&_depth[y * WIDTH + tile_x], &_depth[y * WIDTH + tile_x + TILE_WIDTH], 1.0f);
+
+    for (auto index : _bins[tile]) {
+        const Triangle& t = _triangles[index];
+        // spans start on a multiple of four, and tiles are a multiple of four wide
+        int x0 = std::max(t.min_x, tile_x) & ~3;
+        int x1 = std::min(t.max_x, tile_x + TILE_WIDTH - 1);
+        int y0 = std::max(t.min_y, tile_y);
+        int y1 = std::min(t.max_y, tile_y + TILE_HEIGHT - 1);
+
+        for (int y = y0; y <= y1; y++) {
+            float py = y + 0.5f;
+            float* row = &_depth[y * WIDTH];
+            float e0 = t.edge[0][1] * py + t.edge[0][2];
+            float e1 = t.edge[1][1] * py + t.edge[1][2];
+            float e2 = t.edge[2][1] * py + t.edge[2][2];
+            float zy = t.z0 + t.dzdy * (py - t.y0) - t.dzdx * t.x0;
+#ifdef OCCLUSION_SSE2
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 a0 = _mm_set1_ps(t.edge[0][0]), a1 = _mm_set1_ps(t.edge[1][0]), a2 = _mm_set1_ps(t.edge[2][0]);
+            const __m128 c0 = _mm_set1_ps(e0), c1 = _mm_set1_ps(e1), c2 = _mm_set1_ps(e2);
+            const __m128 dzdx = _mm_set1_ps(t.dzdx), zrow = _mm_set1_ps(zy);
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x0), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+            const __m128 step = _mm_set1_ps(4.0f);
+            for (int x = x0; x <= x1; x += 4, px = _mm_add_ps(px, step)) {
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), c0), zero),
+                                _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), c1), zero),
+                                           _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), c2), zero)));
+                __m128 z = _mm_add_ps(zrow, _mm_mul_ps(dzdx, px));
+                __m128 depth = _mm_loadu_ps(row + x);
+                __m128 closer = _mm_and_ps(inside, _mm_cmplt_ps(z, depth));
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(closer, z), _mm_andnot_ps(closer, depth)));
+            }
+#else
+            for (int x = x0; x <= x1; x++) {
+                float px = x + 0.5f;
+                if (t.edge[0][0] * px + e0 >= 0.0f && t.edge[1][0] * px + e1 >= 0.0f && t.edge[2][0] * px + e2 >= 0.0f)
+                    row[x] = std::min(row[x], zy + t.dzdx * px);
+            }
+#endif
+        }
+    }
+
+    // farthest depth of every block, so a box behind it skips the pixel test
+    for (int by = tile_y / BLOCK_SIZE; by < (tile_y + TILE_HEIGHT) / BLOCK_SIZE; by++) {
+        for (int bx = tile_x / BLOCK_SIZE; bx < (tile_x + TILE_WIDTH) / BLOCK_SIZE; bx++) {
+            float max_depth = 0.0f;
+            for (int y = by * BLOCK_SIZE; y < (by + 1) * BLOCK_SIZE; y++) {
+                const float* row = &_depth[y * WIDTH + bx * BLOCK_SIZE];
+                max_depth = std::max(max_depth, *std::max_element(row, row + BLOCK_SIZE));
+            }
+            _blockMaxDepth[by * BLOCKS_X + bx] = max_depth;
+        }
+    }
+}
+
+void OcclusionCuller::Rasterize()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    const int tiles = TILES_X * TILES_Y;
+    if (_triangles.size() < PARALLEL_RASTER_THRESHOLD) {
+        for (int tile = 0; tile < tiles; tile++)
+            RasterizeTile(tile);
+    }
+    else {
+        // tiles own disjoint pixels, so every tile is a job and idle threads steal the busy ones
+        JobSystem::GetInstance()->ParallelFor(tiles, tiles, [this](uint32_t, uint32_t begin, uint32_t end) {
+            for (uint32_t tile = begin; tile < end; tile++)
+                RasterizeTile((int)tile);
+        });
+    }
+
+    _stats.triangles = (uint32_t)_triangles.size();
+    _stats.raster_ms += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool OcclusionCuller::IsVisible(const AABB& world_bounds) const
+{
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner(i & 1 ? world_bounds.max.x : world_bounds.min.x,
+                         i & 2 ? world_bounds.max.y : world_bounds.min.y,
+                         i & 4 ? world_bounds.max.z : world_bounds.min.z);
+        glm::vec4 clip = _viewProj * glm::vec4(corner, 1.0f);
+        // boxes reaching the near plane are too close to be occluded
+        if (clip.w <= 0.0f || clip.z < -clip.w)
+            return true;
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        lo = glm::min(lo, ndc);
+        hi = glm::max(hi, ndc);
+    }
+    if (lo.z > 1.0f)
+        return true;
+
+    // every pixel the box touches, not only the pixel centers it covers
+    int x0 = (int)std::max(0.0f, std::floor((lo.x * 0.5f + 0.5f) * WIDTH));
+    int x1 = (int)std::min(float(WIDTH - 1), std::floor((hi.x * 0.5f + 0.5f) * WIDTH));
+    int y0 = (int)std::max(0.0f, std::floor((lo.y * 0.5f + 0.5f) * HEIGHT));
+    int y1 = (int)std::min(float(HEIGHT - 1), std::floor((hi.y * 0.5f + 0.5f) * HEIGHT));
+    if (x0 > x1 || y0 > y1)
+        return true;
+
+    for (int by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
+        for (int bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
+            if (lo.z > _blockMaxDepth[by * BLOCKS_X + bx])
+                continue;
+            int py1 = std::min(y1, (by + 1) * BLOCK_SIZE - 1);
+            int px1 = std::min(x1, (bx + 1) * BLOCK_SIZE - 1);
+            for (int y = std::max(y0, by * BLOCK_SIZE); y <= py1; y++) {
+                for (int x = std::max(x0, bx * BLOCK_SIZE); x <= px1; x++) {
+                    if (_depth[y * WIDTH + x] >= lo.z)
+                        return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "frustum.h"
+
+#include <vector>
+
+// triangles an occluder rasterizes, in the space its model matrix transforms from
+struct OccluderMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t>  indices;
+};
+
+// CPU occlusion culling against a low resolution depth buffer. Occluders are rasterized
+// with SSE2 into screen tiles in parallel, each tile keeping the farthest depth of its
+// 8x8 blocks; bounding boxes are rejected by those blocks first and by pixels after.
+class OcclusionCuller {
+public:
+    static const int WIDTH       = 256;
+    static const int HEIGHT      = 160;
+    static const int TILE_WIDTH  = 64;
+    static const int TILE_HEIGHT = 32;
+    static const int BLOCK_SIZE  = 8;
+
+    struct Stats {
+        uint32_t occluders;
+        uint32_t triangles;         // occluder triangles rasterized
+        uint32_t tested;
+        uint32_t occluded;
+        float    raster_ms;
+    };
+
+    OcclusionCuller();
+
+    // clears the depth buffer for a new view projection
+    void         Begin(const glm::mat4& view_proj);
+    // transforms and bins the triangles of an occluder; triangles crossing the near plane are skipped
+    void         AddOccluder(const OccluderMesh& mesh, const glm::mat4& model);
+    // rasterizes the binned triangles and builds the block depths
+    void         Rasterize();
+    // false if every pixel the box covers is behind an occluder; safe to call from several threads
+    bool         IsVisible(const AABB& world_bounds) const;
+    // adds the tests made with IsVisible to the stats
+    void         CountTests(uint32_t tested, uint32_t occluded) { _stats.tested += tested; _stats.occluded += occluded; }
+    const Stats& GetStats() const { return _stats; }
+
+private:
+    struct Triangle {
+        float x0, y0, z0;
+        float dzdx, dzdy;
+        float edge[3][3];           // a * x + b * y + c >= 0 inside
+        int   min_x, min_y, max_x, max_y;
+    };
+
+    void         RasterizeTile(int tile);
+
+    static const int TILES_X  = WIDTH / TILE_WIDTH;
+    static const int TILES_Y  = HEIGHT / TILE_HEIGHT;
+    static const int BLOCKS_X = WIDTH / BLOCK_SIZE;
+    static const int BLOCKS_Y = HEIGHT / BLOCK_SIZE;
+
+    glm::mat4                          _viewProj;
+    std::vector<float>                 _depth;          // NDC depth, 1 is the far plane
+    std::vector<float>                 _blockMaxDepth;
+    std::vector<Triangle>              _triangles;
+    std::vector<std::vector<uint32_t>> _bins;           // triangles overlapping each tile
+    std::vector<glm::vec4>             _clip;
+    Stats                              _stats;
+};
@@ -0,0 +1,265 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+Profiler* Profiler::GetInstance()
+{
+    static Profiler profiler;
+    return &profiler;
+}
+
+Profiler::Profiler()
+    : _enabled(false),
+    _recording(false),
+    _frameIndex(0),
+    _droppedFrames(0),
+    _slot(0),
+    _start(std::chrono::steady_clock::now()),
+    _gpuBase(-1),
+    _cpuAtGpuBase(0)
+{
+    char* val = getenv("GFXLAB_PROFILE");
+    _enabled = val && atoi(val) == 1;
+}
+
+uint64_t Profiler::Now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+void Profiler::BeginFrame()
+{
+    if (!_enabled)
+        return;
+
+    if (_gpuBase < 0) {
+        // aligns the GPU timeline with the CPU one in the trace
+        glGetInteger64v(GL_TIMESTAMP, &_gpuBase);
+        _cpuAtGpuBase = Now();
+    }
+
+    _slot = (_slot + 1) % FRAME_LATENCY;
+    Frame& frame = _frames[_slot];
+    if (frame.pending)
+        Resolve(frame, false);
+
+    frame.index = _frameIndex++;
+    frame.events.clear();
+    frame.pending = true;
+    _stack.clear();
+    _recording = true;
+    Begin("Frame");
+}
+
+void Profiler::EndFrame()
+{
+    if (!_recording)
+        return;
+
+    End();
+    assert(_stack.empty());
+    _recording = false;
+}
+
+void Profiler::Begin(const char* name)
+{
+    Frame& frame = _frames[_slot];
+    Event e;
+    // copied, as names such as render pass names may go away with a reload
+    e.name = _names.insert(name).first->c_str();
+    e.depth = (uint32_t)_stack.size();
+    e.cpu_begin = Now();
+    e.cpu_end = e.cpu_begin;
+    e.gpu_begin = e.gpu_end = 0;
+    e.draws = 0;
+    e.triangles = 0;
+
+    size_t q = frame.events.size() * 2;
+    if (frame.queries.size() < q + 2) {
+        frame.queries.resize(q + 2);
+        glGenQueries(2, &frame.queries[q]);
+    }
+    glQueryCounter(frame.queries[q], GL_TIMESTAMP);
+
+    _stack.push_back((uint32_t)frame.events.size());
+    frame.events.push_back(e);
+}
+
+void Profiler::End()
+{
+    Frame& frame = _frames[_slot];
+    uint32_t idx = _stack.back();
+    _stack.pop_back();
+    glQueryCounter(frame.queries[idx * 2 + 1], GL_TIMESTAMP);
+    frame.events[idx].cpu_end = Now();
+}
+
+void Profiler::CountDraw(uint64_t triangles)
+{
+    Frame& frame = _frames[_slot];
+    for (auto idx : _stack) {
+        frame.events[idx].draws++;
+        frame.events[idx].triangles += triangles;
+    }
+}
+
+void Profiler::Resolve(Frame& frame, bool wait)
+{
+    frame.pending = false;
+    if (frame.events.empty())
+        return;
+
+    // the end of the frame scope is the last query of the frame
+    GLuint available = GL_FALSE;
+    if (wait)
+        available = GL_TRUE;
+    else
+        glGetQueryObjectuiv(frame.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        _droppedFrames++;
+        return;
+    }
+
+    for (size_t i = 0; i < frame.events.size(); i++) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(frame.queries[i * 2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+        frame.events[i].gpu_begin = begin;
+        frame.events[i].gpu_end = end;
+    }
+
+    if (_history.size() == MAX_HISTORY_FRAMES)
+        _history.pop_front();
+    _history.push_back({ frame.index, frame.events });
+}
+
+void Profiler::Shutdown()
+{
+    if (!_enabled)
+        return;
+
+    for (int i = 1; i <= FRAME_LATENCY; i++) {
+        Frame& frame = _frames[(_slot + i) % FRAME_LATENCY];
+        if (frame.pending)
+            Resolve(frame, true);
+    }
+    for (auto& frame : _frames) {
+        if (!frame.queries.empty())
+            glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+        frame.queries.clear();
+    }
+
+    PrintSummary(std::cout);
+
+    char* val = getenv("GFXLAB_PROFILE_TRACE");
+    std::string file = val ? val : "gfxlab_trace.json";
+    if (WriteChromeTrace(file))
+        std::cout << "profiler trace written to " << file << std::endl;
+    _enabled = false;
+}
+
+static std::string EscapeJSON(const char* str)
+{
+    std::string out;
+    for (const char* c = str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            out += '\\';
+        out += *c;
+    }
+    return out;
+}
+
+bool Profiler::WriteChromeTrace(const std::string& file) const
+{
+    std::ofstream out(file);
+    if (!out.is_open()) {
+        std::cout << "failed to write " << file << std::endl;
+        return false;
+    }
+
+    // complete ('X') events in microseconds, CPU scopes on thread 0 and GPU scopes on thread 1
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}";
+    out << std::fixed << std::setprecision(3);
+    for (auto& frame : _history) {
+        for (auto& e : frame.events) {
+            std::string name = EscapeJSON(e.name);
+            out << ",\n{\"name\":\"" << name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0"
+                << ",\"ts\":" << e.cpu_begin / 1000.0 << ",\"dur\":" << (e.cpu_end - e.cpu_begin) / 1000.0
+                << ",\"args\":{\"frame\":" << frame.index << ",\"draws\":" << e.draws << ",\"triangles\":" << e.triangles << "}}";
+
+            double gpu_ts = (double(int64_t(e.gpu_begin) - _gpuBase) + double(_cpuAtGpuBase)) / 1000.0;
+            out << ",\n{\"name\":\"" << name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":1"
+                << ",\"ts\":" << gpu_ts << ",\"dur\":" << (e.gpu_end - e.gpu_begin) / 1000.0
+                << ",\"args\":{\"frame\":" << frame.index << "}}";
+        }
+    }
+    out << "\n]}\n";
+    return bool(out);
+}
+
+void Profiler::PrintSummary(std::ostream& out) const
+{
+    struct Samples {
+        size_t              order;
+        std::vector<double> cpu;
+        std::vector<double> gpu;
+        uint64_t            draws;
+        uint64_t            triangles;
+    };
+
+    // scopes are identified by their path, so the same name in different passes stays apart
+    std::map<std::string, Samples> scopes;
+    std::vector<std::string> path;
+    for (auto& frame : _history) {
+        for (auto& e : frame.events) {
+            path.resize(e.depth);
+            path.push_back((e.depth ? path.back() + "/" : std::string()) + e.name);
+            auto& s = scopes[path.back()];
+            if (s.cpu.empty()) {
+                s.order = scopes.size();
+                s.draws = s.triangles = 0;
+            }
+            s.cpu.push_back((e.cpu_end - e.cpu_begin) / 1e6);
+            s.gpu.push_back((e.gpu_end - e.gpu_begin) / 1e6);
+            s.draws += e.draws;
+            s.triangles += e.triangles;
+        }
+    }
+
+    std::vector<std::pair<std::string, Samples*>> sorted;
+    for (auto& it : scopes)
+        sorted.push_back({ it.first, &it.second });
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Samples*>& a, const std::pair<std::string, Samples*>& b) {
+        return a.second->order < b.second->order;
+    });
+
+    auto percentile = [](std::vector<double>& v, double p) {
+        size_t i = std::min(v.size() - 1, size_t(p * (v.size() - 1) + 0.5));
+        std::nth_element(v.begin(), v.begin() + i, v.end());
+        return v[i];
+    };
+
+    out << "profiled " << _history.size() << " frames (" << _droppedFrames << " dropped), times in ms\n";
+    out << std::left << std::setw(48) << "scope" << std::right
+        << std::setw(8) << "cpu p50" << std::setw(8) << "p95" << std::setw(8) << "p99"
+        << std::setw(9) << "gpu p50" << std::setw(8) << "p95" << std::setw(8) << "p99"
+        << std::setw(10) << "draws" << std::setw(12) << "triangles" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (auto& it : sorted) {
+        Samples& s = *it.second;
+        double calls = double(s.cpu.size());
+        out << std::left << std::setw(48) << it.first << std::right
+            << std::setw(8) << percentile(s.cpu, 0.5) << std::setw(8) << percentile(s.cpu, 0.95) << std::setw(8) << percentile(s.cpu, 0.99)
+            << std::setw(9) << percentile(s.gpu, 0.5) << std::setw(8) << percentile(s.gpu, 0.95) << std::setw(8) << percentile(s.gpu, 0.99)
+            << std::setprecision(1) << std::setw(10) << s.draws / calls << std::setw(12) << s.triangles / calls
+            << std::setprecision(3) << "\n";
+    }
+    out.unsetf(std::ios::floatfield);
+    out << std::flush;
+}
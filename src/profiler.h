@@ -0,0 +1,115 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <deque>
+#include <ostream>
+
+// Hierarchical CPU and GPU profiler. Scopes nest; each one records its CPU time, a pair of
+// GL_TIMESTAMP queries and the draw calls and triangles submitted while it was open. A frame's
+// queries are read back FRAME_LATENCY frames later, so the profiler never waits on the GPU;
+// a frame whose results are still not available then is dropped.
+//
+// Build with GFXLAB_PROFILER defined and run with GFXLAB_PROFILE=1 to enable it. On exit the
+// recorded frames are summarized with per-scope percentiles and written as Chrome trace events
+// to GFXLAB_PROFILE_TRACE, or gfxlab_trace.json.
+class Profiler {
+public:
+    struct Event {
+        const char* name;          // interned by the profiler
+        uint32_t    depth;
+        uint64_t    cpu_begin;     // ns since the profiler was created
+        uint64_t    cpu_end;
+        uint64_t    gpu_begin;     // ns on the GL timeline
+        uint64_t    gpu_end;
+        uint32_t    draws;
+        uint64_t    triangles;
+    };
+
+    class Scope {
+    public:
+        Scope(const char* name) : _active(Profiler::GetInstance()->IsRecording())
+        {
+            if (_active)
+                Profiler::GetInstance()->Begin(name);
+        }
+        ~Scope()
+        {
+            if (_active)
+                Profiler::GetInstance()->End();
+        }
+    private:
+        bool _active;
+    };
+
+    static const int    FRAME_LATENCY = 3;
+    static const size_t MAX_HISTORY_FRAMES = 2000;
+
+    static Profiler* GetInstance();
+
+    void      Enable(bool enable)     { _enabled = enable; }
+    bool      IsEnabled() const       { return _enabled; }
+    bool      IsRecording() const     { return _recording; }
+
+    void      BeginFrame();
+    void      EndFrame();
+    void      Begin(const char* name);
+    void      End();
+    // adds a draw call to every open scope
+    void      CountDraw(uint64_t triangles);
+
+    // reads back the outstanding frames, prints the summary and writes the trace
+    void      Shutdown();
+    bool      WriteChromeTrace(const std::string& file) const;
+    void      PrintSummary(std::ostream& out) const;
+
+private:
+    Profiler();
+
+    struct Frame {
+        Frame() : index(0), pending(false) {}
+        uint64_t            index;
+        std::vector<Event>  events;
+        std::vector<GLuint> queries;     // begin and end timestamp of events[i] at 2i and 2i+1
+        bool                pending;
+    };
+
+    struct RecordedFrame {
+        uint64_t            index;
+        std::vector<Event>  events;
+    };
+
+    void      Resolve(Frame& frame, bool wait);
+    uint64_t  Now() const;
+
+    bool                                      _enabled;
+    bool                                      _recording;
+    uint64_t                                  _frameIndex;
+    uint64_t                                  _droppedFrames;
+    int                                       _slot;
+    Frame                                     _frames[FRAME_LATENCY];
+    std::vector<uint32_t>                     _stack;
+    // every scope name seen; set nodes keep their address, so events point into them
+    std::unordered_set<std::string>           _names;
+    std::deque<RecordedFrame>                 _history;
+    std::chrono::steady_clock::time_point     _start;
+    int64_t                                   _gpuBase;
+    uint64_t                                  _cpuAtGpuBase;
+};
+
+#ifdef GFXLAB_PROFILER
+#define PROFILE_CONCAT_IMPL(a, b)      a##b
+#define PROFILE_CONCAT(a, b)           PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name)            Profiler::Scope PROFILE_CONCAT(_profile_scope_, __LINE__)(name)
+#define PROFILE_BEGIN_FRAME()          Profiler::GetInstance()->BeginFrame()
+#define PROFILE_END_FRAME()            Profiler::GetInstance()->EndFrame()
+#define PROFILE_COUNT_DRAW(triangles)  do { if (Profiler::GetInstance()->IsRecording()) Profiler::GetInstance()->CountDraw(triangles); } while (0)
+#define PROFILE_SHUTDOWN()             Profiler::GetInstance()->Shutdown()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_BEGIN_FRAME()
+#define PROFILE_END_FRAME()
+#define PROFILE_COUNT_DRAW(triangles)
+#define PROFILE_SHUTDOWN()
+#endif
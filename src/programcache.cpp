@@ -0,0 +1,163 @@
+#include "programcache.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+const uint32_t ProgramCache::MAGIC   = 0x50434647; // "GFCP"
+const uint32_t ProgramCache::VERSION = 1;
+
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// creates 'dir' and the folders leading to it
+static void CreateDirectories(const std::string& dir)
+{
+    for (size_t pos = dir.find_first_of("/\\", 1); ; pos = dir.find_first_of("/\\", pos + 1)) {
+        std::string part = dir.substr(0, pos);
+#ifdef _WIN32
+        _mkdir(part.c_str());
+#else
+        mkdir(part.c_str(), 0755);
+#endif
+        if (pos == std::string::npos)
+            break;
+    }
+}
+
+std::string ProgramCache::GetDefaultDir()
+{
+    // binaries are tied to the machine's driver, so they go to the user's cache and not
+    // next to the shaders in the source tree
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (base && *base)
+        return std::string(base) + "/gfxlab/programcache";
+#else
+    const char* base = getenv("XDG_CACHE_HOME");
+    if (base && *base)
+        return std::string(base) + "/gfxlab/programcache";
+    const char* home = getenv("HOME");
+    if (home && *home)
+        return std::string(home) + "/.cache/gfxlab/programcache";
+#endif
+    return "programcache";
+}
+
+static uint64_t HashString(uint64_t hash, const std::string& str)
+{
+    // the length separates consecutive strings
+    uint64_t length = str.size();
+    hash = HashBytes(hash, &length, sizeof(length));
+    return HashBytes(hash, str.data(), str.size());
+}
+
+bool ProgramCache::Supported()
+{
+    if (!GLEW_ARB_get_program_binary)
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+uint64_t ProgramCache::ComputeKey(const std::vector<std::string>& stages, const std::vector<std::string>& sources,
+    const std::vector<std::string>& defines)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const GLenum driver_strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (auto name : driver_strings) {
+        const char* str = reinterpret_cast<const char*>(glGetString(name));
+        hash = HashString(hash, str ? str : "");
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        hash = HashString(hash, stages[i]);
+        hash = HashString(hash, sources[i]);
+    }
+    for (auto& d : defines)
+        hash = HashString(hash, d);
+    return hash;
+}
+
+std::string ProgramCache::GetEntryPath(const std::string& dir, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.gfxprog", (unsigned long long)key);
+    return dir + "/" + name;
+}
+
+bool ProgramCache::Load(const std::string& dir, uint64_t key, GLuint program)
+{
+    std::ifstream in(GetEntryPath(dir, key), std::ios::binary);
+    if (!in.is_open())
+        return false;
+
+    Header header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || header.magic != MAGIC || header.version != VERSION || header.key != key || header.size == 0)
+        return false;
+
+    std::vector<char> binary(header.size);
+    in.read(binary.data(), header.size);
+    if (!in)
+        return false;
+
+    glProgramBinary(program, header.format, binary.data(), (GLsizei)header.size);
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success == GL_TRUE;
+}
+
+bool ProgramCache::Store(const std::string& dir, uint64_t key, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    std::vector<char> binary(length);
+    Header header;
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.key = key;
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+    header.format = format;
+    header.size = (uint32_t)length;
+
+    CreateDirectories(dir);
+
+    // same temporary file and rename scheme as the mesh cache
+    std::string path = GetEntryPath(dir, key);
+    std::string tmp_path = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cout << "failed to write program cache " << path << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(binary.data(), binary.size());
+    out.close();
+
+    if (!out) {
+        std::remove(tmp_path.c_str());
+        std::cout << "failed to write program cache " << path << std::endl;
+        return false;
+    }
+
+    std::remove(path.c_str());
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+
+// On-disk cache of linked program binaries. Entries are keyed by a hash of the shader stages and
+// sources, the defines and the GL vendor, renderer and version strings, so a driver update or
+// an edited shader simply misses. A binary the driver refuses is treated as a miss as well.
+class ProgramCache {
+public:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;
+        uint32_t size;
+    };
+
+    static const uint32_t MAGIC;
+    static const uint32_t VERSION;
+
+    // GL_ARB_get_program_binary is available and the driver offers at least one binary format
+    static bool        Supported();
+    // 'stages' and 'sources' are parallel, the stage is the shader file suffix
+    static uint64_t    ComputeKey(const std::vector<std::string>& stages, const std::vector<std::string>& sources,
+                                  const std::vector<std::string>& defines);
+    // restores 'program' from the entry of 'key'; false if missing, stale or rejected
+    static bool        Load(const std::string& dir, uint64_t key, GLuint program);
+    static bool        Store(const std::string& dir, uint64_t key, GLuint program);
+    // per-user cache folder, or a 'programcache' folder in the working directory without one
+    static std::string GetDefaultDir();
+
+private:
+    static std::string GetEntryPath(const std::string& dir, uint64_t key);
+};
@@ -4,6 +4,9 @@
 #include "camera.h"
 #include "rendererfactory.h"
 #include "renderpass.h"
+#include "resourcemanager.h"
+#include "texturestreamer.h"
+#include "profiler.h"
 
 #include <unordered_set>
 
@@ -11,27 +14,155 @@ Renderer::Renderer()
     :_globalCallback(nullptr),
     _perFrameCallback(nullptr),
     _perProgramCallback(nullptr),
-    _perGeometryCallback(nullptr)
+    _perGeometryCallback(nullptr),
+    _stateStats({ 0, 0 }),
+    _printStateStats(false),
+    _printMeshletStats(false),
+    _printOcclusionStats(false),
+    _occlusionFrame(~0ull),
+    _frameCount(0)
 {
+    char* val = getenv("GFXLAB_GL_STATE_STATS");
+    _printStateStats = val && atoi(val) == 1;
+    // GFXLAB_MESHLET_STATS=1 prints the meshlet culling of every mesh built with meshlets
+    val = getenv("GFXLAB_MESHLET_STATS");
+    _printMeshletStats = val && atoi(val) == 1;
+    val = getenv("GFXLAB_OCCLUSION_STATS");
+    _printOcclusionStats = val && atoi(val) == 1;
+
     RendererFactory::RegisterRenderer<Renderer>("Default");
 }
 
+void Renderer::AddShaderProgram(const std::string name, GLuint id)
+{
+    _renderStates.programs[name] = id;
+    _renderStates.reverse_program_lookup[id] = name;
+    _renderStates.program_states[id] = ResourceManager::GetInstance()->GetProgramStates(id);
+}
+
+void Renderer::ReplaceRenderPass(size_t i, RenderPassPtr renderpass)
+{
+    _renderpasses[i] = std::move(renderpass);
+}
+
+void Renderer::ClearRenderPasses()
+{
+    _renderpasses.clear();
+}
+
 void Renderer::Initialize()
 {
+    _frameUniforms.Initialize();
+    GeometryArena::ResetObjectTransform();
+    _renderStates.uniform_buffer_objects.push_back(_frameUniforms.GetBuffer());
+    ResolveAttachmentActions();
+
     if (_globalCallback)
         _globalCallback(_scene, _renderStates);
+    // the callback DLLs bind GL state directly
+    GLStateCache::GetInstance()->Invalidate();
 }
 
-void Renderer::Render()
+void Renderer::OnResourcesReloaded(const std::vector<GLuint>& relinked)
+{
+    for (GLuint prog : relinked)
+        _renderStates.program_states[prog] = ResourceManager::GetInstance()->GetProgramStates(prog);
+    ResolveAttachmentActions();
+
+    if (_globalCallback)
+        _globalCallback(_scene, _renderStates);
+    GLStateCache::GetInstance()->Invalidate();
+}
+
+void Renderer::ResolveAttachmentActions()
 {
+    // the pass order is fixed, so which pass first draws into each framebuffer is too
     std::unordered_set<GLuint> fbos;
-    bool needs_clear;
-    GLuint fbo;
+    size_t last_default = _renderpasses.size();
+    for (size_t i = 0; i < _renderpasses.size(); i++) {
+        if (_renderpasses[i]->GetFBO() == 0)
+            last_default = i;
+    }
+    for (size_t i = 0; i < _renderpasses.size(); i++) {
+        bool first_use = fbos.insert(_renderpasses[i]->GetFBO()).second;
+        _renderpasses[i]->ResolveAttachmentActions(first_use, i == last_default);
+    }
+}
+
+void Renderer::Render()
+{
+    PROFILE_BEGIN_FRAME();
+    GLStateCache::GetInstance()->ResetStats();
+    {
+        PROFILE_SCOPE("TextureStreaming");
+        TextureStreamer::GetInstance()->Update();
+    }
+    if (_scene != nullptr) {
+        PROFILE_SCOPE("FrameUniforms");
+        _frameUniforms.Update(_scene);
+    }
+    // all passes record their draw lists before the first one draws, so the GL thread only
+    // replays commands once submission starts
+    {
+        PROFILE_SCOPE("Prepare");
+        for (auto& rp : _renderpasses)
+            rp->Prepare();
+    }
+    for (auto& rp : _renderpasses) {
+        PROFILE_SCOPE(rp->GetName().c_str());
+        rp->Render();
+    }
+    _frameUniforms.EndFrame();
+    PROFILE_END_FRAME();
+    _stateStats = GLStateCache::GetInstance()->GetStats();
+
+    if (_printStateStats && _frameCount % 100 == 0) {
+        std::cout << "GL state changes: " << _stateStats.requested << " requested, " << _stateStats.issued
+                  << " issued, " << (_stateStats.requested - _stateStats.issued) << " skipped" << std::endl;
+    }
+    if (_printOcclusionStats && _frameCount % 100 == 0 && _occlusionFrame == _frameCount) {
+        const OcclusionCuller::Stats& stats = _occlusionCuller.GetStats();
+        printf("[OCCLUSION] %u occluders, %u triangles in %.2f ms, %u of %u tested geometries occluded (%.1f%%)\n",
+            stats.occluders, stats.triangles, stats.raster_ms, stats.occluded, stats.tested,
+            stats.tested ? 100.0f * stats.occluded / stats.tested : 0.0f);
+    }
+    if (_printMeshletStats && _frameCount % 100 == 0 && _scene != nullptr) {
+        for (auto& g : _scene->GetGeometries()) {
+            const MeshletStats* stats = g->GetMeshletStats();
+            if (stats == nullptr || stats->meshlets == 0)
+                continue;
+            printf("[MESHLET] %s: %u of %u visible, %u frustum culled, %u backface culled (%.1f%% culled)\n",
+                g->GetName().c_str(), stats->visible, stats->meshlets, stats->frustum_culled, stats->backface_culled,
+                100.0f * (stats->meshlets - stats->visible) / stats->meshlets);
+        }
+    }
+    _frameCount++;
+}
+
+OcclusionCuller& Renderer::PrepareOcclusionCulling(const glm::mat4& view_proj, const std::vector<uint8_t>& visible)
+{
+    if (_occlusionFrame == _frameCount && _occlusionViewProj == view_proj)
+        return _occlusionCuller;
+
+    _occlusionCuller.Begin(view_proj);
+    for (auto& g : _scene->GetGeometries()) {
+        const OccluderMesh* occluder = g->GetOccluderMesh();
+        int32_t idx = g->GetSceneIndex();
+        if (occluder != nullptr && (idx < 0 || visible[idx]))
+            _occlusionCuller.AddOccluder(*occluder, g->GetTransformation());
+    }
+    _occlusionCuller.Rasterize();
+    _occlusionViewProj = view_proj;
+    _occlusionFrame = _frameCount;
+    return _occlusionCuller;
+}
+
+void Renderer::GetCullStats(uint32_t& drawn, uint32_t& culled) const
+{
+    drawn = culled = 0;
     for (auto& rp : _renderpasses) {
-        fbo = rp->GetFBO();
-        needs_clear = fbos.find(fbo) == fbos.end();
-        rp->Render(needs_clear);
-        fbos.insert(fbo);
+        drawn += rp->GetCullStats().drawn;
+        culled += rp->GetCullStats().culled;
     }
 }
 
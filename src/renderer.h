@@ -3,6 +3,9 @@
 #include "common.h"
 #include "scene.h"
 #include "renderstatecallbacks.h"
+#include "glstate.h"
+#include "framedata.h"
+#include "occlusionculler.h"
 
 
 
@@ -18,11 +21,15 @@ public:
     void      SetFrameSetStateCallback(SetPerFrameStateCallback cb)       { _perFrameCallback = cb; }
     void      SetProgramSetStateCallback(SetPerProgramStateCallback cb)   { _perProgramCallback = cb; }
     void      SetGeometrySetStateCallback(SetPerGeometryStateCallback cb) { _perGeometryCallback = cb; }
-    void      AddShaderProgram(const std::string name, GLuint id)
-    {
-        _renderStates.programs[name] = id;
-        _renderStates.reverse_program_lookup[id] = name;
-    }
+    void      AddShaderProgram(const std::string name, GLuint id);
+    ScenePtr  GetScene() const                                            { return _scene; }
+    // used by hot reload to rebuild some or all of the render passes
+    size_t    GetRenderPassCount() const                                  { return _renderpasses.size(); }
+    void      ReplaceRenderPass(size_t i, RenderPassPtr renderpass);
+    void      ClearRenderPasses();
+    // refreshes the reflected uniforms of the relinked programs, resolves the attachment actions
+    // of the rebuilt passes and sets the global states again, a relink having reset them
+    void      OnResourcesReloaded(const std::vector<GLuint>& relinked);
     CameraPtr GetCamera()
     {
         if (_scene != nullptr)
@@ -32,6 +39,13 @@ public:
     }
 
 
+    // drawn and culled geometries summed over the render passes of the last frame
+    void      GetCullStats(uint32_t& drawn, uint32_t& culled) const;
+    // GL state calls requested and actually issued during the last frame
+    const GLStateCache::Stats& GetStateStats() const { return _stateStats; }
+    // occluders rasterized and geometries tested against them during the last frame
+    const OcclusionCuller::Stats& GetOcclusionStats() const { return _occlusionCuller.GetStats(); }
+
     virtual void      Initialize();
     virtual void      Render();
     virtual void      Resize(int width, int height);
@@ -39,6 +53,11 @@ public:
 
 
 protected:
+    void      ResolveAttachmentActions();
+    // rasterizes the occluders overlapping the frustum; passes sharing the camera in a frame
+    // reuse the depth buffer
+    OcclusionCuller& PrepareOcclusionCulling(const glm::mat4& view_proj, const std::vector<uint8_t>& visible);
+
     ScenePtr                                              _scene;
     std::vector<RenderPassPtr>                            _renderpasses;
     SetGlobalStateCallback                                _globalCallback;
@@ -46,4 +65,13 @@ protected:
     SetPerProgramStateCallback                            _perProgramCallback;
     SetPerGeometryStateCallback                           _perGeometryCallback;
     RenderStates                                          _renderStates;
+    FrameUniforms                                         _frameUniforms;
+    GLStateCache::Stats                                   _stateStats;
+    bool                                                  _printStateStats;
+    bool                                                  _printMeshletStats;
+    bool                                                  _printOcclusionStats;
+    OcclusionCuller                                       _occlusionCuller;
+    glm::mat4                                             _occlusionViewProj;
+    uint64_t                                              _occlusionFrame;
+    uint64_t                                              _frameCount;
 };
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "rendergraph.h"
+#include "resourcemanager.h"
+
+RenderGraph::RenderGraph()
+    : _aliasing(true),
+    _stats({ 0, 0, 0, 0, 0, 0 })
+{
+}
+
+int RenderGraph::AddPass(const std::string& name)
+{
+    _passes.push_back({ name, {}, {}, false });
+    return int(_passes.size()) - 1;
+}
+
+int RenderGraph::CreateResource(int pass, const std::string& name, const ResourceDesc& desc)
+{
+    _resources.push_back({ name, desc, pass, pass, pass, -1, false });
+    int id = int(_resources.size()) - 1;
+    _passes[pass].writes.push_back(id);
+    return id;
+}
+
+int RenderGraph::FindResource(const std::string& name) const
+{
+    for (size_t i = 0; i < _resources.size(); i++) {
+        if (_resources[i].name == name)
+            return int(i);
+    }
+    return -1;
+}
+
+void RenderGraph::Read(int pass, int resource)
+{
+    _passes[pass].reads.push_back(resource);
+}
+
+size_t RenderGraph::GetByteSize(const ResourceDesc& desc)
+{
+    size_t texel_size;
+    switch (desc.internal_format) {
+    case GL_STENCIL_INDEX:
+    case GL_STENCIL_INDEX8:
+        texel_size = 1;
+        break;
+    default:
+        // RGBA8, 24 bit depth padded to 32 and DEPTH24_STENCIL8
+        texel_size = 4;
+        break;
+    }
+    return size_t(desc.width) * size_t(desc.height) * texel_size;
+}
+
+void RenderGraph::Compile()
+{
+    // culling: passes rendering to the default framebuffer are kept, and so is the producer of
+    // every attachment a kept pass reads
+    std::vector<int> stack;
+    for (size_t p = 0; p < _passes.size(); p++) {
+        _passes[p].culled = !_passes[p].writes.empty();
+        if (!_passes[p].culled)
+            stack.push_back(int(p));
+    }
+    while (!stack.empty()) {
+        int p = stack.back();
+        stack.pop_back();
+        for (int r : _passes[p].reads) {
+            Pass& producer = _passes[_resources[r].producer];
+            if (producer.culled) {
+                producer.culled = false;
+                stack.push_back(_resources[r].producer);
+            }
+        }
+    }
+
+    for (size_t p = 0; p < _passes.size(); p++) {
+        if (_passes[p].culled)
+            continue;
+        for (int r : _passes[p].reads) {
+            Resource& res = _resources[r];
+            res.read = true;
+            if (int(p) <= res.producer) {
+                res.first = 0;
+                res.last = int(_passes.size());
+            }
+            else
+                res.last = std::max(res.last, int(p));
+        }
+    }
+
+    // greedy interval assignment in order of first use
+    std::vector<int> order;
+    for (size_t r = 0; r < _resources.size(); r++) {
+        if (!_passes[_resources[r].producer].culled)
+            order.push_back(int(r));
+    }
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return _resources[a].first < _resources[b].first; });
+
+    _allocations.clear();
+    for (int r : order) {
+        Resource& res = _resources[r];
+        res.allocation = -1;
+        if (_aliasing) {
+            for (size_t a = 0; a < _allocations.size(); a++) {
+                if (_allocations[a].desc == res.desc && _allocations[a].last < res.first) {
+                    res.allocation = int(a);
+                    break;
+                }
+            }
+        }
+        if (res.allocation < 0) {
+            _allocations.push_back({ res.desc, res.last, 0 });
+            res.allocation = int(_allocations.size()) - 1;
+        }
+        else
+            _allocations[res.allocation].last = res.last;
+    }
+
+    _stats = { uint32_t(_passes.size()), 0, uint32_t(_resources.size()), uint32_t(_allocations.size()), 0, 0 };
+    for (auto& p : _passes)
+        _stats.culled_passes += p.culled ? 1 : 0;
+    for (auto& r : _resources)
+        _stats.unaliased_bytes += GetByteSize(r.desc);
+    for (auto& a : _allocations)
+        _stats.aliased_bytes += GetByteSize(a.desc);
+}
+
+void RenderGraph::Realize()
+{
+    for (auto& a : _allocations) {
+        if (a.object != 0)
+            continue;
+        if (a.desc.type == GL_TEXTURE_2D)
+            a.object = ResourceManager::GetInstance()->CreateTexture(GL_TEXTURE_2D, 0, a.desc.internal_format,
+                a.desc.width, a.desc.height, 0, GL_RGBA, GL_UNSIGNED_BYTE);
+        else
+            a.object = ResourceManager::GetInstance()->CreateRenderBuffer(GL_RENDERBUFFER, a.desc.internal_format,
+                a.desc.width, a.desc.height);
+    }
+}
+
+void RenderGraph::Reset()
+{
+    for (auto& a : _allocations) {
+        if (a.object != 0)
+            ResourceManager::GetInstance()->ReleaseFBOAttachment(a.desc.type, a.object);
+    }
+    _allocations.clear();
+    _resources.clear();
+    _passes.clear();
+    _stats = { 0, 0, 0, 0, 0, 0 };
+}
+
+GLuint RenderGraph::GetGLObject(int resource) const
+{
+    int a = _resources[resource].allocation;
+    return a < 0 ? 0 : _allocations[a].object;
+}
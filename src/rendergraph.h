@@ -0,0 +1,89 @@
+#pragma once
+
+#include "common.h"
+
+// Dependency graph of the render passes and the attachments they write and read, compiled
+// before any attachment is created. Passes that neither render to the default framebuffer nor
+// produce an attachment a kept pass reads are culled. Every attachment lives from the pass that
+// writes it to the last pass that reads it; attachments with the same description whose
+// lifetimes do not overlap share one texture or render buffer. An attachment read by a pass
+// that runs before its producer holds the previous frame's content and is never shared.
+class RenderGraph {
+public:
+    struct ResourceDesc {
+        GLenum  type;              // GL_TEXTURE_2D or GL_RENDERBUFFER
+        GLenum  internal_format;
+        GLsizei width;
+        GLsizei height;
+
+        bool operator==(const ResourceDesc& o) const
+        {
+            return type == o.type && internal_format == o.internal_format && width == o.width && height == o.height;
+        }
+    };
+
+    struct Stats {
+        uint32_t passes;
+        uint32_t culled_passes;
+        uint32_t resources;
+        uint32_t allocations;
+        size_t   unaliased_bytes;    // every attachment with its own allocation
+        size_t   aliased_bytes;
+    };
+
+    RenderGraph();
+
+    void          EnableAliasing(bool enable)  { _aliasing = enable; }
+
+    // declared in execution order; a pass without attachments renders to the default framebuffer
+    int           AddPass(const std::string& name);
+    // 'name' is how readers refer to it, e.g. "fbo0.color0"
+    int           CreateResource(int pass, const std::string& name, const ResourceDesc& desc);
+    int           FindResource(const std::string& name) const;
+    void          Read(int pass, int resource);
+
+    void          Compile();
+    // creates one GL object per allocation
+    void          Realize();
+    // releases the GL objects and forgets every pass and resource, so the graph can be declared again
+    void          Reset();
+
+    bool          IsCulled(int pass) const     { return _passes[pass].culled; }
+    // false for attachments no kept pass samples, e.g. most depth buffers
+    bool          IsRead(int resource) const   { return _resources[resource].read; }
+    GLuint        GetGLObject(int resource) const;
+    const ResourceDesc& GetDesc(int resource) const { return _resources[resource].desc; }
+    const Stats&  GetStats() const             { return _stats; }
+
+    static size_t GetByteSize(const ResourceDesc& desc);
+
+private:
+    struct Pass {
+        std::string       name;
+        std::vector<int>  writes;
+        std::vector<int>  reads;
+        bool              culled;
+    };
+
+    struct Resource {
+        std::string   name;
+        ResourceDesc  desc;
+        int           producer;
+        int           first;          // first and last pass using it
+        int           last;
+        int           allocation;
+        bool          read;
+    };
+
+    struct Allocation {
+        ResourceDesc  desc;
+        int           last;           // last pass using its current occupant
+        GLuint        object;
+    };
+
+    bool                     _aliasing;
+    std::vector<Pass>        _passes;
+    std::vector<Resource>    _resources;
+    std::vector<Allocation>  _allocations;
+    Stats                    _stats;
+};
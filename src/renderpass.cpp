@@ -3,15 +3,34 @@
 #include "renderer.h"
 #include "geometry.h"
 #include "resourcemanager.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "camera.h"
+#include "occlusionculler.h"
+#include "jobsystem.h"
+
+#include <cstring>
 
 RenderPass::RenderPass(RendererPtr renderer)
     : _renderer(renderer),
     _fbo(0),
     _useColorBuffer(true),
+    _numColorAttachments(1),
     _useDepthBuffer(true),
     _useStencilBuffer(false),
-    _isBlit(false)
+    _isBlit(false),
+    _cullingEnabled(true),
+    _cullStats({ 0, 0, 0, 0, 0, 0, 0, 0 }),
+    _sortDraws(false),
+    _cull(false),
+    _selectLod(false)
 {
+    for (int i = 0; i < NUM_ATTACHMENTS; i++)
+        _requestedActions[i] = _actions[i] = { LOAD_DEFAULT, STORE_DEFAULT };
+
+    char* val = getenv("GFXLAB_DISABLE_CULLING");
+    if (val && atoi(val) == 1)
+        _cullingEnabled = false;
 }
 
 RenderPass::~RenderPass()
@@ -39,12 +58,107 @@ void RenderPass::SetProgramStates()
  }
 
 
-void RenderPass::Render(bool needs_clear)
+void RenderPass::Render()
 {
     if (_isBlit)
         BlitTextureToSceen();
     else
-        RenderScene(needs_clear);
+        RenderScene();
+    StoreAttachments();
+}
+
+void RenderPass::SetAttachmentActions(int attachment, LoadAction load, StoreAction store)
+{
+    assert(attachment >= 0 && attachment < NUM_ATTACHMENTS);
+    _requestedActions[attachment] = _actions[attachment] = { load, store };
+}
+
+void RenderPass::ResolveAttachmentActions(bool first_use, bool last_default_framebuffer_use)
+{
+    // resolving again, after the passes are rebuilt, starts from the requested actions
+    for (int i = 0; i < NUM_ATTACHMENTS; i++) {
+        auto& a = _actions[i];
+        a = _requestedActions[i];
+        if (a.load == LOAD_DEFAULT) {
+            // a blit covers the whole color buffer and ignores depth and stencil
+            if (_isBlit)
+                a.load = i < MAX_COLOR ? LOAD_DONT_CARE : LOAD_LOAD;
+            else
+                a.load = first_use ? LOAD_CLEAR : LOAD_LOAD;
+        }
+        if (a.store == STORE_DEFAULT) {
+            bool discard = _fbo == 0 && last_default_framebuffer_use && i >= MAX_COLOR;
+            a.store = discard ? STORE_DISCARD : STORE_STORE;
+        }
+    }
+}
+
+static bool InvalidateSupported()
+{
+    static bool supported = GLEW_ARB_invalidate_subdata != 0;
+    return supported;
+}
+
+GLenum RenderPass::GetInvalidateEnum(int attachment) const
+{
+    if (_fbo == 0)
+        return attachment == DEPTH ? GL_DEPTH : attachment == STENCIL ? GL_STENCIL : GL_COLOR;
+    return attachment == DEPTH ? GL_DEPTH_ATTACHMENT : attachment == STENCIL ? GL_STENCIL_ATTACHMENT : GLenum(GL_COLOR_ATTACHMENT0 + attachment);
+}
+
+void RenderPass::LoadAttachments()
+{
+    static const GLfloat clear_color[4] = { 0.1f, 0.1f, 0.1f, 0.1f };
+
+    GLenum invalidate[NUM_ATTACHMENTS];
+    GLsizei count = 0;
+    int num_colors = _useColorBuffer ? _numColorAttachments : 0;
+    for (int i = 0; i < num_colors; i++) {
+        if (_actions[COLOR0 + i].load == LOAD_CLEAR)
+            glClearBufferfv(GL_COLOR, i, clear_color);
+        else if (_actions[COLOR0 + i].load == LOAD_DONT_CARE)
+            invalidate[count++] = GetInvalidateEnum(COLOR0 + i);
+    }
+
+    bool clear_depth = _useDepthBuffer && _actions[DEPTH].load == LOAD_CLEAR;
+    bool clear_stencil = _useStencilBuffer && _actions[STENCIL].load == LOAD_CLEAR;
+    if (clear_depth && clear_stencil)
+        glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+    else if (clear_depth) {
+        const GLfloat depth = 1.0f;
+        glClearBufferfv(GL_DEPTH, 0, &depth);
+    }
+    else if (clear_stencil) {
+        const GLint stencil = 0;
+        glClearBufferiv(GL_STENCIL, 0, &stencil);
+    }
+    if (_useDepthBuffer && _actions[DEPTH].load == LOAD_DONT_CARE)
+        invalidate[count++] = GetInvalidateEnum(DEPTH);
+    if (_useStencilBuffer && _actions[STENCIL].load == LOAD_DONT_CARE)
+        invalidate[count++] = GetInvalidateEnum(STENCIL);
+
+    if (count > 0 && InvalidateSupported())
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, count, invalidate);
+}
+
+void RenderPass::StoreAttachments()
+{
+    // depth and stencil are invalidated whether or not the pass tests against them, the
+    // default framebuffer has both
+    GLenum invalidate[NUM_ATTACHMENTS];
+    GLsizei count = 0;
+    int num_colors = _useColorBuffer ? _numColorAttachments : 0;
+    for (int i = 0; i < num_colors; i++) {
+        if (_actions[COLOR0 + i].store == STORE_DISCARD)
+            invalidate[count++] = GetInvalidateEnum(COLOR0 + i);
+    }
+    if (_actions[DEPTH].store == STORE_DISCARD)
+        invalidate[count++] = GetInvalidateEnum(DEPTH);
+    if (_actions[STENCIL].store == STORE_DISCARD)
+        invalidate[count++] = GetInvalidateEnum(STENCIL);
+
+    if (count > 0 && InvalidateSupported())
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, count, invalidate);
 }
 
 bool RenderPass::CreateFBO(std::vector<std::pair<GLuint, GLenum>>& color_attachments,
@@ -55,7 +169,7 @@ bool RenderPass::CreateFBO(std::vector<std::pair<GLuint, GLenum>>& color_attachm
     bool status = true;
 
     glGenFramebuffers(1, &_fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    GLStateCache::GetInstance()->BindFramebuffer(GL_FRAMEBUFFER, _fbo);
 
     GLuint id;
     GLenum type;
@@ -70,6 +184,7 @@ bool RenderPass::CreateFBO(std::vector<std::pair<GLuint, GLenum>>& color_attachm
             glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, type, id);
     }
     _useColorBuffer = !color_attachments.empty();
+    _numColorAttachments = (int)std::min<size_t>(color_attachments.size(), MAX_COLOR);
 
     id = depth_attachment.first;
     if (id != 0) {
@@ -107,7 +222,7 @@ bool RenderPass::CreateFBO(std::vector<std::pair<GLuint, GLenum>>& color_attachm
         std::cout << "Failed to create FBO: " << glewGetErrorString(glGetError()) << std::endl;
         status = false;
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLStateCache::GetInstance()->BindFramebuffer(GL_FRAMEBUFFER, 0);
 
     return status;
 }
@@ -127,57 +242,299 @@ void RenderPass::BlitTextureToSceen()
 {
     static GLuint vao = ResourceManager::GetInstance()->GetScreenQuadVAO();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glUseProgram(_prog);
-    glBindVertexArray(vao);
-    glDisable(GL_DEPTH_TEST);
-    glBindTexture(GL_TEXTURE_2D, _textureToBlit);
+    GLStateCache::GetInstance()->BindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLStateCache::GetInstance()->UseProgram(_prog);
+    GLStateCache::GetInstance()->BindVertexArray(vao);
+    GLStateCache::GetInstance()->Disable(GL_DEPTH_TEST);
+    GLStateCache::GetInstance()->BindTexture(GL_TEXTURE_2D, _textureToBlit);
+    LoadAttachments();
     glDrawArrays(GL_TRIANGLES, 0, 6);
-    glUseProgram(0);
+    PROFILE_COUNT_DRAW(2);
 }
 
-void RenderPass::RenderScene(bool needs_clear)
+uint64_t RenderPass::MakeSortKey(const Geometry& g, const glm::mat4& view) const
 {
-    for (size_t i = 0; i < _inputTextures.size(); i++) {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_2D, _inputTextures[i]);
+    // program | VAO | texture | depth, so draws sharing state are adjacent and
+    // draws sharing everything go front to back
+    glm::vec3 center = g.GetWorldBounds().Center();
+    float depth = std::max(0.0f, -(view * glm::vec4(center, 1.0f)).z);
+    uint32_t depth_bits;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+    return (uint64_t(_prog & 0xfff) << 52) |
+           (uint64_t(g.GetVAO() & 0xffff) << 36) |
+           (uint64_t(g.GetTexture() & 0xffff) << 20) |
+           uint64_t(depth_bits >> 11);
+}
+
+void RenderPass::Prepare()
+{
+    _cullStats = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    _drawList.clear();
+    if (_isBlit)
+        return;
+
+    auto& scene = _renderer->_scene;
+    _cull = _cullingEnabled && scene->GetCamera() != nullptr;
+    if (_cull) {
+        PROFILE_SCOPE("Cull");
+        auto camera = scene->GetCamera();
+        _viewProj = camera->GetProjectionMatrix() * camera->GetViewMatrix();
+        _eye = camera->GetPosition();
+        scene->Cull(Frustum(_viewProj), _visible);
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    _selectLod = scene->GetCamera() != nullptr && scene->GetLODPixelError() > 0.0f;
+    if (_selectLod) {
+        auto camera = scene->GetCamera();
+        _lodSelector.eye = camera->GetPosition();
+        _lodSelector.pixels_per_unit = camera->GetProjectionMatrix()[1][1] * 0.5f * camera->GetViewHeight();
+        _lodSelector.pixel_error = scene->GetLODPixelError();
+    }
 
-    GLbitfield mask = 0;
-    if (_useColorBuffer) {
-        mask |= GL_COLOR_BUFFER_BIT;
-        glClearColor(0.1f, 0.1f, 0.1f, 0.1f);
+    const OcclusionCuller* occlusion = nullptr;
+    if (_cull && scene->IsOcclusionCullingEnabled()) {
+        PROFILE_SCOPE("Occlusion");
+        occlusion = &_renderer->PrepareOcclusionCulling(_viewProj, _visible);
     }
-    if (_useDepthBuffer) {
-        mask |= GL_DEPTH_BUFFER_BIT;
-        glEnable(GL_DEPTH_TEST);
+
+    // each batch records a contiguous range of the geometries; concatenating the lists keeps
+    // the submission order of a single threaded prepare
+    PROFILE_SCOPE("Prepare");
+    JobSystem* jobs = JobSystem::GetInstance();
+    uint32_t count = (uint32_t)_geometries.size();
+    uint32_t batches = jobs->GetBatchCount(count, PARALLEL_PREPARE_THRESHOLD);
+    if (batches <= 1)
+        PrepareRange(0, count, occlusion, _drawList, _cullStats);
+    else {
+        _threadDrawLists.resize(batches);
+        std::vector<CullStats> stats(batches);
+        jobs->ParallelFor(count, batches, [&](uint32_t batch, uint32_t begin, uint32_t end) {
+            _threadDrawLists[batch].clear();
+            stats[batch] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+            PrepareRange(begin, end, occlusion, _threadDrawLists[batch], stats[batch]);
+        });
+        for (uint32_t t = 0; t < batches; t++) {
+            _drawList.insert(_drawList.end(), _threadDrawLists[t].begin(), _threadDrawLists[t].end());
+            _cullStats.drawn += stats[t].drawn;
+            _cullStats.culled += stats[t].culled;
+            _cullStats.meshlets_drawn += stats[t].meshlets_drawn;
+            _cullStats.meshlets_culled += stats[t].meshlets_culled;
+            _cullStats.occlusion_tested += stats[t].occlusion_tested;
+            _cullStats.occluded += stats[t].occluded;
+        }
     }
-    if (_useStencilBuffer) {
-        mask |= GL_STENCIL_BUFFER_BIT;
-        glEnable(GL_STENCIL_TEST);
+    if (occlusion != nullptr)
+        _renderer->_occlusionCuller.CountTests(_cullStats.occlusion_tested, _cullStats.occluded);
+
+    if (_sortDraws && scene->GetCamera() != nullptr) {
+        PROFILE_SCOPE("Sort");
+        std::stable_sort(_drawList.begin(), _drawList.end(),
+            [](const DrawCommand& a, const DrawCommand& b) { return a.key < b.key; });
+    }
+}
+
+void RenderPass::PrepareRange(uint32_t begin, uint32_t end, const OcclusionCuller* occlusion,
+    std::vector<DrawCommand>& draws, CullStats& stats)
+{
+    auto& scene = _renderer->_scene;
+    bool sort = _sortDraws && scene->GetCamera() != nullptr;
+    glm::mat4 view = sort ? scene->GetCamera()->GetViewMatrix() : glm::mat4(1.0f);
+
+    for (uint32_t i = begin; i < end; i++) {
+        const GeometryPtr& g = _geometries[i];
+        int32_t idx = g->GetSceneIndex();
+        if (_cull && idx >= 0 && !_visible[idx]) {
+            stats.culled++;
+            continue;
+        }
+
+        // only scene geometries are tested; occluders are left out as their bounds always reach their own depth
+        if (occlusion != nullptr && idx >= 0 && !g->IsInstanced() && !g->IsOccluder()) {
+            stats.occlusion_tested++;
+            if (!occlusion->IsVisible(g->GetWorldBounds())) {
+                stats.culled++;
+                stats.occluded++;
+                continue;
+            }
+        }
+
+        DrawCommand cmd;
+        cmd.key = sort ? MakeSortKey(*g, view) : 0;
+        cmd.geom = &g;
+        cmd.flags = 0;
+
+        // culling instances updates their buffers, which waits for the GL thread
+        if (_cull && g->IsInstanced()) {
+            cmd.flags = DRAW_CULL_INSTANCES | DRAW_BY_GEOMETRY;
+            draws.push_back(cmd);
+            continue;
+        }
+
+        if (_selectLod)
+            g->SelectLOD(_lodSelector);
+        const MeshletStats* meshlets = _cull ? g->CullMeshlets(_viewProj, _eye) : nullptr;
+        if (meshlets != nullptr) {
+            stats.meshlets_drawn += meshlets->visible;
+            stats.meshlets_culled += meshlets->meshlets - meshlets->visible;
+            if (meshlets->visible == 0) {
+                stats.culled++;
+                continue;
+            }
+        }
+        stats.drawn++;
+
+        if (g->IsInstanced() || g->GetMeshletRanges() != nullptr)
+            cmd.flags = DRAW_BY_GEOMETRY;
+        else {
+            const GeometryArena::Range& range = g->GetArenaRange();
+            GLuint first;
+            GLsizei count;
+            g->GetLODIndexRange(first, count);
+            cmd.vao = g->GetVAO();
+            cmd.texture = g->GetTexture();
+            cmd.texture_type = g->GetTextureType();
+            cmd.index_type = g->GetIndexType();
+            cmd.first_index = (range.pool >= 0 ? range.first_index : 0) + first;
+            cmd.count = count;
+            cmd.base_vertex = range.pool >= 0 ? range.base_vertex : 0;
+        }
+        draws.push_back(cmd);
+    }
+}
+
+void RenderPass::RenderScene()
+{
+    auto state = GLStateCache::GetInstance();
+    for (size_t i = 0; i < _inputTextures.size(); i++) {
+        state->ActiveTexture(GL_TEXTURE0 + i);
+        state->BindTexture(GL_TEXTURE_2D, _inputTextures[i]);
     }
 
-    if (needs_clear)
-        glClear(mask);
+    state->BindFramebuffer(GL_FRAMEBUFFER, _fbo);
 
-    glUseProgram(_prog);
+    // every pass sets the state it needs instead of resetting it afterwards, so
+    // consecutive passes with the same state issue no calls
+    if (_useDepthBuffer)
+        state->Enable(GL_DEPTH_TEST);
+    else
+        state->Disable(GL_DEPTH_TEST);
+    if (_useStencilBuffer)
+        state->Enable(GL_STENCIL_TEST);
+    else
+        state->Disable(GL_STENCIL_TEST);
+
+    LoadAttachments();
 
-    SetProgramStates();
+    state->UseProgram(_prog);
+
+    {
+        PROFILE_SCOPE("ProgramCallback");
+        SetProgramStates();
+    }
+
+    // replay of the draw list recorded by Prepare, including the per-geometry callbacks
+    PROFILE_SCOPE("Submit");
+    ProgramRenderStates& prog_states = _renderer->_renderStates.program_states[_prog];
+    // arena meshes always draw indirectly when they can, since only the indirect draw fills the
+    // object transforms the pool VAO reads; single draws are batches of one
+    bool multi_draw = GeometryArena::GetInstance()->MultiDrawSupported();
+    for (size_t i = 0; i < _drawList.size(); ) {
+        const DrawCommand& cmd = _drawList[i];
+        if (cmd.flags & DRAW_CULL_INSTANCES) {
+            const GeometryPtr& g = *cmd.geom;
+            uint32_t count = g->CullInstances(_viewProj, _selectLod ? &_lodSelector : nullptr);
+            _cullStats.instances_drawn += count;
+            _cullStats.instances_culled += g->GetInstanceNum() - count;
+            if (count == 0) {
+                _cullStats.culled++;
+                i++;
+                continue;
+            }
+            _cullStats.drawn++;
+        }
+
+        if (multi_draw && (*cmd.geom)->GetArenaRange().pool >= 0) {
+            size_t batch = GetArenaBatchSize(i);
+            DrawArenaBatch(i, batch, prog_states);
+            i += batch;
+            continue;
+        }
 
-    for (auto& g : _geometries) {
         if (_renderer->_perGeometryCallback)
-            _renderer->_perGeometryCallback(g, _renderer->_renderStates.program_states[_prog]);
-        g->Render();
+            _renderer->_perGeometryCallback(*cmd.geom, prog_states);
+        SubmitDraw(cmd);
+        i++;
     }
+}
 
-    glUseProgram(0);
+void RenderPass::SubmitDraw(const DrawCommand& cmd)
+{
+    if (cmd.flags & DRAW_BY_GEOMETRY) {
+        (*cmd.geom)->Render();
+        return;
+    }
 
-    if (_useDepthBuffer)
-        glDisable(GL_DEPTH_TEST);
+    auto state = GLStateCache::GetInstance();
+    if (cmd.texture != 0) {
+        state->ActiveTexture(GL_TEXTURE0);
+        state->BindTexture(cmd.texture_type, cmd.texture);
+    }
+    state->BindVertexArray(cmd.vao);
+    size_t index_size = cmd.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    glDrawElementsBaseVertex(GL_TRIANGLES, cmd.count, cmd.index_type, (GLvoid*)(cmd.first_index * index_size), cmd.base_vertex);
+    PROFILE_COUNT_DRAW(cmd.count / 3);
+}
 
-    if (_useStencilBuffer)
-        glDisable(GL_STENCIL_TEST);
+size_t RenderPass::GetArenaBatchSize(size_t first) const
+{
+    // consecutive arena draws from the same pool with the same texture
+    const Geometry& g = **_drawList[first].geom;
+    if (g.GetArenaRange().pool < 0)
+        return 1;
+
+    size_t last = first + 1;
+    while (last < _drawList.size()) {
+        const Geometry& next = **_drawList[last].geom;
+        if (next.GetArenaRange().pool != g.GetArenaRange().pool || next.GetTexture() != g.GetTexture())
+            break;
+        last++;
+    }
+    return last - first;
+}
 
-}
\ No newline at end of file
+void RenderPass::DrawArenaBatch(size_t first, size_t count, ProgramRenderStates& prog_states)
+{
+    _arenaCommands.clear();
+    _arenaTransforms.clear();
+    for (size_t i = first; i < first + count; i++) {
+        const DrawCommand& cmd = _drawList[i];
+        if (_renderer->_perGeometryCallback)
+            _renderer->_perGeometryCallback(*cmd.geom, prog_states);
+        const Geometry& geom = **cmd.geom;
+        const GeometryArena::Range& range = geom.GetArenaRange();
+        GLuint transform = (GLuint)_arenaTransforms.size();
+        const std::vector<IndexRange>* meshlet_ranges = geom.GetMeshletRanges();
+        if (meshlet_ranges != nullptr) {
+            // one command per run of visible meshlets, all reading the same transform
+            for (auto& r : *meshlet_ranges)
+                _arenaCommands.push_back({ (GLuint)r.count, 1, range.first_index + r.first, range.base_vertex, transform });
+        }
+        else
+            _arenaCommands.push_back({ (GLuint)cmd.count, 1, cmd.first_index, cmd.base_vertex, transform });
+        _arenaTransforms.push_back(geom.GetTransformation());
+    }
+    if (_arenaCommands.empty())
+        return;
+
+    // the object transforms replace the per-geometry model uniform, whatever the callbacks set
+    static const glm::mat4 identity(1.0f);
+    glUniformMatrix4fv(prog_states.builtin[ProgramRenderStates::MODEL], 1, GL_FALSE, &identity[0][0]);
+
+    const Geometry& g = **_drawList[first].geom;
+    if (g.GetTexture() != 0) {
+        GLStateCache::GetInstance()->ActiveTexture(GL_TEXTURE0);
+        GLStateCache::GetInstance()->BindTexture(g.GetTextureType(), g.GetTexture());
+    }
+    GeometryArena::GetInstance()->MultiDraw(g.GetArenaRange().pool, _arenaCommands, _arenaTransforms);
+}
@@ -1,8 +1,52 @@
 #pragma once
 #include "common.h"
+#include "geometry.h"
+#include "geometryarena.h"
+#include "renderstatecallbacks.h"
+
+class OcclusionCuller;
 
 class RenderPass {
 public:
+    struct CullStats {
+        uint32_t drawn;
+        uint32_t culled;
+        uint32_t instances_drawn;
+        uint32_t instances_culled;
+        uint32_t meshlets_drawn;
+        uint32_t meshlets_culled;
+        uint32_t occlusion_tested;
+        uint32_t occluded;          // culled geometries hidden behind occluders
+    };
+
+    // what happens to an attachment's content at the start and the end of the pass; DEFAULT is
+    // resolved by ResolveAttachmentActions
+    enum LoadAction {
+        LOAD_DEFAULT,
+        LOAD_CLEAR,
+        LOAD_LOAD,
+        LOAD_DONT_CARE
+    };
+
+    enum StoreAction {
+        STORE_DEFAULT,
+        STORE_STORE,
+        STORE_DISCARD
+    };
+
+    enum Attachment {
+        COLOR0          = 0,
+        MAX_COLOR       = 8,
+        DEPTH           = MAX_COLOR,
+        STENCIL,
+        NUM_ATTACHMENTS
+    };
+
+    struct AttachmentActions {
+        LoadAction  load;
+        StoreAction store;
+    };
+
     RenderPass(RendererPtr renderer);
 
     ~RenderPass();
@@ -20,25 +64,104 @@ public:
 
     void      SetInputTextures(const std::vector<GLuint>& textures);
 
-    void      Render(bool needs_clear);
+    // culls the geometries and records the draw list of the next Render, on worker threads for
+    // large passes; nothing in it touches GL
+    void      Prepare();
+
+    // draws the list recorded by Prepare
+    void      Render();
+
+    void      SetAttachmentActions(int attachment, LoadAction load, StoreAction store);
+    // the actions set on the pass; LOAD_DEFAULT and STORE_DEFAULT until resolved
+    const AttachmentActions& GetAttachmentActions(int attachment) const { return _requestedActions[attachment]; }
+    // by default the first pass drawing into a framebuffer clears it and later ones load it,
+    // every attachment is stored except the default framebuffer's depth and stencil after the
+    // last pass drawing into it
+    void      ResolveAttachmentActions(bool first_use, bool last_default_framebuffer_use);
 
     void      SetDisplayImage(GLuint texture);
 
+    // shown by the profiler
+    void      SetName(const std::string& name) { _name = name; }
+    const std::string& GetName() const { return _name; }
+
+    // sorts the draws of the pass by program, VAO, texture and depth
+    void      SetSortDraws(bool sort) { _sortDraws = sort; }
+
+    // geometries drawn and culled by the last Prepare and Render calls
+    const CullStats& GetCullStats() const { return _cullStats; }
+
 private:
     void      SetProgramStates();
 
     void      BlitTextureToSceen();
 
-    void      RenderScene(bool needs_clear);
+    void      RenderScene();
+
+    // geometries below this many per batch are prepared on the calling thread
+    static const uint32_t PARALLEL_PREPARE_THRESHOLD = 1024;
+
+    enum DrawFlags {
+        DRAW_CULL_INSTANCES = 1 << 0,   // instance culling uploads buffers, so it waits for the submission
+        DRAW_BY_GEOMETRY    = 1 << 1    // instanced and meshlet draws are issued by the geometry
+    };
+
+    // a draw recorded by Prepare and replayed on the GL thread; the index range is absolute in
+    // the VAO's element buffer
+    struct DrawCommand {
+        uint64_t           key;
+        const GeometryPtr* geom;
+        uint32_t           flags;
+        GLuint             vao;
+        GLuint             texture;
+        GLenum             texture_type;
+        GLenum             index_type;
+        GLuint             first_index;
+        GLsizei            count;
+        GLint              base_vertex;
+    };
+
+    void      PrepareRange(uint32_t begin, uint32_t end, const OcclusionCuller* occlusion,
+                           std::vector<DrawCommand>& draws, CullStats& stats);
+    void      SubmitDraw(const DrawCommand& cmd);
+
+    // clears and invalidates the attachments as their actions request
+    void      LoadAttachments();
+    void      StoreAttachments();
+    GLenum    GetInvalidateEnum(int attachment) const;
+
+    uint64_t  MakeSortKey(const Geometry& g, const glm::mat4& view) const;
+
+    size_t    GetArenaBatchSize(size_t first) const;
+
+    void      DrawArenaBatch(size_t first, size_t count, ProgramRenderStates& prog_states);
 
     RendererPtr                 _renderer;
+    std::string                 _name;
     GLuint                      _prog;
     std::vector<GeometryPtr>    _geometries;
     std::vector<GLuint>         _inputTextures;
     GLuint                      _fbo;
     bool                        _useColorBuffer;
+    int                         _numColorAttachments;
+    AttachmentActions           _requestedActions[NUM_ATTACHMENTS];
+    AttachmentActions           _actions[NUM_ATTACHMENTS];          // resolved
     bool                        _useDepthBuffer;
     bool                        _useStencilBuffer;
     bool                        _isBlit;
     GLuint                      _textureToBlit;
+    bool                        _cullingEnabled;
+    std::vector<uint8_t>        _visible;
+    CullStats                   _cullStats;
+    bool                        _sortDraws;
+    // culling state of the last Prepare, used again by the instance culling while drawing
+    bool                        _cull;
+    glm::mat4                   _viewProj;
+    glm::vec3                   _eye;
+    bool                        _selectLod;
+    LODSelector                 _lodSelector;
+    std::vector<DrawCommand>    _drawList;
+    std::vector<std::vector<DrawCommand>> _threadDrawLists;
+    std::vector<GeometryArena::DrawCommand> _arenaCommands;
+    std::vector<glm::mat4>      _arenaTransforms;
 };
\ No newline at end of file
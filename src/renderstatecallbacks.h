@@ -2,8 +2,55 @@
 #include "common.h"
 
 // data structures for communicating render states between main application and callback DLLs
+
+// FNV-1a hash of a uniform name, evaluated at compile time for literals: UniformID("model")
+constexpr uint32_t UniformID(const char* name, uint32_t hash = 2166136261u)
+{
+    return *name ? UniformID(name + 1, (hash ^ uint32_t((unsigned char)*name)) * 16777619u) : hash;
+}
+
+// an active uniform outside of uniform blocks; arrays are listed once without the "[0]"
+struct UniformInfo {
+    uint32_t                                             id;
+    GLint                                                location;
+    GLenum                                               type;
+    GLint                                                size;
+    std::string                                          name;
+};
+
+struct UniformBlockInfo {
+    uint32_t                                             id;
+    GLuint                                               index;
+    GLint                                                data_size;
+    std::string                                          name;
+};
+
+// uniforms of a program, reflected once when the program is linked
 struct ProgramRenderStates {
-    std::unordered_map<std::string, GLuint>              uniform_locations;
+    // uniforms used by most programs, addressed without any lookup
+    enum BuiltinUniform {
+        MODEL,
+        VIEW,
+        PROJECTION,
+        LIGHT_POS,
+        NUM_BUILTIN_UNIFORMS
+    };
+
+    ProgramRenderStates()                                { std::fill(builtin, builtin + NUM_BUILTIN_UNIFORMS, -1); }
+
+    // location of the uniform with the given UniformID, -1 if it is not active
+    GLint Location(uint32_t id) const
+    {
+        for (auto& u : uniforms) {
+            if (u.id == id)
+                return u.location;
+        }
+        return -1;
+    }
+
+    GLint                                                builtin[NUM_BUILTIN_UNIFORMS];
+    std::vector<UniformInfo>                             uniforms;
+    std::vector<UniformBlockInfo>                        uniform_blocks;
 };
 
 struct RenderStates {
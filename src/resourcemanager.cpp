@@ -1,10 +1,16 @@
 #include "resourcemanager.h"
 #include "mesh.h"
+#include "glstate.h"
+#include "framedata.h"
+#include "geometryarena.h"
+#include "programcache.h"
+#include "jobsystem.h"
 
 #include <SOIL.h>
 
 #include <cstdlib>
 #include <cassert>
+#include <chrono>
 
 std::string ResourceManager::SCREEN_QUAD = "screen_quad";
 
@@ -21,10 +27,106 @@ ResourceManager::ResourceManager()
     _program_deleter      = [](GLuint* id) { glDeleteProgram(*id); };
     _shader_deleter       = [](GLuint* id) { glDeleteShader(*id); };
     _renderbuffer_deleter = [](GLuint* id) { glDeleteRenderbuffers(1, id); };
+
+    char* val = getenv("GFXLAB_DISABLE_MESH_CACHE");
+    _mesh_cache_enabled = !(val && atoi(val) == 1);
+
+    // GFXLAB_VBO_PACKING_BENCHMARK=<iterations> times VBO packing against the reference path on every imported mesh
+    val = getenv("GFXLAB_VBO_PACKING_BENCHMARK");
+    _vbo_packing_benchmark = val ? atoi(val) : 0;
+
+    // linked programs are cached in the user's cache folder unless GFXLAB_PROGRAM_CACHE_FOLDER
+    // names another one
+    val = getenv("GFXLAB_DISABLE_PROGRAM_CACHE");
+    _program_cache_enabled = !(val && atoi(val) == 1);
+    val = getenv("GFXLAB_PROGRAM_CACHE_FOLDER");
+    if (val)
+        _program_cache_folder = val;
+    _program_cache_hits = 0;
+    _program_cache_misses = 0;
 }
 
 
 void ResourceManager::LoadMesh(const std::string& file, MeshPtr& pMesh)
+{
+    LoadMeshData(file, pMesh);
+    UploadMesh(file, pMesh);
+}
+
+void ResourceManager::LoadMeshData(const std::string& file, MeshPtr& pMesh)
+{
+    OpenMesh::IO::Options opt;
+    opt += OpenMesh::IO::Options::VertexNormal;
+    opt += OpenMesh::IO::Options::VertexTexCoord;
+    opt += OpenMesh::IO::Options::VertexColor;
+    opt += OpenMesh::IO::Options::FaceColor;
+    uint32_t import_options = (uint32_t)opt | pMesh->GetImportOptions();
+
+    pMesh->_staging.reset(new Mesh::StagingData);
+    auto& staging = *(pMesh->_staging);
+
+    if (_mesh_cache_enabled) {
+        std::unique_ptr<MeshCache> cache(new MeshCache);
+        if (cache->Open(file, import_options)) {
+            pMesh->LoadFromCache(*cache, staging.info);
+            staging.cache = std::move(cache);
+            return;
+        }
+    }
+
+    ImportMesh(file, pMesh, opt);
+    pMesh->ComputeBoundingBox();
+    if (_vbo_packing_benchmark > 0)
+        pMesh->BenchmarkVBOPacking(_vbo_packing_benchmark, file);
+    pMesh->PopulateVBO(staging.info);
+    if (_mesh_cache_enabled)
+        pMesh->WriteCache(file, import_options, staging.info);
+}
+
+void ResourceManager::UploadMesh(const std::string& file, MeshPtr& pMesh)
+{
+    assert(pMesh->_staging != nullptr);
+    auto& staging = *(pMesh->_staging);
+
+    // meshes imported with different options have different buffers and cannot share a VAO
+    uint32_t import_options = pMesh->GetImportOptions();
+    std::string vao_key = import_options ? file + "#" + std::to_string(import_options) : file;
+
+    // static meshes are suballocated from the shared arena buffers instead of owning a VAO
+    auto arena = GeometryArena::GetInstance();
+    if (arena->IsEnabled() && !pMesh->IsInstanced()) {
+        if (_arena_ranges.find(vao_key) == _arena_ranges.end()) {
+            const void* vertices = staging.cache ? staging.cache->GetVertexData() : staging.info.data.get();
+            const void* indices = staging.cache ? staging.cache->GetIndexData() : staging.info.index_data.data();
+            _arena_ranges[vao_key] = arena->Allocate(staging.info.attribs, staging.info.vertex_size, staging.info.index_type,
+                vertices, staging.info.size / staging.info.vertex_size, indices, pMesh->_numIndices);
+        }
+        pMesh->_arenaRange = _arena_ranges[vao_key];
+        pMesh->_vao = arena->GetVAO(pMesh->_arenaRange.pool);
+    }
+    else if (_vertex_array_objs.find(vao_key) == _vertex_array_objs.end()) {
+        if (staging.cache != nullptr)
+            pMesh->SetupVAO(staging.info, staging.cache->GetVertexData(), staging.cache->GetIndexData());
+        else
+            pMesh->SetupVAO(staging.info, staging.info.data.get(), staging.info.index_data.data());
+        GLuint vao = pMesh->_vao;
+        _vertex_array_objs[vao_key] = std::unique_ptr<GLuint, decltype(_vao_deleter)>(new GLuint(vao), _vao_deleter);
+    }
+    else 
+        pMesh->_vao = *(_vertex_array_objs[vao_key]);
+
+    if (pMesh->IsOccluder()) {
+        if (staging.cache != nullptr)
+            pMesh->ExtractOccluder(staging.info, staging.cache->GetVertexData(), staging.cache->GetIndexData());
+        else
+            pMesh->ExtractOccluder(staging.info, staging.info.data.get(), staging.info.index_data.data());
+    }
+
+    pMesh->_staging.reset();
+    pMesh->SetInitialTransformation();
+}
+
+void ResourceManager::ImportMesh(const std::string& file, MeshPtr& pMesh, OpenMesh::IO::Options opt)
 {
     auto& mesh = pMesh->GetMeshObj();
     mesh.request_vertex_normals();
@@ -36,12 +138,13 @@ void ResourceManager::LoadMesh(const std::string& file, MeshPtr& pMesh)
     mesh.request_face_status();
     mesh.request_halfedge_status();
 
-    OpenMesh::IO::Options opt;
-    opt += OpenMesh::IO::Options::VertexNormal;
-    opt += OpenMesh::IO::Options::VertexTexCoord;
-    opt += OpenMesh::IO::Options::VertexColor;
-    opt += OpenMesh::IO::Options::FaceColor;
-    assert(OpenMesh::IO::read_mesh(mesh, file, opt));
+    // OpenMesh's readers are shared singletons, so file parsing is serialized across loader threads
+    bool loaded;
+    {
+        std::lock_guard<std::mutex> lock(_import_mutex);
+        loaded = OpenMesh::IO::read_mesh(mesh, file, opt);
+    }
+    assert(loaded);
 
     pMesh->DeleteIsolatedVerts();
 
@@ -65,72 +168,96 @@ void ResourceManager::LoadMesh(const std::string& file, MeshPtr& pMesh)
         pMesh->EnablePerFaceShading(true);
     else
         mesh.release_face_colors();
+}
 
-    if (_vertex_array_objs.find(file) == _vertex_array_objs.end()) {
-        pMesh->SetupVAO();
-        GLuint vao = pMesh->_vao;
-        _vertex_array_objs[file] = std::unique_ptr<GLuint, decltype(_vao_deleter)>(new GLuint(vao), _vao_deleter);
+GLuint ResourceManager::LoadTexture(const std::string& type, const std::string& path)
+{
+    if (_texture_objs.find(path) == _texture_objs.end()) {
+        TextureImage image;
+        DecodeTexture(type, path, image);
+        return UploadTexture(type, path, image);
     }
-    else 
-        pMesh->_vao = *(_vertex_array_objs[file]);
-    
-    pMesh->ComputeBoundingBox();
-    pMesh->SetInitialTransformation();
+
+    return *(_texture_objs[path]);
 }
 
-GLuint ResourceManager::LoadTexture(const std::string& type, const std::string& path)
+void ResourceManager::DecodeTexture(const std::string& type, const std::string& path, TextureImage& image)
+{
+    std::vector<std::string> files;
+    if (type == "2D")
+        files.push_back(path);
+    else if (type == "CubeMap") {
+        for (auto f : { "right.jpg", "left.jpg", "top.jpg", "bottom.jpg", "back.jpg", "front.jpg" })
+            files.push_back(path + "/" + f);
+    }
+
+    // the faces of a cube map are decoded as separate jobs
+    image.faces.resize(files.size());
+    JobSystem::GetInstance()->ParallelFor((uint32_t)files.size(), (uint32_t)files.size(), [&](uint32_t, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            auto& face = image.faces[i];
+            face.data = SOIL_load_image(files[i].c_str(), &face.width, &face.height, 0, SOIL_LOAD_RGB);
+            if (!face.data) {
+                std::cout << "Failed to load texture " << files[i] << std::endl;
+                assert(0);
+            }
+        }
+    });
+}
+
+GLuint ResourceManager::UploadTexture(const std::string& type, const std::string& path, TextureImage& image)
 {
     if (_texture_objs.find(path) == _texture_objs.end()) {
         GLuint texobj;
         glGenTextures(1, &texobj);
         _texture_objs[path] = std::unique_ptr<GLuint, decltype(_texobj_deleter)>(new GLuint(texobj), _texobj_deleter);
 
-        unsigned char* image;
-        int width, height;
         if (type == "2D") {
-            image = SOIL_load_image(path.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-            if (!image) {
-                std::cout << "Failed to load texture " << path << std::endl;
-                assert(0);
-            }
-
-            glBindTexture(GL_TEXTURE_2D, texobj);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+            auto& face = image.faces[0];
+            GLStateCache::GetInstance()->BindTexture(GL_TEXTURE_2D, texobj);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, face.width, face.height, 0, GL_RGB, GL_UNSIGNED_BYTE, face.data);
             glGenerateMipmap(GL_TEXTURE_2D);
-            SOIL_free_image_data(image);
 
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            GLStateCache::GetInstance()->BindTexture(GL_TEXTURE_2D, 0);
         }
         else if (type == "CubeMap") {
-            glBindTexture(GL_TEXTURE_CUBE_MAP, texobj);
-            std::vector<std::string> files = { "right.jpg", "left.jpg", "top.jpg", "bottom.jpg", "back.jpg", "front.jpg" };
-            int i = 0;
-
-            for (auto f : files) {
-                std::string full_path = path + "/" + f;
-                image = SOIL_load_image(full_path.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-                if (!image) {
-                    std::cout << "Failed to load texture " << full_path << std::endl;
-                    assert(0);
-                }
-                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i++, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+            GLStateCache::GetInstance()->BindTexture(GL_TEXTURE_CUBE_MAP, texobj);
+            for (size_t i = 0; i < image.faces.size(); i++) {
+                auto& face = image.faces[i];
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, face.width, face.height, 0, GL_RGB, GL_UNSIGNED_BYTE, face.data);
             }
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            GLStateCache::GetInstance()->BindTexture(GL_TEXTURE_CUBE_MAP, 0);
         }
     }
 
+    for (auto& face : image.faces)
+        SOIL_free_image_data(face.data);
+    image.faces.clear();
+
     return *(_texture_objs[path]);
 }
 
+GLuint ResourceManager::FindTexture(const std::string& path)
+{
+    auto it = _texture_objs.find(path);
+    return it == _texture_objs.end() ? 0 : *(it->second);
+}
+
+void ResourceManager::RegisterTexture(const std::string& path, GLuint texobj)
+{
+    assert(_texture_objs.find(path) == _texture_objs.end());
+    _texture_objs[path] = std::unique_ptr<GLuint, decltype(_texobj_deleter)>(new GLuint(texobj), _texobj_deleter);
+}
+
 GLuint  ResourceManager::CreateTexture(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLint format, GLenum type)
 {
     GLuint texobj;
@@ -138,16 +265,28 @@ GLuint  ResourceManager::CreateTexture(GLenum target, GLint level, GLint interna
     auto pTex = std::unique_ptr<GLuint, decltype(_texobj_deleter)>(new GLuint(texobj), _texobj_deleter);
     _fbo_textures.push_back(std::move(pTex));
 
-    glBindTexture(GL_TEXTURE_2D, texobj);
+    GLStateCache::GetInstance()->BindTexture(GL_TEXTURE_2D, texobj);
     glTexImage2D(target, level, internalFormat, width, height, 0, format, type, 0);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GLStateCache::GetInstance()->BindTexture(GL_TEXTURE_2D, 0);
 
     return texobj;
 }
 
+void ResourceManager::ReleaseFBOAttachment(GLenum type, GLuint object)
+{
+    auto release = [object](std::vector<TexObjPtr>& objects) {
+        objects.erase(std::remove_if(objects.begin(), objects.end(),
+            [object](const TexObjPtr& p) { return *p == object; }), objects.end());
+    };
+    if (type == GL_RENDERBUFFER)
+        release(_fbo_renderbuffers);
+    else
+        release(_fbo_textures);
+}
+
 GLuint  ResourceManager::CreateRenderBuffer(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height)
 {
     GLuint rbo;
@@ -155,30 +294,54 @@ GLuint  ResourceManager::CreateRenderBuffer(GLenum target, GLenum internalFormat
     auto pRbo = std::unique_ptr<GLuint, decltype(_renderbuffer_deleter)>(new GLuint(rbo), _renderbuffer_deleter);
     _fbo_renderbuffers.push_back(std::move(pRbo));
 
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+    GLStateCache::GetInstance()->BindRenderbuffer(GL_RENDERBUFFER, rbo);
     glRenderbufferStorage(target, internalFormat, width, height);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    GLStateCache::GetInstance()->BindRenderbuffer(GL_RENDERBUFFER, 0);
 
     return rbo;
 }
 
 
-GLuint ResourceManager::CreateProgram(std::vector<std::string>& shader_files)
+GLuint ResourceManager::CreateProgram(std::vector<std::string>& shader_files, const std::vector<std::string>& defines)
 {
     std::sort(shader_files.begin(), shader_files.end());
     std::string str;
     for (auto& s : shader_files)
         str += s;
+    for (auto& d : defines)
+        str += "#" + d;
 
     if (_programs.find(str) == _programs.end()) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<std::string> stages, sources;
+        for (auto& s : shader_files) {
+            stages.push_back(s.substr(s.find_last_of(".") + 1));
+            sources.push_back(ReadShaderSource(s, defines));
+        }
+
         GLuint program = glCreateProgram();
+        bool use_cache = _program_cache_enabled && ProgramCache::Supported();
+        std::string cache_dir = _program_cache_folder.empty() ? ProgramCache::GetDefaultDir() : _program_cache_folder;
+        uint64_t key = use_cache ? ProgramCache::ComputeKey(stages, sources, defines) : 0;
+
+        bool cache_hit = use_cache && ProgramCache::Load(cache_dir, key, program);
+        GLint success = GL_TRUE;
+        if (!cache_hit) {
+            // a rejected binary may leave the program unusable, start over with a fresh object
+            if (use_cache) {
+                glDeleteProgram(program);
+                program = glCreateProgram();
+                glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
 
-        for (auto& s : shader_files)
-            glAttachShader(program, CreateShader(s));
+            for (size_t i = 0; i < shader_files.size(); i++)
+                glAttachShader(program, CreateShader(shader_files[i], sources[i], defines));
+
+            glLinkProgram(program);
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+        }
 
-        glLinkProgram(program);
-        GLint success;
-        glGetProgramiv(program, GL_LINK_STATUS, &success);
         if (!success)
         {
             GLchar infoLog[512];
@@ -189,7 +352,19 @@ GLuint ResourceManager::CreateProgram(std::vector<std::string>& shader_files)
             program = 0;
         }
         else {
+            if (use_cache && !cache_hit)
+                ProgramCache::Store(cache_dir, key, program);
+
             _programs[str] = std::unique_ptr<GLuint, decltype(_program_deleter)>(new GLuint(program), _program_deleter);
+            _program_sources[program] = { shader_files, defines };
+            ReflectProgram(program, _program_states[program]);
+        }
+
+        if (use_cache) {
+            cache_hit ? _program_cache_hits++ : _program_cache_misses++;
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start);
+            std::cout << "program " << str << (cache_hit ? " restored from cache" : " compiled") << " in "
+                << elapsed.count() / 1000.0 << " ms (cache hits " << _program_cache_hits << ", misses " << _program_cache_misses << ")" << std::endl;
         }
 
         return program;
@@ -199,61 +374,234 @@ GLuint ResourceManager::CreateProgram(std::vector<std::string>& shader_files)
     }
 }
 
-GLuint ResourceManager::CreateShader(const std::string& file)
+void ResourceManager::ReflectProgram(GLuint program, ProgramRenderStates& states)
 {
-    if (_shaders.find(file) == _shaders.end()) {
-        std::string suffix = file.substr(file.find_last_of(".")+1);
-        GLenum type;
-        if (suffix == "vs")
-            type = GL_VERTEX_SHADER;
-        else if (suffix == "fs")
-            type = GL_FRAGMENT_SHADER;
-        else if (suffix == "gs")
-            type = GL_GEOMETRY_SHADER;
-        else {
-            fprintf(stderr, "unsupported shader file suffix %s\n", suffix.c_str());
-            assert(0);
-        }
+    static const char* builtin_names[ProgramRenderStates::NUM_BUILTIN_UNIFORMS] = {
+        "model", "view", "projection", "light_pos"
+    };
+
+    GLint count = 0, max_length = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<GLchar> name(std::max(max_length, 1));
+
+    states.uniforms.clear();
+    for (GLint i = 0; i < count; i++) {
+        UniformInfo info;
+        GLsizei length = 0;
+        glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &info.size, &info.type, name.data());
+        info.name.assign(name.data(), length);
+        if (info.name.size() > 3 && info.name.compare(info.name.size() - 3, 3, "[0]") == 0)
+            info.name.resize(info.name.size() - 3);
+
+        // members of uniform blocks have no location
+        info.location = glGetUniformLocation(program, info.name.c_str());
+        if (info.location < 0)
+            continue;
+        info.id = UniformID(info.name.c_str());
+        states.uniforms.push_back(info);
+    }
+
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+    name.resize(std::max(max_length, 1));
+
+    states.uniform_blocks.clear();
+    for (GLint i = 0; i < count; i++) {
+        UniformBlockInfo info;
+        GLsizei length = 0;
+        glGetActiveUniformBlockName(program, (GLuint)i, (GLsizei)name.size(), &length, name.data());
+        glGetActiveUniformBlockiv(program, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &info.data_size);
+        info.name.assign(name.data(), length);
+        info.index = (GLuint)i;
+        info.id = UniformID(info.name.c_str());
+        states.uniform_blocks.push_back(info);
+
+        if (info.id == UniformID("FrameData"))
+            glUniformBlockBinding(program, info.index, FrameUniforms::BINDING);
+    }
 
-        std::string code;
-        std::ifstream shaderFile;
-        shaderFile.exceptions(std::ifstream::badbit);
-        try {
-            shaderFile.open(file);
-            std::stringstream shaderStream;
-            // Read file's buffer contents into streams
-            shaderStream << shaderFile.rdbuf();
-            // close file handlers
-            shaderFile.close();
-            // Convert stream into string
-            code = shaderStream.str();
-            assert(!code.empty());
+    for (int i = 0; i < ProgramRenderStates::NUM_BUILTIN_UNIFORMS; i++)
+        states.builtin[i] = states.Location(UniformID(builtin_names[i]));
+}
+
+std::string ResourceManager::ReadShaderSource(const std::string& file, const std::vector<std::string>& defines)
+{
+    std::string code;
+    std::ifstream shaderFile;
+    shaderFile.exceptions(std::ifstream::badbit);
+    try {
+        shaderFile.open(file);
+        std::stringstream shaderStream;
+        // Read file's buffer contents into streams
+        shaderStream << shaderFile.rdbuf();
+        // close file handlers
+        shaderFile.close();
+        // Convert stream into string
+        code = shaderStream.str();
+        assert(!code.empty());
+    }
+    catch (std::ifstream::failure e)
+    {
+        std::cout << "failed to read " << file << std::endl;
+    }
+
+    if (!defines.empty()) {
+        // the defines have to follow the #version directive
+        size_t pos = 0;
+        if (code.compare(0, 8, "#version") == 0) {
+            pos = code.find('\n');
+            pos = (pos == std::string::npos) ? code.size() : pos + 1;
         }
-        catch (std::ifstream::failure e)
-        {
-            std::cout << "failed to read " << file << std::endl;
+        std::string define_lines;
+        for (auto& d : defines) {
+            std::string line = d;
+            size_t eq = line.find('=');
+            if (eq != std::string::npos)
+                line[eq] = ' ';
+            define_lines += "#define " + line + "\n";
         }
+        code.insert(pos, define_lines);
+    }
 
-        GLuint shaderId;
+    return code;
+}
+
+static std::string GetShaderKey(const std::string& file, const std::vector<std::string>& defines)
+{
+    std::string key = file;
+    for (auto& d : defines)
+        key += "#" + d;
+    return key;
+}
+
+GLuint ResourceManager::CompileShader(const std::string& file, const std::string& code, bool& success)
+{
+    std::string suffix = file.substr(file.find_last_of(".")+1);
+    GLenum type;
+    if (suffix == "vs")
+        type = GL_VERTEX_SHADER;
+    else if (suffix == "fs")
+        type = GL_FRAGMENT_SHADER;
+    else if (suffix == "gs")
+        type = GL_GEOMETRY_SHADER;
+    else {
+        fprintf(stderr, "unsupported shader file suffix %s\n", suffix.c_str());
+        assert(0);
+    }
+
+    GLuint shaderId;
+    GLint status;
+    const GLchar* shaderCode = code.c_str();
+    GLchar infoLog[512];
+    // Vertex Shader
+    shaderId = glCreateShader(type);
+    glShaderSource(shaderId, 1, &shaderCode, NULL);
+    glCompileShader(shaderId);
+    // Print compile errors if any
+    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &status);
+    if (!status)
+    {
+        glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
+        std::cout << file << ": " << infoLog << std::endl;
+    }
+    success = status == GL_TRUE;
+    return shaderId;
+}
+
+GLuint ResourceManager::CreateShader(const std::string& file, const std::string& code, const std::vector<std::string>& defines)
+{
+    std::string key = GetShaderKey(file, defines);
+
+    if (_shaders.find(key) == _shaders.end()) {
+        bool success;
+        GLuint shaderId = CompileShader(file, code, success);
+        _shaders[key] = std::unique_ptr<GLuint, decltype(_shader_deleter)>(new GLuint(shaderId), _shader_deleter);
+    }
+
+    return *(_shaders[key]);
+}
+
+void ResourceManager::GetShaderFiles(std::vector<std::string>& files) const
+{
+    std::unordered_set<std::string> unique;
+    for (auto& it : _program_sources) {
+        for (auto& f : it.second.shader_files)
+            unique.insert(f);
+    }
+    files.assign(unique.begin(), unique.end());
+}
+
+bool ResourceManager::ReloadShader(const std::string& file, std::vector<GLuint>& relinked)
+{
+    // every define variant of the file is recompiled, then the programs using it are relinked
+    // in place so their ids stay valid; a program whose new shaders fail to link is left as it was
+    std::unordered_map<std::string, GLuint> compiled;
+    bool ok = true;
+    for (auto& it : _program_sources) {
+        auto& src = it.second;
+        if (std::find(src.shader_files.begin(), src.shader_files.end(), file) == src.shader_files.end())
+            continue;
+
+        std::string key = GetShaderKey(file, src.defines);
+        if (compiled.find(key) == compiled.end()) {
+            bool success;
+            GLuint shader = CompileShader(file, ReadShaderSource(file, src.defines), success);
+            if (!success) {
+                glDeleteShader(shader);
+                shader = 0;
+                ok = false;
+            }
+            compiled[key] = shader;
+        }
+        GLuint shader = compiled[key];
+        if (shader == 0)
+            continue;
+
+        GLuint program = it.first;
+        std::vector<GLuint> shaders;
+        for (auto& f : src.shader_files)
+            shaders.push_back(f == file ? shader : CreateShader(f, ReadShaderSource(f, src.defines), src.defines));
+
+        // the new shaders are linked into a scratch program first; the live program is only
+        // touched once they are known to link, as one restored from the binary cache has no
+        // shaders to fall back to
+        GLuint scratch = glCreateProgram();
+        for (GLuint s : shaders)
+            glAttachShader(scratch, s);
+        glLinkProgram(scratch);
         GLint success;
-        const GLchar* shaderCode = code.c_str();
-        GLchar infoLog[512];
-        // Vertex Shader
-        shaderId = glCreateShader(type);
-        glShaderSource(shaderId, 1, &shaderCode, NULL);
-        glCompileShader(shaderId);
-        // Print compile errors if any
-        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
-        if (!success)
-        {
-            glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
-            std::cout << file << ": " << infoLog << std::endl;
+        glGetProgramiv(scratch, GL_LINK_STATUS, &success);
+        if (!success) {
+            GLchar infoLog[512];
+            glGetProgramInfoLog(scratch, 512, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+            glDeleteProgram(scratch);
+            ok = false;
+            continue;
         }
+        glDeleteProgram(scratch);
+
+        GLuint attached[8];
+        GLsizei num_attached = 0;
+        glGetAttachedShaders(program, 8, &num_attached, attached);
+        for (GLsizei i = 0; i < num_attached; i++)
+            glDetachShader(program, attached[i]);
+        for (GLuint s : shaders)
+            glAttachShader(program, s);
+        glLinkProgram(program);
 
-        _shaders[file] = std::unique_ptr<GLuint, decltype(_shader_deleter)>(new GLuint(shaderId), _shader_deleter);
+        _program_states[program] = ProgramRenderStates();
+        ReflectProgram(program, _program_states[program]);
+        relinked.push_back(program);
     }
 
-    return *(_shaders[file]);
+    // the old shader objects are released once no program has them attached
+    for (auto& it : compiled) {
+        if (it.second != 0)
+            _shaders[it.first] = std::unique_ptr<GLuint, decltype(_shader_deleter)>(new GLuint(it.second), _shader_deleter);
+    }
+    return ok;
 }
 
 GLuint  ResourceManager::GetScreenQuadVAO()
@@ -273,14 +621,14 @@ GLuint  ResourceManager::GetScreenQuadVAO()
         GLuint vao, vbo;
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        GLStateCache::GetInstance()->BindVertexArray(vao);
+        GLStateCache::GetInstance()->BindBuffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
-        glBindVertexArray(0);
+        GLStateCache::GetInstance()->BindVertexArray(0);
 
         _vertex_array_objs[SCREEN_QUAD] = std::unique_ptr<GLuint, decltype(_vao_deleter)>(new GLuint(vao), _vao_deleter);
         return vao;
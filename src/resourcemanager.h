@@ -1,20 +1,57 @@
 #pragma once
 
 #include "common.h"
+#include "renderstatecallbacks.h"
+#include "geometryarena.h"
+
+#include <OpenMesh\Core\IO\Options.hh>
 
 
 class ResourceManager {
 public:
+    // decoded but not yet uploaded texture, one face for 2D textures and six for cube maps
+    struct TextureImage {
+        struct Face {
+            unsigned char* data;
+            int            width;
+            int            height;
+        };
+        std::vector<Face> faces;
+    };
+
     static ResourceManager* GetInstance();
     void    LoadMesh(const std::string& file, MeshPtr& pMesh);
+    // LoadMesh split into its thread safe CPU stage and its GL stage which must run on the context thread
+    void    LoadMeshData(const std::string& file, MeshPtr& pMesh);
+    void    UploadMesh(const std::string& file, MeshPtr& pMesh);
     GLuint  LoadTexture(const std::string& type, const std::string& path);
+    // LoadTexture split the same way as LoadMesh; UploadTexture releases the decoded image
+    void    DecodeTexture(const std::string& type, const std::string& path, TextureImage& image);
+    GLuint  UploadTexture(const std::string& type, const std::string& path, TextureImage& image);
+    // texture object loaded from 'path', 0 if it is not resident
+    GLuint  FindTexture(const std::string& path);
+    // takes ownership of a texture loaded elsewhere, e.g. by the TextureStreamer
+    void    RegisterTexture(const std::string& path, GLuint texobj);
     GLuint  CreateTexture(GLenum target, GLint level, GLint internalFormat, GLsizei with, GLsizei height, GLint border, GLint format, GLenum type);
     GLuint  CreateRenderBuffer(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height);
-    GLuint  CreateProgram(std::vector<std::string>& shader_files);
+    // deletes a texture or render buffer made by CreateTexture or CreateRenderBuffer
+    void    ReleaseFBOAttachment(GLenum type, GLuint object);
+    // 'defines' are NAME or NAME=VALUE strings injected after the #version line of every stage
+    GLuint  CreateProgram(std::vector<std::string>& shader_files, const std::vector<std::string>& defines = std::vector<std::string>());
+    // uniforms and uniform blocks of a program created by CreateProgram
+    const ProgramRenderStates& GetProgramStates(GLuint program) { return _program_states[program]; }
+    // recompiles 'file' and relinks the programs using it, which keep their ids; 'relinked'
+    // receives the programs whose uniforms have to be set again. False if anything failed
+    bool    ReloadShader(const std::string& file, std::vector<GLuint>& relinked);
+    void    GetShaderFiles(std::vector<std::string>& files) const;
     GLuint  GetScreenQuadVAO();
 private:
     ResourceManager();
-    GLuint  CreateShader(const std::string& file);
+    std::string ReadShaderSource(const std::string& file, const std::vector<std::string>& defines);
+    GLuint  CreateShader(const std::string& file, const std::string& code, const std::vector<std::string>& defines);
+    GLuint  CompileShader(const std::string& file, const std::string& code, bool& success);
+    void    ReflectProgram(GLuint program, ProgramRenderStates& states);
+    void    ImportMesh(const std::string& file, MeshPtr& pMesh, OpenMesh::IO::Options opt);
 
     static std::string SCREEN_QUAD;
 
@@ -30,6 +67,13 @@ private:
     std::unordered_map<std::string, ProgramPtr> _programs;
     std::vector<TexObjPtr>                      _fbo_textures;
     std::vector<RenderBufferPtr>                _fbo_renderbuffers;
+    std::unordered_map<GLuint, ProgramRenderStates> _program_states;
+    struct ProgramSources {
+        std::vector<std::string> shader_files;
+        std::vector<std::string> defines;
+    };
+    std::unordered_map<GLuint, ProgramSources>  _program_sources;
+    std::unordered_map<std::string, GeometryArena::Range> _arena_ranges;
 
 
     std::function<void(GLuint*)>               _vao_deleter;
@@ -37,4 +81,11 @@ private:
     std::function<void(GLuint*)>               _shader_deleter;
     std::function<void(GLuint*)>               _program_deleter;
     std::function<void(GLuint*)>               _renderbuffer_deleter;
+    bool                                       _mesh_cache_enabled;
+    int                                        _vbo_packing_benchmark;
+    bool                                       _program_cache_enabled;
+    std::string                                _program_cache_folder;
+    uint32_t                                   _program_cache_hits;
+    uint32_t                                   _program_cache_misses;
+    std::mutex                                 _import_mutex;
 };
@@ -0,0 +1,76 @@
+#include "scene.h"
+#include "geometry.h"
+
+void Scene::AddGeometry(GeometryPtr geom)
+{
+    geom->_sceneIndex = (int32_t)_geometries.size();
+    _geometries.push_back(geom);
+    _bvhDirty = true;
+}
+
+void Scene::ReplaceGeometry(const GeometryPtr& old_geom, GeometryPtr geom)
+{
+    int32_t idx = old_geom->_sceneIndex;
+    assert(idx >= 0 && idx < (int32_t)_geometries.size() && _geometries[idx] == old_geom);
+    geom->_sceneIndex = idx;
+    _geometries[idx] = geom;
+    _bvhDirty = true;
+}
+
+void Scene::RemoveGeometry(const GeometryPtr& geom)
+{
+    auto it = std::find(_geometries.begin(), _geometries.end(), geom);
+    if (it == _geometries.end())
+        return;
+    // passes still holding it must not index the visibility of the remaining geometries
+    geom->_sceneIndex = -1;
+    _geometries.erase(it);
+    for (int32_t i = 0; i < (int32_t)_geometries.size(); i++)
+        _geometries[i]->_sceneIndex = i;
+    _bvhDirty = true;
+}
+
+void Scene::UpdateBVH()
+{
+    if (_bvhDirty) {
+        std::vector<AABB> bounds;
+        _bvhItems.clear();
+        _unculled.clear();
+        for (uint32_t i = 0; i < _geometries.size(); i++) {
+            auto& g = _geometries[i];
+            g->_transformDirty = false;
+            if (g->IsInstanced())
+                _unculled.push_back(i);
+            else {
+                _bvhItems.push_back(i);
+                bounds.push_back(g->GetWorldBounds());
+            }
+        }
+        _bvh.Build(bounds);
+        _bvhDirty = false;
+        return;
+    }
+
+    // moved geometries only refit their path to the root
+    for (uint32_t item = 0; item < _bvhItems.size(); item++) {
+        auto& g = _geometries[_bvhItems[item]];
+        if (g->_transformDirty) {
+            _bvh.Refit(item, g->GetWorldBounds());
+            g->_transformDirty = false;
+        }
+    }
+}
+
+void Scene::Cull(const Frustum& frustum, std::vector<uint8_t>& visible, BVH::Stats* stats)
+{
+    UpdateBVH();
+
+    visible.assign(_geometries.size(), 0);
+    for (auto i : _unculled)
+        visible[i] = 1;
+
+    _visibleItems.clear();
+    _bvh.Query(frustum, _visibleItems, stats);
+    for (auto item : _visibleItems)
+        visible[_bvhItems[item]] = 1;
+}
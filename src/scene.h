@@ -1,19 +1,45 @@
 #pragma once
 
 #include "common.h"
+#include "bvh.h"
 
 
 class Scene {
 public:
+    Scene() : _bvhDirty(true), _lodPixelError(1.0f), _occlusionCulling(false) {}
+
     void                            SetCamera(CameraPtr cam)      { _camera = cam; }
     void                            AddLight(LightPtr light)      { _lights.push_back(light); }
-    void                            AddGeometry(GeometryPtr geom) { _geometries.push_back(geom); }
+    void                            AddGeometry(GeometryPtr geom);
+    // used by hot reload; both keep the scene indices dense
+    void                            ReplaceGeometry(const GeometryPtr& old_geom, GeometryPtr geom);
+    void                            RemoveGeometry(const GeometryPtr& geom);
+    void                            ClearLights()                 { _lights.clear(); }
+    // screen space error in pixels up to which meshes switch to a coarser level of detail, 0 disables LODs
+    void                            SetLODPixelError(float pixels) { _lodPixelError = pixels; }
+    float                           GetLODPixelError() const       { return _lodPixelError; }
+    // geometries marked as occluders hide the ones behind them in culling render passes
+    void                            EnableOcclusionCulling(bool enable) { _occlusionCulling = enable; }
+    bool                            IsOcclusionCullingEnabled() const   { return _occlusionCulling; }
     const CameraPtr                 GetCamera()     const         { return _camera; }
     const std::vector<LightPtr>&    GetLights()     const         { return _lights; }
     const std::vector<GeometryPtr>& GetGeometries() const         { return _geometries; }
 
+    // sets visible[GetSceneIndex()] for every geometry overlapping the frustum; instanced
+    // geometries are never culled here
+    void                            Cull(const Frustum& frustum, std::vector<uint8_t>& visible, BVH::Stats* stats = nullptr);
+
 private:
+    void                            UpdateBVH();
+
     CameraPtr                _camera;
     std::vector<LightPtr>    _lights;
     std::vector<GeometryPtr> _geometries;
-};
\ No newline at end of file
+    BVH                      _bvh;
+    std::vector<uint32_t>    _bvhItems;         // BVH item -> scene index
+    std::vector<uint32_t>    _unculled;
+    std::vector<uint32_t>    _visibleItems;
+    bool                     _bvhDirty;
+    float                    _lodPixelError;
+    bool                     _occlusionCulling;
+};
@@ -0,0 +1,272 @@
+#include "texturestreamer.h"
+#include "glstate.h"
+#include "jobsystem.h"
+
+#include <SOIL.h>
+
+#include <cstring>
+
+TextureStreamer* TextureStreamer::GetInstance()
+{
+    static TextureStreamer streamer;
+    return &streamer;
+}
+
+TextureStreamer::TextureStreamer()
+    : _enabled(false),
+    _uploadBudget(DEFAULT_UPLOAD_BUDGET),
+    _uploadedBytes(0),
+    _outstanding(0),
+    _placeholder2D(0),
+    _placeholderCube(0),
+    _stop(false)
+{
+    // the decode jobs run on the job system's workers, which must outlive this instance
+    JobSystem::GetInstance();
+    for (auto& b : _buffers) {
+        b.pbo = 0;
+        b.size = 0;
+        b.fence = nullptr;
+    }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // decodes that have not started are skipped
+    _stop = true;
+    JobSystem::GetInstance()->Wait(_decodes);
+
+    // the context is gone by now, only the decoded images are released
+    for (auto& it : _requested) {
+        for (auto& face : it.second->image.faces)
+            SOIL_free_image_data(face.data);
+    }
+}
+
+void TextureStreamer::Decode(JobPtr job)
+{
+    if (_stop)
+        return;
+
+    ResourceManager::GetInstance()->DecodeTexture(job->type, job->path, job->image);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _decoded.push_back(job);
+}
+
+void TextureStreamer::CreatePlaceholders()
+{
+    const unsigned char white[3] = { 255, 255, 255 };
+    GLStateCache* state = GLStateCache::GetInstance();
+
+    glGenTextures(1, &_placeholder2D);
+    state->BindTexture(GL_TEXTURE_2D, _placeholder2D);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, white);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    state->BindTexture(GL_TEXTURE_2D, 0);
+
+    glGenTextures(1, &_placeholderCube);
+    state->BindTexture(GL_TEXTURE_CUBE_MAP, _placeholderCube);
+    for (int i = 0; i < 6; i++)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, white);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    state->BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    for (auto& b : _buffers)
+        glGenBuffers(1, &b.pbo);
+}
+
+GLuint TextureStreamer::Request(const std::string& type, const std::string& path, ResidentCallback on_resident)
+{
+    GLuint texobj = ResourceManager::GetInstance()->FindTexture(path);
+    if (texobj != 0) {
+        on_resident(texobj);
+        return texobj;
+    }
+
+    if (_placeholder2D == 0)
+        CreatePlaceholders();
+    GLuint placeholder = (type == "CubeMap") ? _placeholderCube : _placeholder2D;
+
+    auto it = _requested.find(path);
+    if (it != _requested.end()) {
+        it->second->callbacks.push_back(on_resident);
+        return placeholder;
+    }
+
+    JobPtr job = std::make_shared<Job>();
+    job->type = type;
+    job->path = path;
+    job->callbacks.push_back(on_resident);
+    job->texobj = 0;
+    job->face = 0;
+    job->row = 0;
+    _requested[path] = job;
+    _outstanding++;
+
+    // background jobs are left to the workers, a frame waiting on culling jobs never decodes
+    JobSystem::GetInstance()->RunBackground([this, job]() { Decode(job); }, &_decodes);
+
+    return placeholder;
+}
+
+int TextureStreamer::AcquireBuffer()
+{
+    for (int i = 0; i < NUM_UPLOAD_BUFFERS; i++) {
+        auto& b = _buffers[i];
+        if (b.fence) {
+            if (glClientWaitSync(b.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                continue;
+            glDeleteSync(b.fence);
+            b.fence = nullptr;
+        }
+        return i;
+    }
+    return -1;
+}
+
+size_t TextureStreamer::UploadRows(Job& job, UploadBuffer& buffer, size_t budget)
+{
+    GLStateCache* state = GLStateCache::GetInstance();
+    GLenum target = (job.type == "CubeMap") ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+
+    if (job.texobj == 0) {
+        // allocate every face up front, the rows are filled in over the following frames
+        glGenTextures(1, &job.texobj);
+        state->BindTexture(target, job.texobj);
+        for (size_t i = 0; i < job.image.faces.size(); i++) {
+            auto& f = job.image.faces[i];
+            GLenum face_target = (target == GL_TEXTURE_CUBE_MAP) ? GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i) : target;
+            glTexImage2D(face_target, 0, GL_RGB, f.width, f.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+
+    auto& face = job.image.faces[job.face];
+    size_t row_size = size_t(face.width) * 3;
+    int rows = std::min(face.height - job.row, std::max(1, int(budget / row_size)));
+    size_t bytes = row_size * rows;
+
+    state->BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+    if (buffer.size < bytes) {
+        buffer.size = std::max(bytes, _uploadBudget);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer.size, nullptr, GL_STREAM_DRAW);
+    }
+
+    // the buffer's fence has signaled, so nothing reads from it anymore
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!dst) {
+        // the rows stay where they are and are retried next frame
+        std::cout << "failed to map the upload buffer of " << job.path << std::endl;
+        state->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return 0;
+    }
+    memcpy(dst, face.data + row_size * job.row, bytes);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    GLenum face_target = (target == GL_TEXTURE_CUBE_MAP) ? GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + job.face) : target;
+    state->BindTexture(target, job.texobj);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(face_target, 0, 0, job.row, face.width, rows, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    state->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    job.row += rows;
+    if (job.row == face.height) {
+        job.row = 0;
+        job.face++;
+    }
+    return bytes;
+}
+
+void TextureStreamer::FinishJob(Job& job)
+{
+    GLStateCache* state = GLStateCache::GetInstance();
+    if (job.type == "2D") {
+        state->BindTexture(GL_TEXTURE_2D, job.texobj);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        state->BindTexture(GL_TEXTURE_2D, 0);
+    }
+    else {
+        state->BindTexture(GL_TEXTURE_CUBE_MAP, job.texobj);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        state->BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    for (auto& face : job.image.faces)
+        SOIL_free_image_data(face.data);
+    job.image.faces.clear();
+
+    // the same image may have been loaded synchronously meanwhile
+    GLuint resident = ResourceManager::GetInstance()->FindTexture(job.path);
+    if (resident != 0) {
+        glDeleteTextures(1, &job.texobj);
+        job.texobj = resident;
+    }
+    else
+        ResourceManager::GetInstance()->RegisterTexture(job.path, job.texobj);
+    for (auto& cb : job.callbacks)
+        cb(job.texobj);
+}
+
+void TextureStreamer::Update()
+{
+    if (_outstanding == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        while (!_decoded.empty()) {
+            JobPtr job = _decoded.front();
+            _decoded.pop_front();
+
+            // a texture that failed to decode keeps its placeholder
+            bool valid = !job->image.faces.empty();
+            for (auto& face : job->image.faces)
+                valid = valid && face.data != nullptr;
+            if (valid)
+                _uploads.push_back(job);
+            else {
+                for (auto& face : job->image.faces)
+                    SOIL_free_image_data(face.data);
+                _requested.erase(job->path);
+                _outstanding--;
+            }
+        }
+    }
+
+    size_t budget = _uploadBudget;
+    while (!_uploads.empty() && budget > 0) {
+        Job& job = *_uploads.front();
+        if (job.face < job.image.faces.size()) {
+            int b = AcquireBuffer();
+            if (b < 0)
+                break;
+            size_t bytes = UploadRows(job, _buffers[b], budget);
+            if (bytes == 0)
+                break;
+            _uploadedBytes += bytes;
+            budget -= std::min(bytes, budget);
+        }
+
+        if (job.face == job.image.faces.size()) {
+            // the rows are sourced from buffers that may still be in flight; the GL orders the
+            // mipmap generation after them, so the texture can be handed out right away
+            FinishJob(job);
+            _requested.erase(job.path);
+            _uploads.pop_front();
+            _outstanding--;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "common.h"
+#include "resourcemanager.h"
+#include "jobsystem.h"
+
+#include <atomic>
+#include <deque>
+
+// Loads image textures in the background. Background jobs decode the images, and Update, called
+// once per frame on the context thread, copies them into the textures through a small pool of
+// pixel unpack buffers. Each buffer is fenced and reused only after the GPU has consumed it.
+// Update stops once the frame's upload budget is spent, so large images are spread over
+// several frames instead of stalling one. Until a texture is complete its users render with a
+// 1x1 white placeholder, and the callback passed to Request hands them the real texture.
+class TextureStreamer {
+public:
+    using ResidentCallback = std::function<void(GLuint)>;
+
+    static const int    NUM_UPLOAD_BUFFERS = 4;
+    static const size_t DEFAULT_UPLOAD_BUDGET = 8 << 20;
+
+    static TextureStreamer* GetInstance();
+
+    void      Enable(bool enable)                { _enabled = enable; }
+    bool      IsEnabled() const                  { return _enabled; }
+    // bytes copied into textures per frame at most, one row is always uploaded to make progress
+    void      SetUploadBudget(size_t bytes)      { _uploadBudget = std::max<size_t>(bytes, 1); }
+
+    // returns the placeholder of 'type' and calls 'on_resident' from Update once the texture is
+    // complete; textures that are already resident are passed to 'on_resident' right away
+    GLuint    Request(const std::string& type, const std::string& path, ResidentCallback on_resident);
+    void      Update();
+    bool      IsIdle() const                     { return _outstanding == 0; }
+    size_t    GetUploadedBytes() const           { return _uploadedBytes; }
+
+private:
+    TextureStreamer();
+    ~TextureStreamer();
+
+    struct Job {
+        std::string                    type;
+        std::string                    path;
+        ResourceManager::TextureImage  image;
+        std::vector<ResidentCallback>  callbacks;
+        GLuint                         texobj;
+        size_t                         face;
+        int                            row;
+    };
+    using JobPtr = std::shared_ptr<Job>;
+
+    struct UploadBuffer {
+        GLuint  pbo;
+        size_t  size;
+        GLsync  fence;
+    };
+
+    // runs as a background job and queues the decoded image for Update
+    void      Decode(JobPtr job);
+    void      CreatePlaceholders();
+    // returns a buffer whose previous upload has completed, or -1 if all are in flight
+    int       AcquireBuffer();
+    // copies up to 'budget' bytes of the next rows of 'job' into the texture through 'buffer';
+    // returns 0 when the buffer could not be mapped and nothing was uploaded
+    size_t    UploadRows(Job& job, UploadBuffer& buffer, size_t budget);
+    void      FinishJob(Job& job);
+
+    bool                                         _enabled;
+    size_t                                       _uploadBudget;
+    size_t                                       _uploadedBytes;
+    size_t                                       _outstanding;
+    GLuint                                       _placeholder2D;
+    GLuint                                       _placeholderCube;
+    UploadBuffer                                 _buffers[NUM_UPLOAD_BUFFERS];
+    std::unordered_map<std::string, JobPtr>      _requested;
+    std::deque<JobPtr>                           _uploads;
+
+    JobSystem::Counter                           _decodes;
+    std::mutex                                   _mutex;
+    std::deque<JobPtr>                           _decoded;
+    std::atomic<bool>                            _stop;
+};
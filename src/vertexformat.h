@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+
+// Storage format of each vertex attribute of a mesh. The float formats give the uncompressed
+// layout. Quantized positions are decoded by folding the bounding box into the model matrix,
+// so apart from NORMAL_OCT16, whose two components the bundled vertex shaders unpack when their
+// program is built with the NORMAL_OCT16 define, the compressed formats need no shader changes.
+struct VertexFormat {
+    enum Position { POSITION_FLOAT, POSITION_UNORM16 };
+    enum Normal   { NORMAL_FLOAT, NORMAL_INT_2_10_10_10, NORMAL_OCT16 };
+    enum Color    { COLOR_FLOAT, COLOR_UNORM8 };
+    enum TexCoord { TEXCOORD_FLOAT, TEXCOORD_HALF };
+
+    VertexFormat()
+        : position(POSITION_FLOAT), normal(NORMAL_FLOAT), color(COLOR_FLOAT), texcoord(TEXCOORD_FLOAT)
+    {}
+
+    // 5 bit key, used as part of the mesh cache key
+    uint32_t Key() const { return position | (normal << 1) | (color << 3) | (texcoord << 4); }
+
+    Position position;
+    Normal   normal;
+    Color    color;
+    TexCoord texcoord;
+};
+
+// layout of one attribute inside an interleaved vertex, as passed to glVertexAttribPointer
+struct VertexAttrib {
+    uint32_t location;
+    uint32_t components;
+    uint32_t type;
+    uint32_t normalized;
+    uint32_t offset;
+};
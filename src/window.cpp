@@ -2,49 +2,75 @@
 #include "camera.h"
 #include "renderer.h"
 #include "renderpass.h"
+#include "profiler.h"
+
+#ifdef GFXLAB_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 Window*           Window::_window = nullptr;
 CameraPtr         Window::_activeCamera = nullptr;
 const char* const Window::TITLE = "GfxLab";
 
-Window* Window::Create(const char* title, int width, int height)
+Window* Window::Create(const char* title, int width, int height, bool headless)
 {
     if (_window == nullptr)
-        _window = new Window(title, width, height);
+        _window = new Window(title, width, height, headless);
     return _window;
 }
 
-Window::Window(const char* title, int width, int height)
+Window::Window(const char* title, int width, int height, bool headless)
     : _width(width),
     _height(height),
     _title(title),
+    _headless(headless),
     _glfwWindow(nullptr),
+    _eglDisplay(nullptr),
+    _eglSurface(nullptr),
+    _eglContext(nullptr),
     _renderer(nullptr)
 {
-    if (!glfwInit()) {
-        std::cout << "glfwInit failed" << std::endl;
-        std::exit(-1);
+#ifdef GFXLAB_EGL
+    if (_headless) {
+        if (!CreateEGLContext()) {
+            std::cout << "failed to create a headless EGL context" << std::endl;
+            std::exit(-1);
+        }
     }
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
-
-    _glfwWindow = glfwCreateWindow(_width, _height, _title.c_str(), NULL, NULL);
-    if (!_glfwWindow) {
-        glfwTerminate();
-        std::cout << "failed to create window" << std::endl;
-        std::exit(-1);
+    else
+#endif
+    {
+        if (!glfwInit()) {
+            std::cout << "glfwInit failed" << std::endl;
+            std::exit(-1);
+        }
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+        glfwWindowHint(GLFW_SAMPLES, 4);
+        if (_headless)
+            glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+
+        _glfwWindow = glfwCreateWindow(_width, _height, _title.c_str(), NULL, NULL);
+        if (!_glfwWindow) {
+            glfwTerminate();
+            std::cout << "failed to create window" << std::endl;
+            std::exit(-1);
+        }
+        glfwMakeContextCurrent(_glfwWindow);
+        // frame times of headless runs must not be bound to the refresh rate
+        if (_headless)
+            glfwSwapInterval(0);
+        glfwSetCursorPosCallback(_glfwWindow, &(Window::cursor_position_callback));
+        glfwSetScrollCallback(_glfwWindow, &(Window::scroll_callback));
+        glfwSetKeyCallback(_glfwWindow, &(Window::key_callback));
+        glfwSetMouseButtonCallback(_glfwWindow, &(Window::mouse_button_callback));
+        glfwSetWindowSizeCallback(_glfwWindow, &(Window::window_size_callback));
+        glfwSetInputMode(_glfwWindow, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
-    glfwMakeContextCurrent(_glfwWindow);
-    glfwSetCursorPosCallback(_glfwWindow, &(Window::cursor_position_callback));
-    glfwSetScrollCallback(_glfwWindow, &(Window::scroll_callback));
-    glfwSetKeyCallback(_glfwWindow, &(Window::key_callback));
-    glfwSetMouseButtonCallback(_glfwWindow, &(Window::mouse_button_callback));
-    glfwSetWindowSizeCallback(_glfwWindow, &(Window::window_size_callback));
-    glfwSetInputMode(_glfwWindow, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
 
     // Initialize GLEW to setup the OpenGL Function pointers
     glewExperimental = GL_TRUE;
@@ -57,24 +83,99 @@ Window::Window(const char* title, int width, int height)
 
 Window::~Window()
 {
+#ifdef GFXLAB_EGL
+    if (_eglDisplay) {
+        eglMakeCurrent(_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (_eglContext)
+            eglDestroyContext(_eglDisplay, _eglContext);
+        if (_eglSurface)
+            eglDestroySurface(_eglDisplay, _eglSurface);
+        eglTerminate(_eglDisplay);
+        return;
+    }
+#endif
     if (_glfwWindow)
         glfwDestroyWindow(_glfwWindow);
     glfwTerminate();
 }
 
-void Window::Display()
+bool Window::CreateEGLContext()
+{
+#ifdef GFXLAB_EGL
+    // the surfaceless platform needs neither a display server nor a GPU, e.g. Mesa llvmpipe
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+        return false;
+    _eglDisplay = display;
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0)
+        return false;
+
+    // the pbuffer stands in for the default framebuffer of the passes rendering to FBO 0
+    const EGLint surface_attribs[] = { EGL_WIDTH, _width, EGL_HEIGHT, _height, EGL_NONE };
+    _eglSurface = eglCreatePbufferSurface(display, config, surface_attribs);
+    if (_eglSurface == EGL_NO_SURFACE)
+        return false;
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+        return false;
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+    _eglContext = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (_eglContext == EGL_NO_CONTEXT)
+        return false;
+
+    return eglMakeCurrent(display, _eglSurface, _eglSurface, _eglContext) == EGL_TRUE;
+#else
+    return false;
+#endif
+}
+
+void Window::Initialize()
 {
     if (_renderer != nullptr)
         _renderer->Initialize();
+}
 
-    while (!glfwWindowShouldClose(_glfwWindow)) {
-        if (_renderer != nullptr)
-            _renderer->Render();
+void Window::RenderFrame()
+{
+    if (_frameCallback)
+        _frameCallback();
+    if (_renderer != nullptr)
+        _renderer->Render();
+    if (_glfwWindow) {
         glfwPollEvents();
         glfwSwapBuffers(_glfwWindow);
     }
 }
 
+void Window::Display()
+{
+    Initialize();
+
+    while (_glfwWindow && !glfwWindowShouldClose(_glfwWindow))
+        RenderFrame();
+    PROFILE_SHUTDOWN();
+}
+
 void Window::cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
 {
     if (_window->_renderer != nullptr) {
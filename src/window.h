@@ -10,14 +10,24 @@ public:
     ~Window();
 
     void           SetRenderer(RendererPtr renderer) { _renderer = renderer; }
+    RendererPtr    GetRenderer() const               { return _renderer; }
     void           Display();
-    static Window* Create(const char* title, int width, int height);
+    // Display split into its steps, for callers that drive the frames themselves
+    void           Initialize();
+    void           RenderFrame();
+    // called at the start of every frame, before the renderer draws it
+    void           SetFrameCallback(std::function<void()> cb) { _frameCallback = cb; }
+    // a headless window renders offscreen: into an EGL pbuffer on the surfaceless platform when
+    // built with GFXLAB_EGL, otherwise into a hidden GLFW window
+    static Window* Create(const char* title, int width, int height, bool headless = false);
+    bool           IsHeadless() const                { return _headless; }
 
     static const int         WIDTH   = 800;
     static const int         HEIGHT  = 600;
     static const char* const TITLE;
 private: 
-    Window(const char* title, int width, int height);
+    Window(const char* title, int width, int height, bool headless);
+    bool              CreateEGLContext();
     static void       cursor_position_callback(GLFWwindow* window, double xpos, double ypos);
     static void       mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
     static void       key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
@@ -30,6 +40,12 @@ private:
     int                      _height;
     std::string              _title;
 
+    bool                     _headless;
     GLFWwindow*              _glfwWindow;
+    // EGLDisplay, EGLSurface and EGLContext of a headless GFXLAB_EGL window
+    void*                    _eglDisplay;
+    void*                    _eglSurface;
+    void*                    _eglContext;
     RendererPtr              _renderer;
+    std::function<void()>    _frameCallback;
 };
\ No newline at end of file
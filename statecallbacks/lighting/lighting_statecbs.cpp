@@ -9,32 +9,20 @@
 
 void SetGlobalStates(const ScenePtr& scene, RenderStates& rs)
 {
-    // find uniform locations
     GLuint prog = rs.programs["lighting"];
-    rs.program_states[prog].uniform_locations["light_pos"] = glGetUniformLocation(prog, "light_pos");
     glUseProgram(prog);
     GLfloat pos[3] = { 0, 0, 10 };
-    glUniform3fv(rs.program_states[prog].uniform_locations["light_pos"], 1, pos);
+    glUniform3fv(rs.program_states[prog].builtin[ProgramRenderStates::LIGHT_POS], 1, pos);
     glUseProgram(0);
-
-    rs.program_states[prog].uniform_locations["model"] = glGetUniformLocation(prog, "model");
-    rs.program_states[prog].uniform_locations["view"] = glGetUniformLocation(prog, "view");
-    rs.program_states[prog].uniform_locations["projection"] = glGetUniformLocation(prog, "projection");
-
-    prog = rs.programs["display_normal"];
-    rs.program_states[prog].uniform_locations["model"] = glGetUniformLocation(prog, "model");
-    rs.program_states[prog].uniform_locations["view"] = glGetUniformLocation(prog, "view");
-    rs.program_states[prog].uniform_locations["projection"] = glGetUniformLocation(prog, "projection");
 }
 
 
 void SetPerProgramStates(const ScenePtr& scene, GLuint prog, RenderStates& rs, ProgramRenderStates& prog_rs)
 {
-    glUniformMatrix4fv(rs.program_states[prog].uniform_locations["view"], 1, GL_FALSE, glm::value_ptr(scene->GetCamera()->GetViewMatrix()));
-    glUniformMatrix4fv(rs.program_states[prog].uniform_locations["projection"], 1, GL_FALSE, glm::value_ptr(scene->GetCamera()->GetProjectionMatrix()));
+    // camera matrices come from the shared FrameData uniform block
 }
 
 void SetPerGeometryStates(const GeometryPtr& geom, ProgramRenderStates& prog_rs)
 {
-    glUniformMatrix4fv((prog_rs.uniform_locations)["model"], 1, GL_FALSE, glm::value_ptr(geom->GetTransformation()));
+    glUniformMatrix4fv(prog_rs.builtin[ProgramRenderStates::MODEL], 1, GL_FALSE, glm::value_ptr(geom->GetTransformation()));
 }
\ No newline at end of file
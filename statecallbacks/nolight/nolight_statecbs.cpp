@@ -9,21 +9,16 @@
 
 void SetGlobalStates(const ScenePtr& scene, RenderStates& rs)
 {
-    // find uniform locations
-    GLuint passthrough_prog = rs.programs["passthrough"];
-    rs.program_states[passthrough_prog].uniform_locations["model"] = glGetUniformLocation(passthrough_prog, "model");
-    rs.program_states[passthrough_prog].uniform_locations["view"] = glGetUniformLocation(passthrough_prog, "view");
-    rs.program_states[passthrough_prog].uniform_locations["projection"] = glGetUniformLocation(passthrough_prog, "projection");
+    // uniform locations are reflected when the programs are linked
 }
 
 
 void SetPerProgramStates(const ScenePtr& scene, GLuint prog, RenderStates& rs, ProgramRenderStates& prog_rs)
 {
-    glUniformMatrix4fv(rs.program_states[prog].uniform_locations["view"], 1, GL_FALSE, glm::value_ptr(scene->GetCamera()->GetViewMatrix()));
-    glUniformMatrix4fv(rs.program_states[prog].uniform_locations["projection"], 1, GL_FALSE, glm::value_ptr(scene->GetCamera()->GetProjectionMatrix()));
+    // camera matrices come from the shared FrameData uniform block
 }
 
 void SetPerGeometryStates(const GeometryPtr& geom, ProgramRenderStates& prog_rs)
 {
-    glUniformMatrix4fv((prog_rs.uniform_locations)["model"], 1, GL_FALSE, glm::value_ptr(geom->GetTransformation()));
+    glUniformMatrix4fv(prog_rs.builtin[ProgramRenderStates::MODEL], 1, GL_FALSE, glm::value_ptr(geom->GetTransformation()));
 }
\ No newline at end of file